@@ -2,6 +2,8 @@
  */
 #include "command.h"
 
+#include <algorithm>
+
 namespace command {
 
 CommandPool::~CommandPool() {}
@@ -56,61 +58,35 @@ int CommandPool::alloc(std::vector<VkCommandBuffer>& buf,
 }
 
 VkCommandBuffer CommandPool::borrowOneTimeBuffer() {
-  std::vector<VkCommandBuffer> v;
-  for (;;) {
-    if (v.size()) {
-      // Clear out v for a second attempt. (It's already empty the first time.)
-      free(v);
-      v.clear();
-    }
-    // Read toBorrow without a lock. Write-after-read safe because toBorrow
-    // has only transition in its lifetime, from NULL to populated, which is
-    // checked below after acquiring the lock.
-    if (!toBorrow) {
-      v.resize(1);
-      // Call alloc() without holding lock.
-      if (alloc(v)) {
-        logE("borrowOneTimeBuffer: alloc failed\n");
-        return VK_NULL_HANDLE;
-      }
-    }
-    // Now transfer v to toBorrow while holding lock.
+  {
     lock_guard_t lock(lockmutex);
-    if (!toBorrow) {
-      toBorrow = v.at(0);
-      borrowCount = 0;
-    } else if (v.size()) {
-      // A race occured: toBorrow was updated. Release lock and try again.
-      continue;
-    }
-    if (borrowCount) {
-      logE("borrowOneTimeBuffer only has one VkCommandBuffer to lend out.\n");
-      logE("This keeps it simple, short, and sweet. Consider whether you\n");
-      logE("need two buffers during init, since it will hide bugs.\n");
-      return VK_NULL_HANDLE;
+    if (!borrowFree.empty()) {
+      borrowed.push_back(borrowFree.back());
+      borrowFree.pop_back();
+      return borrowed.back();
     }
-    borrowCount++;
-    return toBorrow;
   }
+  // Call alloc() without holding lock.
+  std::vector<VkCommandBuffer> v(1);
+  if (alloc(v)) {
+    logE("borrowOneTimeBuffer: alloc failed\n");
+    return VK_NULL_HANDLE;
+  }
+  lock_guard_t lock(lockmutex);
+  borrowed.push_back(v.at(0));
+  return v.at(0);
 }
 
 int CommandPool::unborrowOneTimeBuffer(VkCommandBuffer buf) {
   lock_guard_t lock(lockmutex);
-  if (!toBorrow) {
-    logE("unborrowOneTimeBuffer: borrowOneTimeBuffer was never called!\n");
-    return 1;
-  }
-  if (!borrowCount) {
-    logE("unborrowOneTimeBuffer: borrowOneTimeBuffer has been called.\n");
-    logE("unborrowOneTimeBuffer: but the buffer is not currently borrowed!\n");
-    return 1;
-  }
-  if (buf != toBorrow) {
-    logE("unborrowOneTimeBuffer(%p): wanted buf=%p\n", (void*)buf,
-         (void*)toBorrow);
+  auto it = std::find(borrowed.begin(), borrowed.end(), buf);
+  if (it == borrowed.end()) {
+    logE("unborrowOneTimeBuffer(%p): buf is not currently borrowed!\n",
+         (void*)buf);
     return 1;
   }
-  borrowCount--;
+  borrowed.erase(it);
+  borrowFree.push_back(buf);
   return 0;
 }
 
@@ -14,7 +14,7 @@
  *    * PipelineStage
  *    * Shader
  *
- * 2. The Semaphore, Fence, and Event classes.
+ * 2. The Semaphore, Fence, Event, and QueryPool classes.
  *
  * 3. The CommandPool and CommandBuilder classes.
  */
@@ -25,9 +25,11 @@
 // vk_enum_string_helper.h is not in the default vulkan installation, but is
 // generated by the gn/vendor/vulkansamples/BUILD.gn file in this repo.
 #include <vulkan/vk_enum_string_helper.h>
+#include <functional>
 #include <memory>
 #include <set>
 #include <string>
+#include <thread>
 // "command_builder.h" is #included at the end of the file (see below).
 
 #pragma once
@@ -116,7 +118,8 @@ typedef struct PipelineStage {
   std::string entryPointName;
 
   // You must initialize info.flag, but do not initialize
-  // info.module and info.pName. They will be written by Pipeline::init().
+  // info.module and info.pName. They will be written by
+  // Pipeline::initCreateInfo().
   VkPipelineShaderStageCreateInfo info;
 } PipelineStage;
 
@@ -171,7 +174,8 @@ typedef struct PipelineCreateInfo {
   VkPipelineInputAssemblyStateCreateInfo asci;
 
   // Optionally modify these structures before calling RenderPass::ctorError().
-  // viewports and scissors will be written to viewsci by Pipeline::init().
+  // viewports and scissors will be written to viewsci by
+  // Pipeline::initCreateInfo().
   // Optionally update the viewports and scissors in-place and use them in
   // CommandBuilder::setViewport() and CommandBuilder::setScissor()
   std::vector<VkViewport> viewports;
@@ -191,7 +195,8 @@ typedef struct PipelineCreateInfo {
   std::vector<VkDynamicState> dynamicStates;
 
   // Optionally modify these structures before calling RenderPass::ctorError().
-  // perFramebufColorBlend will be written to cbsci by Pipeline::init().
+  // perFramebufColorBlend will be written to cbsci by
+  // Pipeline::initCreateInfo().
   std::vector<VkPipelineColorBlendAttachmentState> perFramebufColorBlend;
   VkPipelineColorBlendStateCreateInfo cbsci;
 
@@ -243,13 +248,103 @@ typedef struct Pipeline {
   // VkPipelineShaderStageCreateInfo pName contents, just the pointer.
   std::vector<std::string> stageName;
 
-  // init() sets up shaders (and references to them in info.stages), and
-  // creates a VkPipeline. The parent renderPass and this Pipeline's
-  // index in it are passed in as parameters. This method should be
-  // called by RenderPass::ctorError().
-  WARN_UNUSED_RESULT virtual int init(RenderPass& renderPass, size_t subpass_i);
+  // These are referenced by gpci, so they must live until vk is created.
+  std::vector<VkPipelineShaderStageCreateInfo> stageCreateInfo;
+  VkPipelineDynamicStateCreateInfo dsci;
+  VkGraphicsPipelineCreateInfo gpci;
+
+  // initCreateInfo() sets up shaders (and references to them in info.stages),
+  // creates pipelineLayout, and fills in gpci. It does not create vk.
+  // RenderPass::ctorError() calls it for each Pipeline, then calls init().
+  WARN_UNUSED_RESULT int initCreateInfo(RenderPass& renderPass,
+                                        size_t subpass_i);
+
+  // init() is called by RenderPass::ctorError() for each Pipeline, after
+  // initCreateInfo() has filled in gpci. The parent renderPass and this
+  // Pipeline's index in it are passed in as parameters. The default does
+  // nothing. Override this to customize gpci. vk is not created until
+  // RenderPass::ctorError() has called init() on all the pipelines, so it can
+  // create them in a single batch.
+  WARN_UNUSED_RESULT virtual int init(RenderPass& renderPass,
+                                      size_t subpass_i);
 } Pipeline;
 
+// ComputePipelineCreateInfo is the ComputePipeline::info. A compute pipeline
+// has exactly one stage and is not part of any RenderPass.
+typedef struct ComputePipelineCreateInfo {
+  ComputePipelineCreateInfo() {
+    stage.info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  ComputePipelineCreateInfo(ComputePipelineCreateInfo&&) = default;
+  ComputePipelineCreateInfo(const ComputePipelineCreateInfo&) = default;
+
+  // setShader sets the Shader and entryPointName of the compute stage.
+  void setShader(std::shared_ptr<Shader> shader,
+                 std::string entryPointName = "main") {
+    stage.shader = shader;
+    stage.entryPointName = entryPointName;
+  }
+
+  // stage.info.stage is always VK_SHADER_STAGE_COMPUTE_BIT.
+  PipelineStage stage;
+
+  // Use vkCreateDescriptorSetLayout to create layouts, which then
+  // auto-generates VkPipelineLayoutCreateInfo.
+  std::vector<VkDescriptorSetLayout> setLayouts;
+  std::vector<VkPushConstantRange> pushConstants;
+
+  // addSpecialization sets the value of the shader's
+  // "layout(constant_id = constantID)" constant. Note that a bool constant
+  // must be passed in as a VkBool32.
+  template <typename T>
+  void addSpecialization(uint32_t constantID, const T& value) {
+    VkSpecializationMapEntry entry;
+    entry.constantID = constantID;
+    entry.offset = specializationData.size();
+    entry.size = sizeof(value);
+    specializationMap.emplace_back(entry);
+    auto* p = reinterpret_cast<const char*>(&value);
+    specializationData.insert(specializationData.end(), p, p + sizeof(value));
+  }
+
+  // specializationMap describes specializationData. Use addSpecialization().
+  std::vector<VkSpecializationMapEntry> specializationMap;
+  std::vector<char> specializationData;
+
+  VkPipelineCreateFlags flags{0};
+} ComputePipelineCreateInfo;
+
+// ComputePipeline represents a VkPipeline and VkPipelineLayout pair created
+// with vkCreateComputePipelines.
+//
+// Use ComputePipeline in the following order:
+// 1. Instantiate a ComputePipeline.
+// 2. Customize the ComputePipeline::info, including calling setShader(). Or
+//    call science::ShaderLibrary::stage() to do that and reflect the layout.
+// 3. Call ctorError() to create the vulkan objects.
+// 4. Use CommandBuffer::bindComputePipelineAndDescriptors() and dispatch().
+typedef struct ComputePipeline {
+  ComputePipeline(language::Device& dev_);
+  ComputePipeline(ComputePipeline&&) = default;
+  ComputePipeline(const ComputePipeline& other) = delete;
+  virtual ~ComputePipeline();
+
+  // Two-stage constructor: customize info, then call ctorError() to build
+  // pipelineLayout and vk. dev.pipelineCache is used to create vk.
+  WARN_UNUSED_RESULT int ctorError();
+
+  language::Device& dev;
+  ComputePipelineCreateInfo info;
+
+  VkPtr<VkPipelineLayout> pipelineLayout;
+  VkPtr<VkPipeline> vk;
+
+ protected:
+  // Workaround bug in NVidia driver that driver does not keep a copy of the
+  // VkPipelineShaderStageCreateInfo pName contents, just the pointer.
+  std::string stageName;
+} ComputePipeline;
+
 // RenderPass is the main object to set up and control presenting pixels to the
 // screen.
 //
@@ -293,7 +388,21 @@ typedef struct RenderPass {
       size_t subpass_i, std::vector<VkSubpassDependency>& subpassdeps);
 
   // ctorError() initializes each pipeline with their PipelineCreateInfo info.
-  WARN_UNUSED_RESULT int ctorError();
+  // All pipelines are created with a single vkCreateGraphicsPipelines call so
+  // the driver can compile them concurrently.
+  WARN_UNUSED_RESULT int ctorError() {
+    std::vector<RenderPass*> passes{this};
+    return ctorErrorMany(passes);
+  }
+
+  // ctorErrorMany calls ctorError() on several RenderPass objects at once, but
+  // creates all of their pipelines in a single vkCreateGraphicsPipelines call.
+  // This is much faster when loading many pipelines at once.
+  //
+  // If any pipeline fails, every failed pipeline is logged by its index in
+  // passes and in RenderPass::pipelines (in order), then 1 is returned.
+  WARN_UNUSED_RESULT static int ctorErrorMany(
+      const std::vector<RenderPass*>& passes);
 
   VkPtr<VkRenderPass> vk;
 
@@ -313,6 +422,9 @@ typedef struct RenderPass {
  protected:
   friend class CommandPool;
   int updateFormat();
+
+  // initRenderPass creates vk but none of the pipelines.
+  WARN_UNUSED_RESULT int initRenderPass();
 } RenderPass;
 
 // Semaphore represents a GPU-only synchronization operation vs. Fence, below.
@@ -328,6 +440,84 @@ typedef struct Semaphore {
   VkPtr<VkSemaphore> vk;
 } Semaphore;
 
+// TimelineSemaphore is a Semaphore with a uint64_t counter instead of a single
+// signaled bit (VK_KHR_timeline_semaphore). The counter only increases. The
+// host and any queue can signal or wait for a value, so one TimelineSemaphore
+// can replace many Semaphores and Fences in a multi-queue frame.
+//
+// Your app must add VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME to
+// Device::requiredExtensions and set
+// enabledFeatures.timelineSemaphore.timelineSemaphore (a Vulkan 1.1 device is
+// required) before Instance::open(). The Vulkan headers must also define
+// VK_KHR_timeline_semaphore (VK_HEADER_VERSION 124 or later), or ctorError()
+// always fails.
+typedef struct TimelineSemaphore {
+  TimelineSemaphore(language::Device& dev) : vk{dev.dev, vkDestroySemaphore} {
+    vk.allocator = dev.dev.allocator;
+  }
+  // Two-stage constructor: call ctorError() to build TimelineSemaphore.
+  WARN_UNUSED_RESULT int ctorError(language::Device& dev,
+                                   uint64_t initialValue = 0);
+
+  // signal sets the counter to value from the host. value must be greater
+  // than the current value and any pending signal.
+  WARN_UNUSED_RESULT int signal(language::Device& dev, uint64_t value);
+
+  // wait waits until the counter is at least value.
+  // The result MUST be checked for multiple possible success states.
+  WARN_UNUSED_RESULT VkResult wait(language::Device& dev, uint64_t value,
+                                   uint64_t timeoutNanos);
+
+  // getValue reads the current counter value without waiting.
+  WARN_UNUSED_RESULT int getValue(language::Device& dev, uint64_t& value);
+
+  VkPtr<VkSemaphore> vk;
+
+#ifdef VK_KHR_timeline_semaphore
+ protected:
+  PFN_vkSignalSemaphoreKHR pSignalSemaphore{nullptr};
+  PFN_vkWaitSemaphoresKHR pWaitSemaphores{nullptr};
+  PFN_vkGetSemaphoreCounterValueKHR pGetSemaphoreCounterValue{nullptr};
+#endif /*VK_KHR_timeline_semaphore*/
+} TimelineSemaphore;
+
+// SubmitSync lists the semaphores a submit waits on and signals. Each
+// semaphore has a value: 0 for a binary Semaphore, or the counter value for a
+// TimelineSemaphore. See CommandBuffer::submit(size_t, SubmitSync&, VkFence).
+typedef struct SubmitSync {
+  void wait(VkSemaphore s, VkPipelineStageFlags stage, uint64_t value = 0) {
+    waitSemaphores.emplace_back(s);
+    waitStages.emplace_back(stage);
+    waitValues.emplace_back(value);
+  }
+  void wait(Semaphore& s, VkPipelineStageFlags stage) { wait(s.vk, stage); }
+  void wait(TimelineSemaphore& s, VkPipelineStageFlags stage, uint64_t value) {
+    wait(s.vk, stage, value);
+  }
+
+  void signal(VkSemaphore s, uint64_t value = 0) {
+    signalSemaphores.emplace_back(s);
+    signalValues.emplace_back(value);
+  }
+  void signal(Semaphore& s) { signal(s.vk); }
+  void signal(TimelineSemaphore& s, uint64_t value) { signal(s.vk, value); }
+
+  // fill writes the semaphores to info. If any value is nonzero, info.pNext
+  // points to this SubmitSync, so it must outlive the vkQueueSubmit call.
+  WARN_UNUSED_RESULT int fill(VkSubmitInfo& info);
+
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<VkPipelineStageFlags> waitStages;
+  std::vector<uint64_t> waitValues;
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<uint64_t> signalValues;
+
+#ifdef VK_KHR_timeline_semaphore
+ protected:
+  VkTimelineSemaphoreSubmitInfoKHR timelineInfo;
+#endif /*VK_KHR_timeline_semaphore*/
+} SubmitSync;
+
 // Fence represents a GPU-to-CPU synchronization. Fences are the only sync
 // primitive which the CPU can wait on.
 typedef struct Fence {
@@ -353,6 +543,61 @@ typedef struct Fence {
   VkPtr<VkFence> vk;
 } Fence;
 
+// FencePool hands out VkFences and recycles them once they signal, so an app
+// does not create and destroy a Fence for every submit. All fences from a
+// FencePool can be polled or waited on in a single call.
+//
+// FencePool is not thread-safe. Use one per thread.
+class FencePool {
+ public:
+  FencePool(language::Device& dev) : dev(dev) {}
+  FencePool(FencePool&&) = delete;
+  FencePool(const FencePool&) = delete;
+  // ~FencePool waits for all pending fences before destroying them. A fence
+  // from get() that is never submitted must be given back with cancel(), or
+  // ~FencePool (and wait() with no fences) would wait forever.
+  virtual ~FencePool();
+
+  language::Device& dev;
+
+  // get returns an unsignaled VkFence that is now pending. The fence must be
+  // passed to a vkQueueSubmit (or to cancel()), or it never signals. onDone,
+  // if set, is called from poll() or wait() after the fence signals and
+  // before it is recycled. Returns VK_NULL_HANDLE on error.
+  WARN_UNUSED_RESULT VkFence get(std::function<void()> onDone = nullptr);
+
+  // cancel gives back a fence from get() that was not submitted, such as when
+  // vkQueueSubmit failed. Its onDone is not called.
+  WARN_UNUSED_RESULT int cancel(VkFence fence);
+
+  // poll checks all pending fences without blocking. Each signaled fence has
+  // its onDone called and is recycled with a single vkResetFences call. If a
+  // fence cannot be checked, it stays pending and poll() returns 1, but the
+  // fences that did signal are still handled.
+  WARN_UNUSED_RESULT int poll();
+
+  // wait waits for fences, which must all be pending in this FencePool. If
+  // fences is empty, all pending fences are waited on. If waitAll is false,
+  // wait returns as soon as any one of them signals. Then poll() is called.
+  // The result MUST be checked for multiple possible success states.
+  WARN_UNUSED_RESULT VkResult wait(const std::vector<VkFence>& fences,
+                                   bool waitAll, uint64_t timeoutNanos);
+
+  // pendingSize returns the number of fences that have not yet signaled.
+  size_t pendingSize() const { return pending.size(); }
+
+ protected:
+  typedef struct Pending {
+    VkFence fence;
+    std::function<void()> onDone;
+  } Pending;
+  std::vector<Pending> pending;
+  // avail holds fences that are reset and ready for get().
+  std::vector<VkFence> avail;
+  // signaled holds fences found by poll(), to be reset all at once.
+  std::vector<VkFence> signaled;
+};
+
 // Event represents a GPU-only synchronization operation, and must be waited on
 // and set (signalled) within a single queue. Events can also be set (signalled)
 // from the CPU.
@@ -366,6 +611,35 @@ typedef struct Event {
   VkPtr<VkEvent> vk;
 } Event;
 
+// QueryPool holds count queries of a single VkQueryType. Queries must be reset
+// with CommandBuffer::resetQueryPool() before each use, then recorded with
+// CommandBuffer::beginQuery() and endQuery() (or writeTimestamp()).
+typedef struct QueryPool {
+  QueryPool(language::Device& dev) : vk{dev.dev, vkDestroyQueryPool} {
+    vk.allocator = dev.dev.allocator;
+  }
+
+  // Two-stage constructor: call ctorError() to build QueryPool.
+  // pipelineStatistics is only used for VK_QUERY_TYPE_PIPELINE_STATISTICS,
+  // which also requires the pipelineStatisticsQuery feature.
+  WARN_UNUSED_RESULT int ctorError(
+      language::Device& dev, VkQueryType type, uint32_t count,
+      VkQueryPipelineStatisticFlags pipelineStatistics = 0);
+
+  // valuesPerQuery is how many values each query produces: one per bit set in
+  // pipelineStatistics, or 1 for other types.
+  uint32_t valuesPerQuery() const;
+
+  // statisticIndex returns where bit is in the values of a query, or -1 if
+  // bit is not in pipelineStatistics.
+  int statisticIndex(VkQueryPipelineStatisticFlagBits bit) const;
+
+  VkQueryType type{VK_QUERY_TYPE_OCCLUSION};
+  uint32_t count{0};
+  VkQueryPipelineStatisticFlags pipelineStatistics{0};
+  VkPtr<VkQueryPool> vk;
+} QueryPool;
+
 // CommandPool holds a reference to the VkCommandPool from which commands are
 // allocated. Create a CommandPool instance in each thread that submits
 // commands to CommandPool::queueFamily.
@@ -377,9 +651,12 @@ class CommandPool {
  protected:
   language::QueueFamilyProperties* qf_ = nullptr;
   std::recursive_mutex lockmutex;
-  VkCommandBuffer toBorrow{VK_NULL_HANDLE};
-  int borrowCount{0};
+  // borrowFree holds one-time buffers that are ready to be lent out again.
+  std::vector<VkCommandBuffer> borrowFree;
+  // borrowed holds one-time buffers that are currently lent out.
+  std::vector<VkCommandBuffer> borrowed;
   friend class CommandBuffer;
+  friend class SubmitBatch;
 
  public:
   CommandPool(language::Device& dev)
@@ -394,13 +671,28 @@ class CommandPool {
   // Instead of: std::lock_guard<std::recursive_mutex> lock(cpool.lockmutex);
   // Do this:    CommandPool::lock_guard_t             lock(cpool.lockmutex);
   // (Then uses of lock_guard_t do not assume lockmutex is a recursive_mutex.)
+#ifdef VOLCANO_TRACE
+  // With VOLCANO_TRACE, lock_guard_t also records contention on lockmutex.
+  struct LockName {
+    static const char* name() { return "CommandPool::lockmutex"; }
+  };
+  typedef language::trace::TracedLockGuard<std::recursive_mutex, LockName>
+      lock_guard_t;
+#else  /*VOLCANO_TRACE*/
   typedef std::lock_guard<std::recursive_mutex> lock_guard_t;
+#endif /*VOLCANO_TRACE*/
   // unique_lock_t: like c++17's constructor type inference, but in c++11
   // Instead of: std::unique_lock<std::recursive_mutex> lock(cpool.lockmutex);
   // Do this:    CommandPool::unique_lock_t             lock(cpool.lockmutex);
   // (Then uses of unique_lock_t do not assume lockmutex is a recursive_mutex.)
   typedef std::unique_lock<std::recursive_mutex> unique_lock_t;
 
+  // owner can be set to the only thread that records into command buffers
+  // from this CommandPool, such as a per-thread pool. Then
+  // CommandBuffer::RecordingScope does not hold lockmutex while recording.
+  // Leave it as std::thread::id() if the pool is shared between threads.
+  std::thread::id owner;
+
   // Two-stage constructor: set queueFamily, then call ctorError() to build
   // CommandPool. Typically a queueFamily of language::GRAPHICS is wanted.
   WARN_UNUSED_RESULT int ctorError(
@@ -444,19 +736,18 @@ class CommandPool {
     return 0;
   }
 
-  // borrowOneTimeBuffer by default only has one VkCommandBuffer to lend out.
-  // If that is too restrictive, override this method. The default keeps things
-  // simple, short, and sweet.
+  // borrowOneTimeBuffer lends out a VkCommandBuffer for one time use, for
+  // example in a science::SmartCommandBuffer. Several buffers can be lent out
+  // at once, so several one time uploads can be in flight at once.
   //
   // Note that if your app never calls this function, no "one time buffer" is
-  // allocated in this CommandPool. After this is called, the "one time buffer"
-  // is held for the rest of the life of this CommandPool. An empty
-  // VkCommandBuffer uses very little space, though.
+  // allocated in this CommandPool. Returned buffers are held for the rest of
+  // the life of this CommandPool and lent out again. An empty VkCommandBuffer
+  // uses very little space, though.
   virtual VkCommandBuffer borrowOneTimeBuffer();
 
-  // unborrowOneTimeBuffer must be called before the next borrowOneTimeBuffer
-  // in the default implementation. This should help catch bugs in your init
-  // code. If you really want something more complex, override this method.
+  // unborrowOneTimeBuffer returns buf to the CommandPool. It must only be
+  // called after the GPU is done with buf.
   virtual int unborrowOneTimeBuffer(VkCommandBuffer buf);
 
   // updateBuffersAndPass is a convenience method that resizes any vector<T> as
@@ -507,6 +798,7 @@ class CommandPool {
   WARN_UNUSED_RESULT int submitMany(size_t poolQindex,
                                     const std::vector<VkSubmitInfo>& info,
                                     VkFence fence = VK_NULL_HANDLE) {
+    VOLCANO_TRACE_SCOPE("vkQueueSubmit");
     VkResult v = vkQueueSubmit(q(poolQindex), info.size(), info.data(), fence);
     if (v != VK_SUCCESS) {
       logE("%s failed: %d (%s)\n", "vkQueueSubmit", v, string_VkResult(v));
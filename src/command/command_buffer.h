@@ -95,6 +95,23 @@ class CommandBuffer {
                             fence);
   }
 
+  // submit calls vkQueueSubmit on poolQindex with the semaphores in sync,
+  // which may include TimelineSemaphore values. A TimelineSemaphore signal
+  // can replace the VkFence, which is optional.
+  WARN_UNUSED_RESULT int submit(size_t poolQindex, SubmitSync& sync,
+                                VkFence fence = VK_NULL_HANDLE) {
+    CommandPool::lock_guard_t lock(cpool.lockmutex);
+    if (flushLazyBarriers(lock)) return 1;
+    VkSubmitInfo VkInit(submitInfo);
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &vk;
+    if (sync.fill(submitInfo)) {
+      return 1;
+    }
+    return cpool.submitMany(poolQindex, std::vector<VkSubmitInfo>{submitInfo},
+                            fence);
+  }
+
   // reset deallocates and clears the current VkCommandBuffer. Note that in
   // most cases, begin() calls vkBeginCommandBuffer() which implicitly resets
   // the buffer and clears any old data it may have had.
@@ -126,6 +143,32 @@ class CommandBuffer {
     return 0;
   }
 
+  // beginSecondary begins a secondary command buffer that will be executed
+  // inside subpass of pass (see executeCommands). framebuffer is optional but
+  // may help the driver.
+  WARN_UNUSED_RESULT int beginSecondary(
+      RenderPass& pass, uint32_t subpass,
+      VkFramebuffer framebuffer = VK_NULL_HANDLE,
+      VkCommandBufferUsageFlags usageFlags =
+          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) {
+    CommandPool::lock_guard_t lock(cpool.lockmutex);
+    if (flushLazyBarriers(lock)) return 1;
+    VkCommandBufferInheritanceInfo VkInit(cbii);
+    cbii.renderPass = pass.vk;
+    cbii.subpass = subpass;
+    cbii.framebuffer = framebuffer;
+    VkCommandBufferBeginInfo VkInit(cbbi);
+    cbbi.flags = usageFlags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    cbbi.pInheritanceInfo = &cbii;
+    VkResult v = vkBeginCommandBuffer(vk, &cbbi);
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkBeginCommandBuffer", v,
+           string_VkResult(v));
+      return 1;
+    }
+    return 0;
+  }
+
   WARN_UNUSED_RESULT int beginOneTimeUse() {
     return begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
   }
@@ -170,6 +213,21 @@ class CommandBuffer {
     return pushConstants(pipe, stageFlags, offset, sizeof(T), &value);
   }
 
+  WARN_UNUSED_RESULT int pushConstants(ComputePipeline& pipe, uint32_t offset,
+                                       uint32_t size, const void* pValues) {
+    CommandPool::lock_guard_t lock(cpool.lockmutex);
+    if (flushLazyBarriers(lock)) return 1;
+    vkCmdPushConstants(vk, pipe.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       offset, size, pValues);
+    return 0;
+  }
+
+  template <typename T>
+  WARN_UNUSED_RESULT int pushConstants(ComputePipeline& pipe, const T& value,
+                                       uint32_t offset = 0) {
+    return pushConstants(pipe, offset, sizeof(T), &value);
+  }
+
   WARN_UNUSED_RESULT int fillBuffer(VkBuffer dst, VkDeviceSize dstOffset,
                                     VkDeviceSize size, uint32_t data) {
     CommandPool::lock_guard_t lock(cpool.lockmutex);
@@ -391,6 +449,13 @@ class CommandBuffer {
     return 0;
   }
 
+  WARN_UNUSED_RESULT int bindPipeline(ComputePipeline& pipe) {
+    CommandPool::lock_guard_t lock(cpool.lockmutex);
+    if (flushLazyBarriers(lock)) return 1;
+    vkCmdBindPipeline(vk, VK_PIPELINE_BIND_POINT_COMPUTE, pipe.vk);
+    return 0;
+  }
+
   WARN_UNUSED_RESULT int bindDescriptorSets(
       VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet,
       uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets,
@@ -414,10 +479,10 @@ class CommandBuffer {
                               pDynamicOffsets);
   }
   WARN_UNUSED_RESULT int bindComputePipelineAndDescriptors(
-      Pipeline& pipe, uint32_t firstSet, uint32_t descriptorSetCount,
+      ComputePipeline& pipe, uint32_t firstSet, uint32_t descriptorSetCount,
       const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount = 0,
       const uint32_t* pDynamicOffsets = nullptr) {
-    return bindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, pipe) ||
+    return bindPipeline(pipe) ||
            bindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,
                               pipe.pipelineLayout, firstSet, descriptorSetCount,
                               pDescriptorSets, dynamicOffsetCount,
@@ -744,6 +809,184 @@ class CommandBuffer {
     }
     return setScissor(0, scissors.size(), scissors.data());
   }
+
+  // RecordingScope is a fast path for recording many commands from one thread.
+  // ctorError() flushes lazyBarriers once. Its methods then call vkCmd*
+  // directly: no per-command locking, no lazyBarriers check, no error return.
+  //
+  // If cpool.owner is set, the pool has a single owner thread and
+  // RecordingScope is lock-free: ctorError() fails unless it is called on
+  // cpool.owner, and lockmutex is only taken briefly to flush lazyBarriers.
+  // Otherwise RecordingScope locks cpool.lockmutex once and holds it for its
+  // whole lifetime, so other threads using the same CommandPool block until
+  // it is destroyed.
+  //
+  // Example usage:
+  //   command::CommandBuffer::RecordingScope rec(cmdBuffer);
+  //   if (rec.ctorError()) { ... }
+  //   for (auto& obj : objects) {
+  //     rec.bindDescriptorSets(...);
+  //     rec.drawIndexed(...);
+  //   }
+  //
+  // The CommandBuffer methods may still be used on the same thread while a
+  // RecordingScope exists (lockmutex is recursive). But since barrier() is
+  // lazy, call flush() after barrier() and before the next RecordingScope
+  // command.
+  class RecordingScope {
+   public:
+    RecordingScope(CommandBuffer& cmd_) : cmd(cmd_), vk(cmd_.vk) {
+      if (cmd.cpool.owner == std::thread::id()) {
+        lock.reset(new CommandPool::lock_guard_t(cmd.cpool.lockmutex));
+      }
+    }
+    RecordingScope(RecordingScope&&) = delete;
+    RecordingScope(const RecordingScope&) = delete;
+
+    // Two-stage constructor: call ctorError() before any other method, or
+    // pending barrier() calls would be recorded after the commands.
+    WARN_UNUSED_RESULT int ctorError() {
+      if (!lock && cmd.cpool.owner != std::this_thread::get_id()) {
+        logE("BUG: RecordingScope: cpool.owner is a different thread\n");
+        return 1;
+      }
+      return flush();
+    }
+
+    // flush calls vkCmdPipelineBarrier if any barrier() calls are pending.
+    WARN_UNUSED_RESULT int flush() {
+      // lockmutex is recursive, so this is fine even if lock holds it.
+      CommandPool::lock_guard_t flushLock(cmd.cpool.lockmutex);
+      if (cmd.flushLazyBarriers(flushLock)) return 1;
+      vk = cmd.vk;
+      return 0;
+    }
+
+    void bindPipeline(VkPipelineBindPoint bindPoint, Pipeline& pipe) {
+      vkCmdBindPipeline(vk, bindPoint, pipe.vk);
+    }
+    void bindPipeline(ComputePipeline& pipe) {
+      vkCmdBindPipeline(vk, VK_PIPELINE_BIND_POINT_COMPUTE, pipe.vk);
+    }
+    void bindDescriptorSets(VkPipelineBindPoint bindPoint,
+                            VkPipelineLayout layout, uint32_t firstSet,
+                            uint32_t descriptorSetCount,
+                            const VkDescriptorSet* pDescriptorSets,
+                            uint32_t dynamicOffsetCount = 0,
+                            const uint32_t* pDynamicOffsets = nullptr) {
+      vkCmdBindDescriptorSets(vk, bindPoint, layout, firstSet,
+                              descriptorSetCount, pDescriptorSets,
+                              dynamicOffsetCount, pDynamicOffsets);
+    }
+    void bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount,
+                           const VkBuffer* pBuffers,
+                           const VkDeviceSize* pOffsets) {
+      vkCmdBindVertexBuffers(vk, firstBinding, bindingCount, pBuffers,
+                             pOffsets);
+    }
+    void bindIndexBuffer(VkBuffer indexBuf, VkDeviceSize offset,
+                         VkIndexType indexType) {
+      vkCmdBindIndexBuffer(vk, indexBuf, offset, indexType);
+    }
+    void pushConstants(VkPipelineLayout layout, VkShaderStageFlags stageFlags,
+                       uint32_t offset, uint32_t size, const void* pValues) {
+      vkCmdPushConstants(vk, layout, stageFlags, offset, size, pValues);
+    }
+    void draw(uint32_t vertexCount, uint32_t instanceCount,
+              uint32_t firstVertex, uint32_t firstInstance) {
+      vkCmdDraw(vk, vertexCount, instanceCount, firstVertex, firstInstance);
+    }
+    void drawIndexed(uint32_t indexCount, uint32_t instanceCount,
+                     uint32_t firstIndex, int32_t vertexOffset,
+                     uint32_t firstInstance) {
+      vkCmdDrawIndexed(vk, indexCount, instanceCount, firstIndex, vertexOffset,
+                       firstInstance);
+    }
+    void drawIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount,
+                      uint32_t stride) {
+      vkCmdDrawIndirect(vk, buffer, offset, drawCount, stride);
+    }
+    void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset,
+                             uint32_t drawCount, uint32_t stride) {
+      vkCmdDrawIndexedIndirect(vk, buffer, offset, drawCount, stride);
+    }
+    void dispatch(uint32_t groupCountX, uint32_t groupCountY,
+                  uint32_t groupCountZ) {
+      vkCmdDispatch(vk, groupCountX, groupCountY, groupCountZ);
+    }
+    void setViewport(uint32_t firstViewport, uint32_t viewportCount,
+                     const VkViewport* pViewports) {
+      vkCmdSetViewport(vk, firstViewport, viewportCount, pViewports);
+    }
+    void setScissor(uint32_t firstScissor, uint32_t scissorCount,
+                    const VkRect2D* pScissors) {
+      vkCmdSetScissor(vk, firstScissor, scissorCount, pScissors);
+    }
+
+    CommandBuffer& cmd;
+
+   protected:
+    // lock is only set if cpool has no owner.
+    std::unique_ptr<CommandPool::lock_guard_t> lock;
+    VkCommandBuffer vk{VK_NULL_HANDLE};
+  };
+};
+
+// SubmitBatch collects many command buffers and their semaphores, then
+// submits them all with a single vkQueueSubmit in flush(). vkQueueSubmit has a
+// high overhead on several drivers, so use one SubmitBatch per queue and
+// flush() it once per frame instead of calling CommandBuffer::submit often.
+//
+// Consecutive add() calls share one VkSubmitInfo where the semaphores allow
+// it. The arrays keep their capacity across flush() calls, so after the first
+// few frames a SubmitBatch does not allocate.
+class SubmitBatch {
+ public:
+  SubmitBatch(CommandPool& cpool, size_t poolQindex)
+      : cpool(cpool), poolQindex(poolQindex) {}
+
+  CommandPool& cpool;
+  const size_t poolQindex;
+
+  // add appends cmd, which must already have had end() called, and the
+  // semaphores in sync (which are copied).
+  WARN_UNUSED_RESULT int add(CommandBuffer& cmd,
+                             const SubmitSync& sync = SubmitSync()) {
+    return add(cmd.vk, sync);
+  }
+  WARN_UNUSED_RESULT int add(VkCommandBuffer cmd,
+                             const SubmitSync& sync = SubmitSync());
+
+  // flush submits everything added since the last flush(). fence is signalled
+  // when all of it is complete. Even if flush() fails, the batch is cleared.
+  WARN_UNUSED_RESULT int flush(VkFence fence = VK_NULL_HANDLE);
+
+  // clear discards everything added since the last flush().
+  void clear();
+
+  // size returns the number of command buffers waiting for flush().
+  size_t size() const { return cmds.size(); }
+
+ protected:
+  // Group indexes into the arrays below for one VkSubmitInfo. The pointers are
+  // only computed in flush() because the arrays may reallocate in add().
+  typedef struct Group {
+    size_t cmd0, cmdN;
+    size_t wait0, waitN;
+    size_t signal0, signalN;
+  } Group;
+  std::vector<Group> groups;
+  std::vector<VkCommandBuffer> cmds;
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<VkPipelineStageFlags> waitStages;
+  std::vector<uint64_t> waitValues;
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<uint64_t> signalValues;
+  bool hasValues{false};
+  std::vector<VkSubmitInfo> infos;
+#ifdef VK_KHR_timeline_semaphore
+  std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelineInfos;
+#endif /*VK_KHR_timeline_semaphore*/
 };
 
 }  // namespace command
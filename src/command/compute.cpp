@@ -0,0 +1,76 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ */
+#include "command.h"
+
+namespace command {
+
+ComputePipeline::ComputePipeline(language::Device& dev_)
+    : dev(dev_),
+      pipelineLayout(dev_.dev, vkDestroyPipelineLayout),
+      vk(dev_.dev, vkDestroyPipeline) {
+  pipelineLayout.allocator = dev.dev.allocator;
+  vk.allocator = dev.dev.allocator;
+}
+
+ComputePipeline::~ComputePipeline() {}
+
+int ComputePipeline::ctorError() {
+  if (!info.stage.shader) {
+    logE("ComputePipeline::ctorError: call info.setShader() first\n");
+    return 1;
+  }
+  if (info.stage.info.stage != VK_SHADER_STAGE_COMPUTE_BIT) {
+    logE("ComputePipeline::ctorError: stage %s (%d) is not COMPUTE\n",
+         string_VkShaderStageFlagBits(info.stage.info.stage),
+         info.stage.info.stage);
+    return 1;
+  }
+
+  VkPipelineLayoutCreateInfo VkInit(plci);
+  plci.setLayoutCount = info.setLayouts.size();
+  plci.pSetLayouts = info.setLayouts.data();
+  plci.pushConstantRangeCount = info.pushConstants.size();
+  plci.pPushConstantRanges = info.pushConstants.data();
+
+  pipelineLayout.reset(dev.dev);
+  VkResult v = vkCreatePipelineLayout(dev.dev, &plci, dev.dev.allocator,
+                                      &pipelineLayout);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreatePipelineLayout", v,
+         string_VkResult(v));
+    return 1;
+  }
+
+  auto& stage = info.stage;
+  stageName = stage.entryPointName;
+  stage.info.module = stage.shader->vk;
+  stage.info.pName = stageName.c_str();
+  stage.info.pSpecializationInfo = nullptr;
+
+  VkComputePipelineCreateInfo VkInit(cpci);
+  cpci.flags = info.flags;
+  cpci.stage = stage.info;
+  cpci.layout = pipelineLayout;
+
+  // specInfo is only valid during this function, so only cpci points to it.
+  VkSpecializationInfo VkInit(specInfo);
+  if (info.specializationMap.size()) {
+    specInfo.mapEntryCount = info.specializationMap.size();
+    specInfo.pMapEntries = info.specializationMap.data();
+    specInfo.dataSize = info.specializationData.size();
+    specInfo.pData = info.specializationData.data();
+    cpci.stage.pSpecializationInfo = &specInfo;
+  }
+
+  vk.reset(dev.dev);
+  v = vkCreateComputePipelines(dev.dev, dev.pipelineCache, 1, &cpci,
+                               dev.dev.allocator, &vk);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreateComputePipelines", v,
+         string_VkResult(v));
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace command
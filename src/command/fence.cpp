@@ -2,6 +2,8 @@
  */
 #include "command.h"
 
+#include <limits>
+
 namespace command {
 
 int Semaphore::ctorError(language::Device& dev) {
@@ -14,6 +16,155 @@ int Semaphore::ctorError(language::Device& dev) {
   return 0;
 }
 
+#ifdef VK_KHR_timeline_semaphore
+int TimelineSemaphore::ctorError(language::Device& dev, uint64_t initialValue) {
+  bool found = false;
+  for (auto name : dev.requiredExtensions) {
+    if (!strcmp(name, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    logE("TimelineSemaphore: add %s to requiredExtensions before open()\n",
+         VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    return 1;
+  }
+  // open() clears the feature if the device does not support it.
+  if (!dev.enabledFeatures.timelineSemaphore.timelineSemaphore) {
+    logE("TimelineSemaphore: set enabledFeatures.timelineSemaphore before "
+         "open()\n");
+    return 1;
+  }
+  // Extension functions are not exported by the loader. Look them up.
+  pSignalSemaphore = (PFN_vkSignalSemaphoreKHR)vkGetDeviceProcAddr(
+      dev.dev, "vkSignalSemaphoreKHR");
+  pWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(
+      dev.dev, "vkWaitSemaphoresKHR");
+  pGetSemaphoreCounterValue =
+      (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(
+          dev.dev, "vkGetSemaphoreCounterValueKHR");
+  if (!pSignalSemaphore || !pWaitSemaphores || !pGetSemaphoreCounterValue) {
+    logE("TimelineSemaphore: vkGetDeviceProcAddr failed\n");
+    return 1;
+  }
+
+  VkSemaphoreTypeCreateInfoKHR VkInit(stci);
+  stci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  stci.initialValue = initialValue;
+  VkSemaphoreCreateInfo VkInit(sci);
+  sci.pNext = &stci;
+  VkResult v = vkCreateSemaphore(dev.dev, &sci, dev.dev.allocator, &vk);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreateSemaphore", v, string_VkResult(v));
+    return 1;
+  }
+  return 0;
+}
+
+int TimelineSemaphore::signal(language::Device& dev, uint64_t value) {
+  if (!pSignalSemaphore || !vk) {
+    logE("BUG: TimelineSemaphore::signal without ctorError\n");
+    return 1;
+  }
+  VkSemaphoreSignalInfoKHR VkInit(ssi);
+  ssi.semaphore = vk;
+  ssi.value = value;
+  VkResult v = pSignalSemaphore(dev.dev, &ssi);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkSignalSemaphoreKHR", v,
+         string_VkResult(v));
+    return 1;
+  }
+  return 0;
+}
+
+VkResult TimelineSemaphore::wait(language::Device& dev, uint64_t value,
+                                 uint64_t timeoutNanos) {
+  if (!pWaitSemaphores || !vk) {
+    logE("BUG: TimelineSemaphore::wait without ctorError\n");
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  VkSemaphore semaphores[] = {vk};
+  VkSemaphoreWaitInfoKHR VkInit(swi);
+  swi.semaphoreCount = sizeof(semaphores) / sizeof(semaphores[0]);
+  swi.pSemaphores = semaphores;
+  swi.pValues = &value;
+  return pWaitSemaphores(dev.dev, &swi, timeoutNanos);
+}
+
+int TimelineSemaphore::getValue(language::Device& dev, uint64_t& value) {
+  if (!pGetSemaphoreCounterValue || !vk) {
+    logE("BUG: TimelineSemaphore::getValue without ctorError\n");
+    return 1;
+  }
+  VkResult v = pGetSemaphoreCounterValue(dev.dev, vk, &value);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkGetSemaphoreCounterValueKHR", v,
+         string_VkResult(v));
+    return 1;
+  }
+  return 0;
+}
+#else  /*VK_KHR_timeline_semaphore*/
+int TimelineSemaphore::ctorError(language::Device&, uint64_t) {
+  logE("TimelineSemaphore: VK_HEADER_VERSION %d has no %s\n",
+       VK_HEADER_VERSION, "VK_KHR_timeline_semaphore");
+  return 1;
+}
+
+int TimelineSemaphore::signal(language::Device&, uint64_t) {
+  logE("BUG: TimelineSemaphore::signal without ctorError\n");
+  return 1;
+}
+
+VkResult TimelineSemaphore::wait(language::Device&, uint64_t, uint64_t) {
+  logE("BUG: TimelineSemaphore::wait without ctorError\n");
+  return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+int TimelineSemaphore::getValue(language::Device&, uint64_t&) {
+  logE("BUG: TimelineSemaphore::getValue without ctorError\n");
+  return 1;
+}
+#endif /*VK_KHR_timeline_semaphore*/
+
+int SubmitSync::fill(VkSubmitInfo& info) {
+  if (waitSemaphores.size() != waitStages.size() ||
+      waitSemaphores.size() != waitValues.size() ||
+      signalSemaphores.size() != signalValues.size()) {
+    logE("SubmitSync: wait %zu/%zu/%zu signal %zu/%zu lengths differ\n",
+         waitSemaphores.size(), waitStages.size(), waitValues.size(),
+         signalSemaphores.size(), signalValues.size());
+    return 1;
+  }
+  info.waitSemaphoreCount = waitSemaphores.size();
+  info.pWaitSemaphores = waitSemaphores.data();
+  info.pWaitDstStageMask = waitStages.data();
+  info.signalSemaphoreCount = signalSemaphores.size();
+  info.pSignalSemaphores = signalSemaphores.data();
+
+  bool hasValues = false;
+  for (auto v : waitValues) hasValues |= v != 0;
+  for (auto v : signalValues) hasValues |= v != 0;
+  if (!hasValues) {
+    return 0;
+  }
+#ifdef VK_KHR_timeline_semaphore
+  VkOverwrite(timelineInfo);
+  timelineInfo.waitSemaphoreValueCount = waitValues.size();
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  timelineInfo.signalSemaphoreValueCount = signalValues.size();
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
+  timelineInfo.pNext = info.pNext;
+  info.pNext = &timelineInfo;
+  return 0;
+#else  /*VK_KHR_timeline_semaphore*/
+  logE("SubmitSync: TimelineSemaphore values need VK_KHR_timeline_semaphore\n");
+  return 1;
+#endif /*VK_KHR_timeline_semaphore*/
+}
+
 int Fence::ctorError(language::Device& dev) {
   VkFenceCreateInfo VkInit(fci);
   VkResult v = vkCreateFence(dev.dev, &fci, nullptr, &vk);
@@ -45,6 +196,128 @@ VkResult Fence::getStatus(language::Device& dev) {
   return vkGetFenceStatus(dev.dev, vk);
 }
 
+FencePool::~FencePool() {
+  std::vector<VkFence> all;
+  for (auto& p : pending) {
+    all.emplace_back(p.fence);
+  }
+  if (!all.empty()) {
+    VkResult v = vkWaitForFences(dev.dev, all.size(), all.data(), VK_TRUE,
+                                 std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+    }
+  }
+  all.insert(all.end(), avail.begin(), avail.end());
+  all.insert(all.end(), signaled.begin(), signaled.end());
+  for (auto fence : all) {
+    vkDestroyFence(dev.dev, fence, dev.dev.allocator);
+  }
+}
+
+VkFence FencePool::get(std::function<void()> onDone /*= nullptr*/) {
+  VkFence fence = VK_NULL_HANDLE;
+  if (!avail.empty()) {
+    fence = avail.back();
+    avail.pop_back();
+  } else {
+    VkFenceCreateInfo VkInit(fci);
+    VkResult v = vkCreateFence(dev.dev, &fci, dev.dev.allocator, &fence);
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkCreateFence", v, string_VkResult(v));
+      return VK_NULL_HANDLE;
+    }
+  }
+  pending.emplace_back();
+  pending.back().fence = fence;
+  pending.back().onDone = onDone;
+  return fence;
+}
+
+int FencePool::cancel(VkFence fence) {
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (pending.at(i).fence == fence) {
+      // fence was never submitted, so it is still unsignaled.
+      pending.erase(pending.begin() + i);
+      avail.emplace_back(fence);
+      return 0;
+    }
+  }
+  logE("FencePool::cancel: fence is not pending\n");
+  return 1;
+}
+
+int FencePool::poll() {
+  // Move signaled fences out of pending before calling any onDone, because
+  // onDone may call get().
+  std::vector<std::function<void()>> done;
+  int r = 0;
+  size_t keep = 0;
+  for (size_t i = 0; i < pending.size(); i++) {
+    auto& p = pending.at(i);
+    // After an error, stop checking but keep compacting pending.
+    VkResult v = r ? VK_NOT_READY : vkGetFenceStatus(dev.dev, p.fence);
+    if (v != VK_SUCCESS && v != VK_NOT_READY) {
+      logE("%s failed: %d (%s)\n", "vkGetFenceStatus", v, string_VkResult(v));
+      r = 1;
+      v = VK_NOT_READY;
+    }
+    if (v == VK_NOT_READY) {
+      if (keep != i) {
+        pending.at(keep) = std::move(p);
+      }
+      keep++;
+      continue;
+    }
+    signaled.emplace_back(p.fence);
+    if (p.onDone) {
+      done.emplace_back(std::move(p.onDone));
+    }
+  }
+  pending.resize(keep);
+
+  if (!signaled.empty()) {
+    VkResult v = vkResetFences(dev.dev, signaled.size(), signaled.data());
+    if (v != VK_SUCCESS) {
+      // signaled is retried in the next poll() or destroyed by ~FencePool.
+      logE("%s failed: %d (%s)\n", "vkResetFences", v, string_VkResult(v));
+      r = 1;
+    } else {
+      avail.insert(avail.end(), signaled.begin(), signaled.end());
+      signaled.clear();
+    }
+  }
+  // The fences in done did signal, even if poll() failed.
+  for (auto& fn : done) {
+    fn();
+  }
+  return r;
+}
+
+VkResult FencePool::wait(const std::vector<VkFence>& fences, bool waitAll,
+                         uint64_t timeoutNanos) {
+  VkResult v;
+  if (fences.empty()) {
+    if (pending.empty()) {
+      return VK_SUCCESS;
+    }
+    std::vector<VkFence> all;
+    for (auto& p : pending) {
+      all.emplace_back(p.fence);
+    }
+    v = vkWaitForFences(dev.dev, all.size(), all.data(),
+                        waitAll ? VK_TRUE : VK_FALSE, timeoutNanos);
+  } else {
+    v = vkWaitForFences(dev.dev, fences.size(), fences.data(),
+                        waitAll ? VK_TRUE : VK_FALSE, timeoutNanos);
+  }
+  if (v == VK_SUCCESS && poll()) {
+    // poll() already logged the error, which is most likely a lost device.
+    return VK_ERROR_DEVICE_LOST;
+  }
+  return v;
+}
+
 int Event::ctorError(language::Device& dev) {
   VkEventCreateInfo VkInit(eci);
   VkResult v = vkCreateEvent(dev.dev, &eci, nullptr, &vk);
@@ -68,14 +68,16 @@ Pipeline::Pipeline(language::Device& dev_)
       vk(dev_.dev, vkDestroyPipeline) {
   pipelineLayout.allocator = dev.dev.allocator;
   vk.allocator = dev.dev.allocator;
+  VkOverwrite(dsci);
+  VkOverwrite(gpci);
 };
 
-int Pipeline::init(RenderPass& renderPass, size_t subpass_i) {
+int Pipeline::initCreateInfo(RenderPass& renderPass, size_t subpass_i) {
   if (subpass_i >= renderPass.pipelines.size()) {
-    fprintf(
-        stderr,
-        "Pipeline::init(): subpass_i=%zu when renderPass.pipeline.size=%zu\n",
-        subpass_i, renderPass.pipelines.size());
+    fprintf(stderr,
+            "Pipeline::initCreateInfo(): subpass_i=%zu when "
+            "renderPass.pipeline.size=%zu\n",
+            subpass_i, renderPass.pipelines.size());
     return 1;
   }
   if (info.asci.topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN) {
@@ -117,9 +119,9 @@ int Pipeline::init(RenderPass& renderPass, size_t subpass_i) {
     return 1;
   }
 
-  VkGraphicsPipelineCreateInfo VkInit(p);
-  p.flags = info.flags;
-  std::vector<VkPipelineShaderStageCreateInfo> stageCreateInfo;
+  VkOverwrite(gpci);
+  gpci.flags = info.flags;
+  stageCreateInfo.clear();
   stageName.resize(info.stages.size());
   for (size_t i = 0; i < info.stages.size(); i++) {
     auto& stage = info.stages.at(i);
@@ -128,33 +130,27 @@ int Pipeline::init(RenderPass& renderPass, size_t subpass_i) {
     stage.info.pName = stageName.at(i).c_str();
     stageCreateInfo.push_back(stage.info);
   }
-  p.stageCount = stageCreateInfo.size();
-  p.pStages = stageCreateInfo.data();
-  p.pVertexInputState = &info.vertsci;
-  p.pInputAssemblyState = &info.asci;
-  p.pViewportState = &info.viewsci;
-  p.pRasterizationState = &info.rastersci;
-  p.pMultisampleState = &info.multisci;
-  p.pDepthStencilState = &info.depthsci;
-  p.pColorBlendState = &info.cbsci;
-  VkPipelineDynamicStateCreateInfo VkInit(dsci);
+  gpci.stageCount = stageCreateInfo.size();
+  gpci.pStages = stageCreateInfo.data();
+  gpci.pVertexInputState = &info.vertsci;
+  gpci.pInputAssemblyState = &info.asci;
+  gpci.pViewportState = &info.viewsci;
+  gpci.pRasterizationState = &info.rastersci;
+  gpci.pMultisampleState = &info.multisci;
+  gpci.pDepthStencilState = &info.depthsci;
+  gpci.pColorBlendState = &info.cbsci;
+  VkOverwrite(dsci);
   if (info.dynamicStates.size()) {
     dsci.dynamicStateCount = info.dynamicStates.size();
     dsci.pDynamicStates = info.dynamicStates.data();
-    p.pDynamicState = &dsci;
-  }
-  p.layout = pipelineLayout;
-  p.renderPass = renderPass.vk;
-  p.subpass = subpass_i;
-
-  vk.reset(dev.dev);
-  v = vkCreateGraphicsPipelines(dev.dev, VK_NULL_HANDLE, 1, &p, nullptr, &vk);
-  if (v != VK_SUCCESS) {
-    logE("%s failed: %d (%s)\n", "vkCreateGraphicsPipelines", v,
-         string_VkResult(v));
-    return 1;
+    gpci.pDynamicState = &dsci;
   }
+  gpci.layout = pipelineLayout;
+  gpci.renderPass = renderPass.vk;
+  gpci.subpass = subpass_i;
   return 0;
 }
 
+int Pipeline::init(RenderPass&, size_t) { return 0; }
+
 }  // namespace command
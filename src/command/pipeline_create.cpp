@@ -57,6 +57,11 @@ PipelineCreateInfo::PipelineCreateInfo(language::Device& dev) {
   // Default PipelineCreateInfo has one color attachment.
   attach.emplace_back(dev.swapChainInfo.imageFormat,
                       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+  if (dev.isHeadless()) {
+    // PRESENT_SRC_KHR needs VK_KHR_swapchain. Leave the image ready to be
+    // read back from Device::offscreenImages instead.
+    attach.back().vk.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  }
 
   VkOverwrite(subpassDesc);
   subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
@@ -0,0 +1,67 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ */
+#include "command.h"
+
+namespace command {
+
+int QueryPool::ctorError(language::Device& dev, VkQueryType type,
+                         uint32_t count,
+                         VkQueryPipelineStatisticFlags pipelineStatistics) {
+  if (!count) {
+    logE("QueryPool::ctorError: count must be at least 1\n");
+    return 1;
+  }
+  VkQueryPoolCreateInfo VkInit(info);
+  info.queryType = type;
+  info.queryCount = count;
+  if (type == VK_QUERY_TYPE_PIPELINE_STATISTICS) {
+    if (!dev.enabledFeatures.features.pipelineStatisticsQuery) {
+      logE("QueryPool: pipelineStatisticsQuery feature is not enabled\n");
+      return 1;
+    }
+    if (!pipelineStatistics) {
+      logE("QueryPool: PIPELINE_STATISTICS without pipelineStatistics\n");
+      return 1;
+    }
+    info.pipelineStatistics = pipelineStatistics;
+  } else {
+    pipelineStatistics = 0;
+  }
+
+  vk.reset(dev.dev);
+  VkResult v = vkCreateQueryPool(dev.dev, &info, dev.dev.allocator, &vk);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreateQueryPool", v, string_VkResult(v));
+    return 1;
+  }
+  vk.allocator = dev.dev.allocator;
+  this->type = type;
+  this->count = count;
+  this->pipelineStatistics = pipelineStatistics;
+  return 0;
+}
+
+uint32_t QueryPool::valuesPerQuery() const {
+  if (type != VK_QUERY_TYPE_PIPELINE_STATISTICS) {
+    return 1;
+  }
+  uint32_t n = 0;
+  for (auto bits = pipelineStatistics; bits; bits &= bits - 1) {
+    n++;
+  }
+  return n;
+}
+
+int QueryPool::statisticIndex(VkQueryPipelineStatisticFlagBits bit) const {
+  if (!(pipelineStatistics & bit)) {
+    return -1;
+  }
+  // Values are written in order of the bits, lowest bit first.
+  int n = 0;
+  for (auto bits = pipelineStatistics & (bit - 1); bits; bits &= bits - 1) {
+    n++;
+  }
+  return n;
+}
+
+}  // namespace command
@@ -4,7 +4,7 @@
 
 namespace command {
 
-int RenderPass::ctorError() {
+int RenderPass::initRenderPass() {
   if (shaders.empty()) {
     logE("RenderPass::init: 0 shaders\n");
     return 1;
@@ -115,15 +115,77 @@ int RenderPass::ctorError() {
     logE("%s failed: %d (%s)\n", "vkCreateRenderPass", v, string_VkResult(v));
     return 1;
   }
+  return 0;
+}
 
-  for (size_t subpass_i = 0; subpass_i < pipelines.size(); subpass_i++) {
-    auto& pipeline = pipelines.at(subpass_i);
-    if (pipeline->init(*this, subpass_i)) {
-      logE("RenderPass::init pipeline[%zu] init failed\n", subpass_i);
+int RenderPass::ctorErrorMany(const std::vector<RenderPass*>& passes) {
+  if (passes.empty()) {
+    logE("RenderPass::ctorErrorMany: 0 passes\n");
+    return 1;
+  }
+  std::vector<VkGraphicsPipelineCreateInfo> gpci;
+  language::Device* dev = nullptr;
+  for (size_t pass_i = 0; pass_i < passes.size(); pass_i++) {
+    auto& pass = *passes.at(pass_i);
+    if (pass.initRenderPass()) {
+      logE("RenderPass::ctorErrorMany: pass[%zu] failed\n", pass_i);
       return 1;
     }
+    if (!dev) {
+      dev = &pass.pipelines.at(0)->dev;
+    } else if (dev != &pass.pipelines.at(0)->dev) {
+      logE("RenderPass::ctorErrorMany: pass[%zu] is on a different Device\n",
+           pass_i);
+      return 1;
+    }
+    for (size_t subpass_i = 0; subpass_i < pass.pipelines.size();
+         subpass_i++) {
+      auto& pipeline = *pass.pipelines.at(subpass_i);
+      if (pipeline.initCreateInfo(pass, subpass_i) ||
+          pipeline.init(pass, subpass_i)) {
+        logE("RenderPass::init pass[%zu] pipeline[%zu] init failed\n", pass_i,
+             subpass_i);
+        return 1;
+      }
+      gpci.emplace_back(pipeline.gpci);
+    }
   }
-  return 0;
+
+  // The spec guarantees that when vkCreateGraphicsPipelines fails, it still
+  // attempts to create all the pipelines, and the ones that failed are
+  // VK_NULL_HANDLE.
+  std::vector<VkPipeline> vk(gpci.size(), VK_NULL_HANDLE);
+  VkResult v = vkCreateGraphicsPipelines(dev->dev, dev->pipelineCache,
+                                         gpci.size(), gpci.data(), nullptr,
+                                         vk.data());
+  int r = 0;
+  if (v != VK_SUCCESS) {
+    logE("%s(%zu pipelines) failed: %d (%s)\n", "vkCreateGraphicsPipelines",
+         gpci.size(), v, string_VkResult(v));
+    r = 1;
+  }
+
+  // Install every VkPipeline that was created, even if there was an error, so
+  // each one is cleaned up by its own Pipeline::vk.
+  size_t vk_i = 0;
+  for (size_t pass_i = 0; pass_i < passes.size(); pass_i++) {
+    auto& pass = *passes.at(pass_i);
+    for (size_t subpass_i = 0; subpass_i < pass.pipelines.size();
+         subpass_i++, vk_i++) {
+      auto& pipeline = *pass.pipelines.at(subpass_i);
+      pipeline.vk.reset(dev->dev);
+      if (vk.at(vk_i) == VK_NULL_HANDLE) {
+        if (r) {
+          logE("RenderPass::init pass[%zu] pipeline[%zu] init failed\n",
+               pass_i, subpass_i);
+        }
+        continue;
+      }
+      *(&pipeline.vk) = vk.at(vk_i);
+      pipeline.vk.allocator = dev->dev.allocator;
+    }
+  }
+  return r;
 }
 
 }  // namespace command
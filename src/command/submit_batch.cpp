@@ -0,0 +1,116 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * SubmitBatch submits many command buffers with one vkQueueSubmit.
+ */
+#include "command.h"
+
+namespace command {
+
+int SubmitBatch::add(VkCommandBuffer cmd, const SubmitSync& sync) {
+  if (!cmd) {
+    logE("SubmitBatch::add: cmd is VK_NULL_HANDLE\n");
+    return 1;
+  }
+  if (sync.waitSemaphores.size() != sync.waitStages.size() ||
+      sync.waitSemaphores.size() != sync.waitValues.size() ||
+      sync.signalSemaphores.size() != sync.signalValues.size()) {
+    logE("SubmitBatch::add: SubmitSync lengths differ\n");
+    return 1;
+  }
+  bool values = false;
+  for (auto v : sync.waitValues) values |= v != 0;
+  for (auto v : sync.signalValues) values |= v != 0;
+#ifndef VK_KHR_timeline_semaphore
+  // Reject sync before anything is added, so the batch is still valid.
+  if (values) {
+    logE("SubmitBatch: TimelineSemaphore values need %s\n",
+         "VK_KHR_timeline_semaphore");
+    return 1;
+  }
+#endif /*VK_KHR_timeline_semaphore*/
+  // Start a new Group if cmd must wait (the previous cmds in the Group must
+  // not wait too), or if the previous Group signals (cmd must not delay it).
+  if (groups.empty() ||
+      (sync.waitSemaphores.size() && groups.back().cmdN) ||
+      groups.back().signalN) {
+    groups.emplace_back();
+    auto& g = groups.back();
+    g.cmd0 = cmds.size();
+    g.wait0 = waitSemaphores.size();
+    g.signal0 = signalSemaphores.size();
+    g.cmdN = g.waitN = g.signalN = 0;
+  }
+  auto& g = groups.back();
+  cmds.emplace_back(cmd);
+  g.cmdN++;
+  waitSemaphores.insert(waitSemaphores.end(), sync.waitSemaphores.begin(),
+                        sync.waitSemaphores.end());
+  waitStages.insert(waitStages.end(), sync.waitStages.begin(),
+                    sync.waitStages.end());
+  waitValues.insert(waitValues.end(), sync.waitValues.begin(),
+                    sync.waitValues.end());
+  g.waitN += sync.waitSemaphores.size();
+  signalSemaphores.insert(signalSemaphores.end(),
+                          sync.signalSemaphores.begin(),
+                          sync.signalSemaphores.end());
+  signalValues.insert(signalValues.end(), sync.signalValues.begin(),
+                      sync.signalValues.end());
+  g.signalN += sync.signalSemaphores.size();
+  hasValues |= values;
+  return 0;
+}
+
+int SubmitBatch::flush(VkFence fence /*= VK_NULL_HANDLE*/) {
+  if (groups.empty() && fence == VK_NULL_HANDLE) {
+    return 0;
+  }
+#ifdef VK_KHR_timeline_semaphore
+  timelineInfos.resize(hasValues ? groups.size() : 0);
+#endif /*VK_KHR_timeline_semaphore*/
+  infos.resize(groups.size());
+  for (size_t i = 0; i < groups.size(); i++) {
+    auto& g = groups.at(i);
+    auto& info = infos.at(i);
+    VkOverwrite(info);
+    info.commandBufferCount = g.cmdN;
+    info.pCommandBuffers = cmds.data() + g.cmd0;
+    info.waitSemaphoreCount = g.waitN;
+    info.pWaitSemaphores = waitSemaphores.data() + g.wait0;
+    info.pWaitDstStageMask = waitStages.data() + g.wait0;
+    info.signalSemaphoreCount = g.signalN;
+    info.pSignalSemaphores = signalSemaphores.data() + g.signal0;
+#ifdef VK_KHR_timeline_semaphore
+    if (hasValues) {
+      auto& t = timelineInfos.at(i);
+      VkOverwrite(t);
+      t.waitSemaphoreValueCount = g.waitN;
+      t.pWaitSemaphoreValues = waitValues.data() + g.wait0;
+      t.signalSemaphoreValueCount = g.signalN;
+      t.pSignalSemaphoreValues = signalValues.data() + g.signal0;
+      info.pNext = &t;
+    }
+#endif /*VK_KHR_timeline_semaphore*/
+  }
+
+  int r;
+  {
+    CommandPool::lock_guard_t lock(cpool.lockmutex);
+    r = cpool.submitMany(poolQindex, infos, fence);
+  }
+  clear();
+  return r;
+}
+
+void SubmitBatch::clear() {
+  // clear() keeps the capacity for the next frame.
+  groups.clear();
+  cmds.clear();
+  waitSemaphores.clear();
+  waitStages.clear();
+  waitValues.clear();
+  signalSemaphores.clear();
+  signalValues.clear();
+  hasValues = false;
+}
+
+}  // namespace command
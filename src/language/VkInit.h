@@ -156,11 +156,26 @@ inline void _VkInit(VkSubpassDependency& spd) {
   // VkSubpassDependency has no 'sType'.
 }
 
+inline void _VkInit(VkPipelineCacheCreateInfo& pcci) {
+  memset(&pcci, 0, sizeof(pcci));
+  pcci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+}
+
 inline void _VkInit(VkGraphicsPipelineCreateInfo& gpci) {
   memset(&gpci, 0, sizeof(gpci));
   gpci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 }
 
+inline void _VkInit(VkComputePipelineCreateInfo& cpci) {
+  memset(&cpci, 0, sizeof(cpci));
+  cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+}
+
+inline void _VkInit(VkSpecializationInfo& si) {
+  memset(&si, 0, sizeof(si));
+  // VkSpecializationInfo has no 'sType'.
+}
+
 inline void _VkInit(VkFramebufferCreateInfo& fbci) {
   memset(&fbci, 0, sizeof(fbci));
   fbci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -218,6 +233,11 @@ inline void _VkInit(VkCommandBufferBeginInfo& cbbi) {
   cbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 }
 
+inline void _VkInit(VkCommandBufferInheritanceInfo& cbii) {
+  memset(&cbii, 0, sizeof(cbii));
+  cbii.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+}
+
 inline void _VkInit(VkMemoryAllocateInfo& mai) {
   memset(&mai, 0, sizeof(mai));
   mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -238,6 +258,21 @@ inline void _VkInit(VkImageMemoryBarrier& imb) {
   imb.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 }
 
+inline void _VkInit(VkBufferMemoryBarrier& bmb) {
+  memset(&bmb, 0, sizeof(bmb));
+  bmb.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+}
+
+inline void _VkInit(VkDescriptorUpdateTemplateCreateInfo& duci) {
+  memset(&duci, 0, sizeof(duci));
+  duci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+}
+
+inline void _VkInit(VkMemoryBarrier& mb) {
+  memset(&mb, 0, sizeof(mb));
+  mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+}
+
 inline void _VkInit(VkImageSubresourceRange& srr) {
   // VkImageSubresourceRange has no sType.
   memset(&srr, 0, sizeof(srr));
@@ -265,6 +300,12 @@ inline void _VkInit(VkDescriptorSetLayoutCreateInfo& dsli) {
   dsli.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 }
 
+inline void _VkInit(VkDescriptorSetLayoutBindingFlagsCreateInfoEXT& dslbf) {
+  memset(&dslbf, 0, sizeof(dslbf));
+  dslbf.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+}
+
 inline void _VkInit(VkDescriptorSetLayoutBinding& dslb) {
   memset(&dslb, 0, sizeof(dslb));
 }
@@ -428,6 +469,13 @@ inline void _VkInit(VkPhysicalDeviceMemoryProperties2& dmp) {
   dmp.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
 }
 
+#ifdef VK_EXT_memory_budget
+inline void _VkInit(VkPhysicalDeviceMemoryBudgetPropertiesEXT& mbp) {
+  memset(&mbp, 0, sizeof(mbp));
+  mbp.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+}
+#endif /*VK_EXT_memory_budget*/
+
 inline void _VkInit(VkImageFormatProperties2& ifp) {
   memset(&ifp, 0, sizeof(ifp));
   ifp.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
@@ -451,6 +499,33 @@ inline void _VkInit(VkAndroidHardwareBufferUsageANDROID& ahw) {
 }
 #endif
 
+#ifdef VK_KHR_timeline_semaphore
+inline void _VkInit(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR& tsf) {
+  memset(&tsf, 0, sizeof(tsf));
+  tsf.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+}
+
+inline void _VkInit(VkSemaphoreTypeCreateInfoKHR& stci) {
+  memset(&stci, 0, sizeof(stci));
+  stci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+}
+
+inline void _VkInit(VkTimelineSemaphoreSubmitInfoKHR& tssi) {
+  memset(&tssi, 0, sizeof(tssi));
+  tssi.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+}
+
+inline void _VkInit(VkSemaphoreWaitInfoKHR& swi) {
+  memset(&swi, 0, sizeof(swi));
+  swi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+}
+
+inline void _VkInit(VkSemaphoreSignalInfoKHR& ssi) {
+  memset(&ssi, 0, sizeof(ssi));
+  ssi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR;
+}
+#endif /*VK_KHR_timeline_semaphore*/
+
 inline void _VkInit(VkTextureLODGatherFormatPropertiesAMD& lg) {
   memset(&lg, 0, sizeof(lg));
   lg.sType = VK_STRUCTURE_TYPE_TEXTURE_LOD_GATHER_FORMAT_PROPERTIES_AMD;
@@ -511,5 +586,10 @@ inline void _VkInit(VkImagePlaneMemoryRequirementsInfo& pri) {
   pri.sType = VK_STRUCTURE_TYPE_IMAGE_PLANE_MEMORY_REQUIREMENTS_INFO;
 }
 
+inline void _VkInit(VkQueryPoolCreateInfo& qpci) {
+  memset(&qpci, 0, sizeof(qpci));
+  qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+}
+
 }  // namespace internal
 }  // namespace language
@@ -143,6 +143,12 @@ Device::Device(VkSurfaceKHR surface) {
   swapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
   swapChainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   swapChainInfo.clipped = VK_TRUE;
+  if (!surface) {
+    // Headless: resetSwapChain() creates offscreenImages with this format.
+    // VK_FORMAT_R8G8B8A8_UNORM is always supported as a color attachment.
+    swapChainInfo.imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    swapChainInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
 }
 
 }  // namespace language
@@ -87,8 +87,19 @@ Instance::Instance() {
   applicationInfo.pEngineName = engineName.c_str();
 }
 
+int Instance::ctorErrorHeadless() {
+  minSurfaceSupport.erase(language::PRESENT);
+  return ctorError(nullptr, nullptr);
+}
+
 int Instance::ctorError(CreateWindowSurfaceFn createWindowSurface,
                         void* window) {
+  if (!createWindowSurface &&
+      minSurfaceSupport.find(language::PRESENT) != minSurfaceSupport.end()) {
+    logE("Instance::ctorError: no createWindowSurface but PRESENT is in\n");
+    logE("minSurfaceSupport. Did you mean to call ctorErrorHeadless?\n");
+    return 1;
+  }
   InstanceExtensionChooser instanceExtensions(*this);
   if (instanceExtensions.choose()) return 1;
 
@@ -138,7 +149,9 @@ int Instance::ctorError(CreateWindowSurfaceFn createWindowSurface,
 
   // surface.inst == VK_NULL_HANDLE, and needs to be reset to use vk.
   surface.reset(vk);
-  if ((v = createWindowSurface(*this, window)) != VK_SUCCESS) {
+  if (!createWindowSurface) {
+    // Headless: surface stays VK_NULL_HANDLE, so each Device is headless too.
+  } else if ((v = createWindowSurface(*this, window)) != VK_SUCCESS) {
     logE("%s failed: %d (%s)\n", "createWindowSurface (the user-provided fn)",
          v, string_VkResult(v));
     return 1;
@@ -64,6 +64,7 @@
 #include <string>
 #include <vector>
 #include "structs.h"
+#include "trace.h"
 
 #pragma once
 
@@ -203,6 +204,10 @@ typedef struct Device {
   // supports the given SurfaceSupport. Returns (size_t) -1 on error.
   size_t getQfamI(SurfaceSupport support) const;
 
+  // hasQfam returns true if any queue family supports the given
+  // SurfaceSupport. Unlike getQfamI() it does not log an error.
+  bool hasQfam(SurfaceSupport support) const;
+
   // Request device extensions by adding to requiredExtensions before open().
   // After open() this is the list of active device extensions.
   // Note that VK_KHR_SWAPCHAIN_EXTENSION_NAME is added automatically.
@@ -254,19 +259,75 @@ typedef struct Device {
         phys, swapChainInfo.surface, &scap);
   }
 
+  // isHeadless is true if this Device has no VkSurfaceKHR. See
+  // Instance::ctorErrorHeadless().
+  bool isHeadless() const { return !swapChainInfo.surface; }
+
   // open() calls resetSwapChain() so swapChain is valid after open().
   VkPtr<VkSwapchainKHR> swapChain{dev, vkDestroySwapchainKHR};
   // framebufs is populated after resetSwapChain() and open().
   std::vector<Framebuf> framebufs;
 
+  // offscreenImages replace the swapChain images if isHeadless(). Each
+  // offscreenImages.at(i) is framebufs.at(i).image.at(0). The RenderPass leaves
+  // them in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ready to be read back.
+  std::vector<std::shared_ptr<memory::Image>> offscreenImages;
+
+  // offscreenCount is how many offscreenImages resetSwapChain() creates.
+  size_t offscreenCount{1};
+
+  // pipelineCache is used by every vkCreate*Pipelines call. open() creates an
+  // empty pipelineCache. Call loadPipelineCache() after open() to seed it
+  // with the data from a previous run.
+  VkPtr<VkPipelineCache> pipelineCache{dev, vkDestroyPipelineCache};
+
+  // pipelineCacheFile is set by loadPipelineCache(). If it is not empty,
+  // ~Device calls savePipelineCache() to write pipelineCache back to the file.
+  std::string pipelineCacheFile;
+
+  // loadPipelineCache replaces pipelineCache with one created from the
+  // contents of filename. If filename does not exist or was written by a
+  // different vendorID, deviceID, or pipelineCacheUUID, the data is discarded
+  // and pipelineCache is left empty. That is not an error.
+  WARN_UNUSED_RESULT int loadPipelineCache(const char* filename);
+
+  // savePipelineCache writes pipelineCache to filename (or pipelineCacheFile
+  // if filename is nullptr). The file is written to a temporary file and then
+  // renamed over filename, so a crash cannot leave a truncated file behind.
+  WARN_UNUSED_RESULT int savePipelineCache(const char* filename = nullptr);
+
   // Only used if memory.h enables vulkanmemoryallocator.
   VmaAllocator vmaAllocator{VK_NULL_HANDLE};
+
+  // lock_guard_t: like c++17's constructor type inference, but we are in c++11
+  // Instead of: std::lock_guard<std::recursive_mutex> lock(dev.lockmutex);
+  // Do this:    Device::lock_guard_t                  lock(dev.lockmutex);
+  // (Then uses of lock_guard_t do not assume lockmutex is a recursive_mutex.)
+#ifdef VOLCANO_TRACE
+  // With VOLCANO_TRACE, lock_guard_t also records contention on lockmutex.
+  struct LockName {
+    static const char* name() { return "Device::lockmutex"; }
+  };
+  typedef trace::TracedLockGuard<std::recursive_mutex, LockName> lock_guard_t;
+#else  /*VOLCANO_TRACE*/
+  typedef std::lock_guard<std::recursive_mutex> lock_guard_t;
+#endif /*VOLCANO_TRACE*/
   std::recursive_mutex lockmutex;
 
+  // memoryCategoryBytes and memoryCategoryCount are indexed by
+  // memory::MemoryCategory, and memoryHeapBytes by heap index. They are the
+  // live allocations of all memory::DeviceMemory objects, updated under
+  // lockmutex. See memory::MemoryReport.
+  std::vector<VkDeviceSize> memoryCategoryBytes;
+  std::vector<size_t> memoryCategoryCount;
+  std::vector<VkDeviceSize> memoryHeapBytes;
+
   // resetSwapChain() re-initializes swapChain with the updated
   // swapChainInfo.imageExtent that should have just been populated. It also
   // rewrites framebufs to match.
   //
+  // If isHeadless(), resetSwapChain() calls resetOffscreen() instead.
+  //
   // The CommandPool and poolQindex arguments specify a queue that is used to
   // re-setup any buffers in the new swapChain.
   WARN_UNUSED_RESULT virtual int resetSwapChain(command::CommandPool& cpool,
@@ -280,6 +341,12 @@ typedef struct Device {
   // GetDepthFormat can be used to detect if addDepthImage() was ever called.
   VkFormat GetDepthFormat() const { return depthFormat; };
 
+  // transientDepth makes the depth image a memory::Image::ctorTransient()
+  // image, which tile-based GPUs may never back with real memory. The depth
+  // buffer is then discarded at the end of the RenderPass: set this before
+  // Pipeline::addDepthImage() if nothing reads the depth buffer afterward.
+  bool transientDepth{false};
+
   // setFrameNumber is required by vulkanmemoryallocator if the CAN_BECOME_LOST
   // feature is used. In order to keep it simple, just pass in the frameNumber
   // each frame regardless. If you use
@@ -313,6 +380,10 @@ typedef struct Device {
 
   language::Instance* inst{nullptr};
 
+  // initPipelineCache replaces pipelineCache with a new VkPipelineCache using
+  // initialData (which can be nullptr if len is 0).
+  WARN_UNUSED_RESULT int initPipelineCache(const void* initialData, size_t len);
+
   // addOrUpdateFramebufs updates framebufs preserving existing FrameBuf
   // elements and adding new ones.
   //
@@ -321,6 +392,13 @@ typedef struct Device {
   // src/memory/memory.cpp.
   int addOrUpdateFramebufs(std::vector<VkImage>& images,
                            command::CommandPool& cpool, size_t poolQindex);
+
+  // resetOffscreen recreates offscreenImages using swapChainInfo.imageExtent
+  // and swapChainInfo.imageFormat, then calls addOrUpdateFramebufs.
+  //
+  // resetOffscreen is also found in src/memory/offscreen.cpp.
+  WARN_UNUSED_RESULT int resetOffscreen(command::CommandPool& cpool,
+                                        size_t poolQindex);
 } Device;
 
 // QueueRequest communicates the physical device within Instance, and the
@@ -436,11 +514,21 @@ class Instance {
   WARN_UNUSED_RESULT int ctorError(CreateWindowSurfaceFn createWindowSurface,
                                    void* window);
 
+  // ctorErrorHeadless is step 2 of the ctor for an app without a window, such
+  // as a render farm, a compute job, or a CI test using lavapipe. No
+  // VkSurfaceKHR is created, PRESENT is removed from minSurfaceSupport, and
+  // each Device renders to offscreenImages instead of a swapChain.
+  //
+  // Set minSurfaceSupport to {language::COMPUTE} before calling
+  // ctorErrorHeadless for a compute-only app.
+  WARN_UNUSED_RESULT int ctorErrorHeadless();
+
   // open() is step 3 of the ctor. Call open() after modifying
   // Device::requiredExtensions, Device::surfaceFormats, or
   // Device::presentModes.
   //
-  // surfaceSizeRequest is the initial size of the window.
+  // surfaceSizeRequest is the initial size of the window (or of the
+  // offscreenImages if the Instance is headless).
   WARN_UNUSED_RESULT int open(VkExtent2D surfaceSizeRequest);
 
   virtual ~Instance();
@@ -478,6 +566,11 @@ class Instance {
   std::set<SurfaceSupport> minSurfaceSupport{language::PRESENT,
                                              language::GRAPHICS};
 
+  // optionalSurfaceSupport lists queue families that are requested in
+  // addition to minSurfaceSupport, but only if the device has them. For
+  // example, add language::TRANSFER to get a dedicated transfer queue.
+  std::set<SurfaceSupport> optionalSurfaceSupport;
+
   // pAllocator defaults to nullptr. Your application can install a custom
   // allocator before calling ctorError().
   VkAllocationCallbacks* pAllocator = nullptr;
@@ -523,4 +616,10 @@ class Instance {
   uint32_t detectedApiVersionInUse{0};
 };
 
+// writeTextFile writes text to filename, replacing its contents. Errors are
+// logged with caller as the prefix. (It is in log.cpp.)
+WARN_UNUSED_RESULT int writeTextFile(const char* filename,
+                                     const std::string& text,
+                                     const char* caller);
+
 }  // namespace language
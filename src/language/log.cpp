@@ -2,6 +2,9 @@
  */
 #include "language.h"
 
+#include <errno.h>
+#include <string.h>
+
 void logV(const char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
@@ -126,3 +129,29 @@ void logVolcano(char level, const char* fmt, va_list ap) {
 }
 
 #endif
+
+namespace language {
+
+int writeTextFile(const char* filename, const std::string& text,
+                  const char* caller) {
+  FILE* f = fopen(filename, "w");
+  if (!f) {
+    logE("%s: fopen(%s) failed: %d %s\n", caller, filename, errno,
+         strerror(errno));
+    return 1;
+  }
+  if (!text.empty() && fwrite(text.data(), text.size(), 1, f) != 1) {
+    logE("%s: fwrite(%s) failed: %d %s\n", caller, filename, errno,
+         strerror(errno));
+    fclose(f);
+    return 1;
+  }
+  if (fclose(f)) {
+    logE("%s: fclose(%s) failed: %d %s\n", caller, filename, errno,
+         strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace language
@@ -0,0 +1,203 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * Device::loadPipelineCache() and Device::savePipelineCache() persist the
+ * VkPipelineCache between runs.
+ */
+#include "VkInit.h"
+#include "language.h"
+// vk_enum_string_helper.h is not in the default vulkan installation, but is
+// generated by the gn/vendor/vulkansamples/BUILD.gn file in this repo.
+#include <vulkan/vk_enum_string_helper.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+
+namespace language {
+
+namespace {  // an anonymous namespace hides its contents outside this file
+
+// getLE32 decodes a uint32_t from the VkPipelineCache header, which the spec
+// says is always written least significant byte first.
+uint32_t getLE32(const unsigned char* p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+// headerMatches validates the VkPipelineCacheHeaderVersionOne fields in data.
+// A driver is supposed to reject a mismatched header on its own, but some do
+// not, and the result is a crash deep inside vkCreateGraphicsPipelines.
+bool headerMatches(Device& dev, const std::vector<unsigned char>& data,
+                   const char* filename) {
+  constexpr size_t headerMinLen = 16 + VK_UUID_SIZE;
+  if (data.size() < headerMinLen) {
+    logW("loadPipelineCache(%s): %zu bytes is too short\n", filename,
+         data.size());
+    return false;
+  }
+  const unsigned char* p = data.data();
+  uint32_t headerLength = getLE32(p);
+  uint32_t headerVersion = getLE32(p + 4);
+  uint32_t vendorID = getLE32(p + 8);
+  uint32_t deviceID = getLE32(p + 12);
+  auto& prop = dev.physProp.properties;
+  if (headerLength < headerMinLen || headerLength > data.size()) {
+    logW("loadPipelineCache(%s): invalid headerLength %u\n", filename,
+         headerLength);
+    return false;
+  }
+  if (headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    logW("loadPipelineCache(%s): unknown headerVersion %u\n", filename,
+         headerVersion);
+    return false;
+  }
+  if (vendorID != prop.vendorID || deviceID != prop.deviceID) {
+    logW("loadPipelineCache(%s): vendor %x:%x does not match device %x:%x\n",
+         filename, vendorID, deviceID, prop.vendorID, prop.deviceID);
+    return false;
+  }
+  if (memcmp(p + 16, prop.pipelineCacheUUID, VK_UUID_SIZE)) {
+    logW("loadPipelineCache(%s): pipelineCacheUUID mismatch\n", filename);
+    return false;
+  }
+  return true;
+}
+
+// readFile reads all of filename into data. Returns 1 if filename could not
+// be opened because it does not exist (not an error).
+int readFile(const char* filename, std::vector<unsigned char>& data) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    if (errno == ENOENT) {
+      return 1;
+    }
+    logW("loadPipelineCache: fopen(%s) failed: %d %s\n", filename, errno,
+         strerror(errno));
+    return 1;
+  }
+  int r = 0;
+  long len;
+  if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET)) {
+    logW("loadPipelineCache: fseek(%s) failed: %d %s\n", filename, errno,
+         strerror(errno));
+    r = 1;
+  } else {
+    data.resize(len);
+    if (len && fread(data.data(), len, 1, f) != 1) {
+      logW("loadPipelineCache: fread(%s) failed: %d %s\n", filename, errno,
+           strerror(errno));
+      data.clear();
+      r = 1;
+    }
+  }
+  fclose(f);
+  return r;
+}
+
+}  // anonymous namespace
+
+int Device::initPipelineCache(const void* initialData, size_t len) {
+  VkPipelineCacheCreateInfo VkInit(pcci);
+  pcci.initialDataSize = len;
+  pcci.pInitialData = initialData;
+  VkPipelineCache newCache;
+  VkResult v = vkCreatePipelineCache(dev, &pcci, dev.allocator, &newCache);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreatePipelineCache", v,
+         string_VkResult(v));
+    return 1;
+  }
+  pipelineCache.reset(dev);
+  *(&pipelineCache) = newCache;
+  pipelineCache.allocator = dev.allocator;
+  return 0;
+}
+
+int Device::loadPipelineCache(const char* filename) {
+  if (!dev) {
+    logE("BUG: loadPipelineCache(%s) before open()\n", filename);
+    return 1;
+  }
+  pipelineCacheFile = filename;
+  std::vector<unsigned char> data;
+  if (readFile(filename, data) || !headerMatches(*this, data, filename)) {
+    // Start with an empty cache. It will be written out on the next save.
+    return initPipelineCache(nullptr, 0);
+  }
+  if (initPipelineCache(data.data(), data.size())) {
+    // The driver refused the data. Fall back to an empty cache.
+    logW("loadPipelineCache(%s): discarding cache data\n", filename);
+    return initPipelineCache(nullptr, 0);
+  }
+  return 0;
+}
+
+int Device::savePipelineCache(const char* filename /*= nullptr*/) {
+  if (!filename) {
+    filename = pipelineCacheFile.c_str();
+  }
+  if (!*filename) {
+    logE("savePipelineCache: no filename and loadPipelineCache not called\n");
+    return 1;
+  }
+  if (!pipelineCache) {
+    logE("BUG: savePipelineCache(%s) before open()\n", filename);
+    return 1;
+  }
+  size_t len = 0;
+  VkResult v = vkGetPipelineCacheData(dev, pipelineCache, &len, nullptr);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkGetPipelineCacheData", v,
+         string_VkResult(v));
+    return 1;
+  }
+  std::vector<unsigned char> data(len);
+  v = vkGetPipelineCacheData(dev, pipelineCache, &len, data.data());
+  if (v != VK_SUCCESS && v != VK_INCOMPLETE) {
+    logE("%s failed: %d (%s)\n", "vkGetPipelineCacheData", v,
+         string_VkResult(v));
+    return 1;
+  }
+  data.resize(len);
+
+  std::string tmpName = std::string(filename) + ".tmp";
+  FILE* f = fopen(tmpName.c_str(), "wb");
+  if (!f) {
+    logE("savePipelineCache: fopen(%s) failed: %d %s\n", tmpName.c_str(), errno,
+         strerror(errno));
+    return 1;
+  }
+  if ((len && fwrite(data.data(), len, 1, f) != 1) || fflush(f)) {
+    logE("savePipelineCache: fwrite(%s) failed: %d %s\n", tmpName.c_str(),
+         errno, strerror(errno));
+    fclose(f);
+    remove(tmpName.c_str());
+    return 1;
+  }
+  if (fclose(f)) {
+    logE("savePipelineCache: fclose(%s) failed: %d %s\n", tmpName.c_str(),
+         errno, strerror(errno));
+    remove(tmpName.c_str());
+    return 1;
+  }
+#ifdef _WIN32
+  if (!::MoveFileEx(tmpName.c_str(), filename, MOVEFILE_REPLACE_EXISTING)) {
+    auto e = ::GetLastError();
+    logE("savePipelineCache: MoveFileEx(%s) failed: %u\n", filename, e);
+    remove(tmpName.c_str());
+    return 1;
+  }
+#else
+  if (rename(tmpName.c_str(), filename)) {
+    logE("savePipelineCache: rename(%s) failed: %d %s\n", filename, errno,
+         strerror(errno));
+    remove(tmpName.c_str());
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+}  // namespace language
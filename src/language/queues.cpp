@@ -19,8 +19,33 @@ int Instance::initQueues(std::vector<QueueRequest>& request) {
   bool foundQueue = false;
   for (size_t dev_i = 0; dev_i < devs.size(); dev_i++) {
     auto selectedQfams = requestQfams(dev_i, minSurfaceSupport);
-    foundQueue |= selectedQfams.size() > 0;
+    if (selectedQfams.size() < 1) {
+      continue;
+    }
+    foundQueue = true;
     request.insert(request.end(), selectedQfams.begin(), selectedQfams.end());
+
+    auto& dev = *devs.at(dev_i);
+    for (auto s : optionalSurfaceSupport) {
+      if (minSurfaceSupport.find(s) != minSurfaceSupport.end() ||
+          !dev.hasQfam(s)) {
+        continue;
+      }
+      for (auto& req : requestQfams(dev_i, {s})) {
+        // Skip an optional request if its family has no spare queue: asking
+        // for more than queueCount would make open() fail.
+        size_t used = 0;
+        for (auto& prev : request) {
+          used += prev.dev_index == req.dev_index &&
+                  prev.dev_qfam_index == req.dev_qfam_index;
+        }
+        auto& props = dev.qfams.at(req.dev_qfam_index).queueFamilyProperties;
+        if (used >= props.queueCount) {
+          continue;
+        }
+        request.emplace_back(req);
+      }
+    }
   }
   if (!foundQueue) {
     logE("Error: no device has minSurfaceSupport.\n");
@@ -105,6 +130,7 @@ int Instance::open(VkExtent2D surfaceSizeRequest) {
       dCreateInfo.pEnabledFeatures = &dev.enabledFeatures.features;
     } else {
       dCreateInfo.pEnabledFeatures = NULL;
+      dev.enabledFeatures.chainEnabled(dev);
       dCreateInfo.pNext = &dev.enabledFeatures;
     }
     if (dev.requiredExtensions.size()) {
@@ -123,6 +149,10 @@ int Instance::open(VkExtent2D surfaceSizeRequest) {
     }
     dev.dev.allocator = pAllocator;
     dev.swapChainInfo.imageExtent = surfaceSizeRequest;
+    if (dev.initPipelineCache(nullptr, 0)) {
+      logE("dev_i=%zu initPipelineCache failed\n", (size_t)kv.first);
+      return 1;
+    }
   }
 
   size_t swap_chain_count = 0;
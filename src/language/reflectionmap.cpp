@@ -212,6 +212,9 @@ DeviceFeatures::DeviceFeatures() {
   ADD_FIELD(descriptorIndexing, descriptorBindingPartiallyBound);
   ADD_FIELD(descriptorIndexing, descriptorBindingVariableDescriptorCount);
   ADD_FIELD(descriptorIndexing, runtimeDescriptorArray);
+#ifdef VK_KHR_timeline_semaphore
+  ADD_FIELD(timelineSemaphore, timelineSemaphore);
+#endif /*VK_KHR_timeline_semaphore*/
 #undef ADD_FIELD
 
   reset();
@@ -226,6 +229,9 @@ void DeviceFeatures::reset() {
   VkOverwrite(storage16Bit);
   VkOverwrite(blendOpAdvanced);
   VkOverwrite(descriptorIndexing);
+#ifdef VK_KHR_timeline_semaphore
+  VkOverwrite(timelineSemaphore);
+#endif /*VK_KHR_timeline_semaphore*/
 }
 
 int DeviceFeatures::getFeatures(Device& dev) {
@@ -234,7 +240,16 @@ int DeviceFeatures::getFeatures(Device& dev) {
     vkGetPhysicalDeviceFeatures(dev.phys, &features);
     return 0;
   }
+  chain(dev, false /*requiredOnly*/);
+  vkGetPhysicalDeviceFeatures2(dev.phys, this);
+  return 0;
+}
+
+void DeviceFeatures::chainEnabled(Device& dev) {
+  chain(dev, true /*requiredOnly*/);
+}
 
+void DeviceFeatures::chain(Device& dev, bool requiredOnly) {
   // Create pNext chain for Vulkan 1.1 features.
   pNext = &variablePointer;
   variablePointer.pNext = &multiview;
@@ -243,16 +258,28 @@ int DeviceFeatures::getFeatures(Device& dev) {
   shaderDraw.pNext = &storage16Bit;
   auto ppNext = &storage16Bit.pNext;
 
-#define ifExtension(extname, membername)   \
-  if (dev.isExtensionAvailable(extname)) { \
-    *ppNext = &membername;                 \
-    ppNext = &membername.pNext;            \
+  auto isRequired = [&dev](const char* extname) -> bool {
+    for (auto name : dev.requiredExtensions) {
+      if (!strcmp(name, extname)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+#define ifExtension(extname, membername)                  \
+  if (requiredOnly ? isRequired(extname)                  \
+                   : dev.isExtensionAvailable(extname)) { \
+    *ppNext = &membername;                                \
+    ppNext = &membername.pNext;                           \
   }
   ifExtension("VK_EXT_blend_operation_advanced", blendOpAdvanced);
   ifExtension("VK_EXT_descriptor_indexing", descriptorIndexing);
-
-  vkGetPhysicalDeviceFeatures2(dev.phys, this);
-  return 0;
+#ifdef VK_KHR_timeline_semaphore
+  ifExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, timelineSemaphore);
+#endif /*VK_KHR_timeline_semaphore*/
+#undef ifExtension
+  *ppNext = nullptr;
 }
 
 PhysicalDeviceProperties::PhysicalDeviceProperties() {
@@ -42,9 +42,7 @@ std::vector<QueueRequest> Instance::requestQfams(
     std::set<SurfaceSupport> qsupport;
     for (auto s_i = support.begin(); s_i != support.end(); s_i++) {
       auto s = *s_i;
-      if (s == GRAPHICS && fam.isGraphics()) {
-        qsupport.emplace(GRAPHICS);
-      } else if (fam.surfaceSupport() == s) {
+      if (fam.supports(s)) {
         qsupport.emplace(s);
       }
     }
@@ -94,12 +92,17 @@ std::vector<QueueRequest> Instance::requestQfams(
 
 size_t Device::getQfamI(SurfaceSupport support) const {
   for (size_t i = 0; i < qfams.size(); i++) {
-    auto& fam = qfams.at(i);
-    if (support == GRAPHICS && fam.isGraphics()) return i;
-    if (support == fam.surfaceSupport()) return i;
+    if (qfams.at(i).supports(support)) return i;
   }
   logE("getQfamI(%d): not found\n", (int)support);
   return (size_t)-1;
 }
 
+bool Device::hasQfam(SurfaceSupport support) const {
+  for (auto& fam : qfams) {
+    if (fam.supports(support)) return true;
+  }
+  return false;
+}
+
 }  // namespace language
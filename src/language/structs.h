@@ -79,7 +79,22 @@ struct DeviceFeatures : VkPhysicalDeviceFeatures2 {
   // Used if VK_EXT_descriptor_indexing:
   VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexing;
 
+#ifdef VK_KHR_timeline_semaphore
+  // Used if VK_KHR_timeline_semaphore:
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphore;
+#endif /*VK_KHR_timeline_semaphore*/
+
   VolcanoReflectionMap reflect;
+
+  // chainEnabled links the pNext chain passed to vkCreateDevice. It only
+  // includes the extension structures for extensions in
+  // dev.requiredExtensions. Instance::open() calls this for enabledFeatures.
+  void chainEnabled(Device& dev);
+
+ protected:
+  // chain links the pNext chain. If requiredOnly is false, it includes every
+  // extension structure dev supports (see getFeatures).
+  void chain(Device& dev, bool requiredOnly);
 };
 
 // PhysicalDeviceProperties gathers all the structures that are supported by
@@ -241,7 +256,13 @@ struct ImageFormatProperties : VkImageFormatProperties2 {
 // VkQueue with queueFlags & VK_QUEUE_GRAPHICS_BIT in Instance::requestQfams()
 // and Device::getQfamI().
 //
-// TODO: Add COMPUTE.
+// TRANSFER is also an exception: it requests a VkQueue from a dedicated
+// transfer queue family (VK_QUEUE_TRANSFER_BIT without GRAPHICS or COMPUTE),
+// which is usually backed by a DMA engine on discrete GPUs.
+//
+// COMPUTE requests a VkQueue with queueFlags & VK_QUEUE_COMPUTE_BIT. A headless
+// compute-only app can set Instance::minSurfaceSupport to just {COMPUTE}.
+//
 // GRAPHICS and COMPUTE support are not tied to a surface, but volcano makes the
 // simplifying assumption that all these bits can be lumped together here.
 enum SurfaceSupport {
@@ -250,6 +271,8 @@ enum SurfaceSupport {
   PRESENT = 2,
 
   GRAPHICS = 0x1000,  // Special case. Not used in QueueFamilyProperties.
+  TRANSFER = 0x1001,  // Special case. Not used in QueueFamilyProperties.
+  COMPUTE = 0x1002,   // Special case. Not used in QueueFamilyProperties.
 };
 
 // QueueFamilyProperties gathers all the structures that are supported by
@@ -275,6 +298,25 @@ struct QueueFamilyProperties : VkQueueFamilyProperties2 {
     return queueFamilyProperties.queueFlags & VK_QUEUE_GRAPHICS_BIT;
   }
 
+  inline bool isCompute() const {
+    return queueFamilyProperties.queueFlags & VK_QUEUE_COMPUTE_BIT;
+  }
+
+  // isDedicatedTransfer is true if this queue family can only do transfers.
+  inline bool isDedicatedTransfer() const {
+    auto f = queueFamilyProperties.queueFlags;
+    return (f & VK_QUEUE_TRANSFER_BIT) &&
+           !(f & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+  }
+
+  // supports returns true if this queue family matches s. See SurfaceSupport.
+  inline bool supports(SurfaceSupport s) const {
+    if (s == GRAPHICS) return isGraphics();
+    if (s == TRANSFER) return isDedicatedTransfer();
+    if (s == COMPUTE) return isCompute();
+    return surfaceSupport() == s;
+  }
+
   // prios and queues store what VkQueues were actually created.
   // Populated only after open().
   std::vector<float> prios;
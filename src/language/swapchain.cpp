@@ -67,6 +67,9 @@ VkSurfaceTransformFlagBitsKHR calculateSurfaceTransform(
 }  // anonymous namespace
 
 int Device::resetSwapChain(command::CommandPool& cpool, size_t poolQindex) {
+  if (isHeadless()) {
+    return resetOffscreen(cpool, poolQindex);
+  }
   VkSurfaceCapabilitiesKHR scap;
   VkResult v = getSurfaceCapabilities(scap);
   if (v != VK_SUCCESS) {
@@ -0,0 +1,194 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * Implements the CPU instrumentation in trace.h.
+ */
+#include "language.h"
+
+#include <stdio.h>
+
+namespace language {
+namespace trace {
+
+#ifdef VOLCANO_TRACE
+
+namespace {  // an anonymous namespace hides its contents outside this file
+
+typedef struct Event {
+  const Site* site;
+  uint64_t start;
+  uint64_t dur;
+  bool contended;
+} Event;
+
+// Ring is the ring buffer of one thread. Only its own thread writes to it, so
+// lockmutex is only contended while another thread reads it.
+typedef struct Ring {
+  std::mutex lockmutex;
+  std::vector<Event> events;
+  // next is where the next event goes. After events is full, next wraps.
+  size_t next{0};
+  bool wrapped{false};
+  size_t tid{0};
+} Ring;
+
+typedef struct Registry {
+  std::mutex lockmutex;
+  std::vector<Site*> sites;
+  std::vector<std::shared_ptr<Ring>> rings;
+  size_t ringSize{65536};
+} Registry;
+
+Registry& registry() {
+  // Never destroyed: threads may still record during static destruction.
+  static Registry* r = new Registry;
+  return *r;
+}
+
+thread_local std::shared_ptr<Ring> threadRing;
+
+Ring& getRing() {
+  if (!threadRing) {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lockmutex);
+    threadRing = std::make_shared<Ring>();
+    threadRing->events.resize(reg.ringSize ? reg.ringSize : 1);
+    threadRing->tid = reg.rings.size();
+    reg.rings.emplace_back(threadRing);
+  }
+  return *threadRing;
+}
+
+}  // anonymous namespace
+
+Site::Site(const char* name, const char* file, int line)
+    : name(name), file(file), line(line) {
+  auto& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.lockmutex);
+  reg.sites.emplace_back(this);
+}
+
+uint64_t now() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+void record(Site& site, uint64_t start, uint64_t dur, bool contended) {
+  site.count++;
+  if (contended) {
+    site.contended++;
+  }
+  site.totalNs += dur;
+  uint64_t prevMax = site.maxNs;
+  while (dur > prevMax && !site.maxNs.compare_exchange_weak(prevMax, dur)) {
+  }
+
+  auto& ring = getRing();
+  std::lock_guard<std::mutex> lock(ring.lockmutex);
+  ring.events.at(ring.next) = Event{&site, start, dur, contended};
+  if (++ring.next >= ring.events.size()) {
+    ring.next = 0;
+    ring.wrapped = true;
+  }
+}
+
+std::vector<SiteStats> getSites() {
+  auto& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.lockmutex);
+  std::vector<SiteStats> out;
+  for (auto site : reg.sites) {
+    out.emplace_back();
+    auto& s = out.back();
+    s.name = site->name;
+    s.file = site->file;
+    s.line = site->line;
+    s.count = site->count;
+    s.contended = site->contended;
+    s.total = std::chrono::nanoseconds(site->totalNs);
+    s.max = std::chrono::nanoseconds(site->maxNs);
+  }
+  return out;
+}
+
+void reset() {
+  auto& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.lockmutex);
+  for (auto site : reg.sites) {
+    site->count = 0;
+    site->contended = 0;
+    site->totalNs = 0;
+    site->maxNs = 0;
+  }
+  for (auto& ring : reg.rings) {
+    std::lock_guard<std::mutex> ringLock(ring->lockmutex);
+    ring->next = 0;
+    ring->wrapped = false;
+  }
+}
+
+void setRingSize(size_t events) {
+  auto& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.lockmutex);
+  reg.ringSize = events;
+}
+
+std::string chromeTrace() {
+  std::string out = "{\"traceEvents\":[";
+  char buf[512];
+  bool first = true;
+  auto& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.lockmutex);
+  for (auto& ring : reg.rings) {
+    std::lock_guard<std::mutex> ringLock(ring->lockmutex);
+    size_t n = ring->wrapped ? ring->events.size() : ring->next;
+    size_t start = ring->wrapped ? ring->next : 0;
+    for (size_t i = 0; i < n; i++) {
+      auto& e = ring->events.at((start + i) % ring->events.size());
+      // Site names are string literals that need no JSON escaping.
+      snprintf(buf, sizeof(buf),
+               "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,"
+               "\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+               first ? "" : ",", e.site->name,
+               e.contended ? "lock" : "call", ring->tid, e.start / 1e3,
+               e.dur / 1e3);
+      out += buf;
+      first = false;
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+void dump() {
+  for (auto& s : getSites()) {
+    if (!s.count) {
+      continue;
+    }
+    logI("%s (%s:%d): %llu calls, %llu contended, total %.3f ms, max %.3f ms\n",
+         s.name.c_str(), s.file, s.line, (unsigned long long)s.count,
+         (unsigned long long)s.contended, s.total.count() / 1e6,
+         s.max.count() / 1e6);
+  }
+}
+
+#else /*VOLCANO_TRACE*/
+
+std::vector<SiteStats> getSites() { return std::vector<SiteStats>(); }
+
+void reset() {}
+
+void setRingSize(size_t) {}
+
+std::string chromeTrace() { return "{\"traceEvents\":[]}\n"; }
+
+void dump() { logI("trace::dump: rebuild with use_volcano_trace = true\n"); }
+
+#endif /*VOLCANO_TRACE*/
+
+int writeChromeTrace(const char* filename) {
+  return writeTextFile(filename, chromeTrace(), "writeChromeTrace");
+}
+
+}  // namespace trace
+}  // namespace language
@@ -0,0 +1,146 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * trace.h measures how much CPU time is spent inside Volcano: call counts and
+ * durations of hot paths (submission, descriptor updates, memory allocation)
+ * and contention on CommandPool::lockmutex and DeviceMemory::lockmutex.
+ *
+ * Tracing is compiled in only if VOLCANO_TRACE is defined (set the GN arg
+ * use_volcano_trace = true). Otherwise VOLCANO_TRACE_SCOPE() expands to
+ * nothing and TracedLockGuard is not used, so there is no cost at all. The
+ * dump functions below always exist so an app can call them either way; they
+ * just return no data.
+ *
+ * Each thread records events into its own ring buffer, so recording never
+ * contends with other threads. Each call site also keeps running totals.
+ *
+ * Example usage:
+ *   void Foo::bar() {
+ *     VOLCANO_TRACE_SCOPE("Foo::bar");
+ *     ...
+ *   }
+ *   // Later:
+ *   language::trace::dump();
+ *   if (language::trace::writeChromeTrace("volcano.json")) { ... }
+ */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace language {
+namespace trace {
+
+// SiteStats is a snapshot of one call site.
+typedef struct SiteStats {
+  std::string name;
+  const char* file;
+  int line;
+  // count is the number of calls (or for a lock, the number of times it was
+  // acquired).
+  uint64_t count;
+  // contended is the number of times a lock had to wait. 0 for a call.
+  uint64_t contended;
+  // total and max are the time spent in the call (or waiting for the lock).
+  std::chrono::nanoseconds total;
+  std::chrono::nanoseconds max;
+} SiteStats;
+
+// getSites returns a snapshot of every call site that has been reached.
+std::vector<SiteStats> getSites();
+
+// dump logs getSites() with logI().
+void dump();
+
+// chromeTrace formats the events in all ring buffers as JSON for
+// chrome://tracing.
+std::string chromeTrace();
+
+// writeChromeTrace writes chromeTrace() to filename.
+int writeChromeTrace(const char* filename);
+
+// reset clears all ring buffers and all call site totals.
+void reset();
+
+// setRingSize sets the number of events kept per thread. It only affects
+// threads that have not yet recorded an event.
+void setRingSize(size_t events);
+
+#ifdef VOLCANO_TRACE
+
+// Site holds the running totals of one call site. Sites are static objects
+// created by VOLCANO_TRACE_SCOPE() and TracedLockGuard.
+typedef struct Site {
+  Site(const char* name, const char* file, int line);
+
+  const char* name;
+  const char* file;
+  int line;
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> contended{0};
+  std::atomic<uint64_t> totalNs{0};
+  std::atomic<uint64_t> maxNs{0};
+} Site;
+
+// now returns nanoseconds since the first call to now().
+uint64_t now();
+
+// record adds one event to site's totals and to this thread's ring buffer.
+void record(Site& site, uint64_t start, uint64_t dur, bool contended);
+
+// Scope records the time from its constructor to its destructor.
+class Scope {
+ public:
+  Scope(Site& site) : site(site), start(now()) {}
+  ~Scope() { record(site, start, now() - start, false); }
+
+ protected:
+  Site& site;
+  uint64_t start;
+};
+
+// TracedLockGuard is a std::lock_guard that records how long it waited. Name
+// is a struct with a static name() method that identifies the mutex.
+template <typename Mutex, typename Name>
+class TracedLockGuard {
+ public:
+  explicit TracedLockGuard(Mutex& m) : m(m) {
+    static Site site(Name::name(), "", 0);
+    if (m.try_lock()) {
+      // Count the uncontended lock without an event in the ring buffer.
+      site.count++;
+      return;
+    }
+    uint64_t start = now();
+    m.lock();
+    record(site, start, now() - start, true);
+  }
+  ~TracedLockGuard() { m.unlock(); }
+  TracedLockGuard(const TracedLockGuard&) = delete;
+  TracedLockGuard& operator=(const TracedLockGuard&) = delete;
+
+ protected:
+  Mutex& m;
+};
+
+#define VOLCANO_TRACE_CAT2(a, b) a##b
+#define VOLCANO_TRACE_CAT(a, b) VOLCANO_TRACE_CAT2(a, b)
+#define VOLCANO_TRACE_SCOPE(name)                                       \
+  static language::trace::Site VOLCANO_TRACE_CAT(volcanoSite, __LINE__)( \
+      name, __FILE__, __LINE__);                                        \
+  language::trace::Scope VOLCANO_TRACE_CAT(volcanoScope, __LINE__)(      \
+      VOLCANO_TRACE_CAT(volcanoSite, __LINE__))
+
+#else /*VOLCANO_TRACE*/
+
+#define VOLCANO_TRACE_SCOPE(name) \
+  do {                            \
+  } while (0)
+
+#endif /*VOLCANO_TRACE*/
+
+}  // namespace trace
+}  // namespace language
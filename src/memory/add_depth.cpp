@@ -39,6 +39,10 @@ int Pipeline::addDepthImage(const std::vector<VkFormat>& formatChoices,
   // this is a VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL attachment.
   info.attach.emplace_back(dev.depthFormat,
                            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  if (dev.transientDepth) {
+    // A transient depth image is never stored, only used during the pass.
+    info.attach.back().vk.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  }
   return 0;
 }
 
@@ -115,7 +119,9 @@ int Device::addOrUpdateFramebufs(std::vector<VkImage>& images,
       depthImage->info.extent = {1, 1, 1};
       depthImage->info.extent.width = swapChainInfo.imageExtent.width;
       depthImage->info.extent.height = swapChainInfo.imageExtent.height;
-      if (depthImage->ctorDeviceLocal() || depthImage->bindMemory()) {
+      if ((transientDepth ? depthImage->ctorTransient()
+                          : depthImage->ctorDeviceLocal()) ||
+          depthImage->bindMemory()) {
         logE("depthImage->ctorError or bindMemory failed\n");
         return 1;
       }
@@ -163,10 +169,15 @@ int Device::addOrUpdateFramebufs(std::vector<VkImage>& images,
 }
 
 Device::~Device() {
+  if (!pipelineCacheFile.empty() && pipelineCache && savePipelineCache()) {
+    logE("~Device: savePipelineCache(%s) failed\n", pipelineCacheFile.c_str());
+  }
   if (depthImage) {
     delete depthImage;
     depthImage = nullptr;
   }
+  // offscreenImages must be freed before vmaAllocator is destroyed.
+  offscreenImages.clear();
   if (vmaAllocator) {
 #ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
     logE("~Device: vmaAllocator should be NULL. Memory corruption detected.");
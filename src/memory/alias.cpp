@@ -0,0 +1,158 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * AliasPool binds Images with non-overlapping lifetimes to the same memory.
+ */
+#include "memory.h"
+
+#include <algorithm>
+
+namespace memory {
+
+int AliasPool::add(Image& img, size_t first, size_t last) {
+  if (!img.vk) {
+    logE("BUG: AliasPool::add: call img.ctorWithoutMemory first\n");
+    return 1;
+  }
+  if (img.info.tiling != VK_IMAGE_TILING_OPTIMAL) {
+    // bufferImageGranularity would apply between LINEAR and OPTIMAL images.
+    logE("AliasPool::add: only VK_IMAGE_TILING_OPTIMAL is supported\n");
+    return 1;
+  }
+  if (first > last) {
+    logE("AliasPool::add(first=%zu, last=%zu): invalid lifetime\n", first,
+         last);
+    return 1;
+  }
+  entries.emplace_back();
+  auto& e = entries.back();
+  e.img = &img;
+  e.first = first;
+  e.last = last;
+  e.offset = 0;
+  vkGetImageMemoryRequirements(dev.dev, img.vk, &e.req);
+  return 0;
+}
+
+void AliasPool::place() {
+  // Place the largest Images first. Each Image goes at the lowest offset
+  // where it does not collide with an already-placed Image that is alive at
+  // the same time.
+  std::vector<size_t> order(entries.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order.at(i) = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return entries.at(a).req.size > entries.at(b).req.size;
+  });
+
+  total = 0;
+  std::vector<size_t> placed;
+  for (auto i : order) {
+    auto& e = entries.at(i);
+    std::vector<size_t> live;
+    for (auto j : placed) {
+      auto& o = entries.at(j);
+      if (o.first <= e.last && e.first <= o.last) {
+        live.emplace_back(j);
+      }
+    }
+    // Candidates are 0 and the end of each live Image.
+    std::vector<VkDeviceSize> candidates{0};
+    for (auto j : live) {
+      candidates.emplace_back(entries.at(j).offset + entries.at(j).req.size);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    auto align = e.req.alignment ? e.req.alignment : 1;
+    for (auto c : candidates) {
+      VkDeviceSize start = (c + align - 1) / align * align;
+      bool fits = true;
+      for (auto j : live) {
+        auto& o = entries.at(j);
+        if (start < o.offset + o.req.size && o.offset < start + e.req.size) {
+          fits = false;
+          break;
+        }
+      }
+      if (fits) {
+        e.offset = start;
+        break;
+      }
+    }
+    total = std::max(total, e.offset + e.req.size);
+    placed.emplace_back(i);
+  }
+}
+
+int AliasPool::alloc(bool lazy /*= false*/) {
+  if (entries.empty()) {
+    logE("AliasPool::alloc: no Images were added\n");
+    return 1;
+  }
+  VkMemoryRequirements raw;
+  raw.size = 0;
+  raw.alignment = 1;
+  raw.memoryTypeBits = ~0u;
+  for (auto& e : entries) {
+    raw.alignment = std::max(raw.alignment, e.req.alignment);
+    raw.memoryTypeBits &= e.req.memoryTypeBits;
+  }
+  if (!raw.memoryTypeBits) {
+    logE("AliasPool::alloc: the Images have no memory type in common\n");
+    return 1;
+  }
+  place();
+  raw.size = total;
+  mem.category = MEMORY_CATEGORY_ATTACHMENT;
+
+  VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if (lazy && hasLazilyAllocated(dev, raw.memoryTypeBits)) {
+    props |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+  }
+#ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
+  MemoryRequirements req(dev, raw);
+  mem.vmaAlloc.requiredProps = props;
+#else
+  MemoryRequirements req(dev, raw, VMA_MEMORY_USAGE_UNKNOWN);
+  req.info.requiredFlags = props;
+#endif
+  if (mem.alloc(req)) {
+    logE("AliasPool::alloc: alloc(0x%llx) failed\n", (unsigned long long)total);
+    return 1;
+  }
+
+#ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
+  VkDeviceMemory vkmem = mem.vmaAlloc.vk;
+  VkDeviceSize base = 0;
+#else
+  VmaAllocationInfo info;
+  if (mem.getAllocInfo(info)) {
+    return 1;
+  }
+  VkDeviceMemory vkmem = info.deviceMemory;
+  VkDeviceSize base = info.offset;
+#endif
+  for (auto& e : entries) {
+    VkResult v = vkBindImageMemory(dev.dev, e.img->vk, vkmem, base + e.offset);
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkBindImageMemory", v, string_VkResult(v));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+bool AliasPool::overlaps(size_t i, size_t j) const {
+  auto& a = entries.at(i);
+  auto& b = entries.at(j);
+  return a.offset < b.offset + b.req.size && b.offset < a.offset + a.req.size;
+}
+
+VkDeviceSize AliasPool::unaliasedSize() const {
+  VkDeviceSize sum = 0;
+  for (auto& e : entries) {
+    sum += e.req.size;
+  }
+  return sum;
+}
+
+}  // namespace memory
@@ -30,6 +30,19 @@ int Buffer::validateBufferCreateInfo(const std::vector<uint32_t>& queueFams) {
   }
   info.queueFamilyIndexCount = queueFams.size();
   info.pQueueFamilyIndices = queueFams.data();
+
+  // Tag mem for MemoryReport if the app did not.
+  if (mem.category == MEMORY_CATEGORY_OTHER) {
+    if (info.usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
+      mem.category = MEMORY_CATEGORY_VERTEX;
+    } else if (info.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+      mem.category = MEMORY_CATEGORY_UNIFORM;
+    } else if (!(info.usage & ~(VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT))) {
+      mem.category = MEMORY_CATEGORY_STAGING;
+    }
+  }
   return 0;
 }
 
@@ -119,6 +132,7 @@ int Buffer::reset() {
 #ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
   mem.vmaAlloc.allocSize = 0;
   mem.vmaAlloc.vk.reset(mem.dev.dev);
+  mem.track(0, 0);
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
   vk.reset(mem.dev.dev);
   return 0;
@@ -163,8 +177,10 @@ int Buffer::copyFromHost(const void* src, size_t len,
     return 1;
   }
   memcpy(reinterpret_cast<char*>(mapped) + dstOffset, src, len);
+  // flushRange does nothing if the memory is host coherent.
+  int r = mem.flushRange(dstOffset, len);
   mem.munmap();
-  return 0;
+  return r;
 }
 
 int UniformBuffer::copyAndKeepMmap(command::CommandPool& pool, const void* src,
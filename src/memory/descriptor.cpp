@@ -7,9 +7,6 @@ namespace memory {
 
 int DescriptorPool::ctorError(
     uint32_t maxSets, const std::multiset<VkDescriptorType>& descriptors) {
-  VkDescriptorPoolCreateInfo VkInit(info);
-  info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-
   // Vulkan Spec says: "If multiple VkDescriptorPoolSize structures appear in
   // the pPoolSizes array then the pool will be created with enough storage
   // for the total number of descriptors of each type."
@@ -31,7 +28,13 @@ int DescriptorPool::ctorError(
     poolSize.type = dType;
     poolSize.descriptorCount = 1;
   }
+  return ctorError(maxSets, poolSizes);
+}
 
+int DescriptorPool::ctorError(
+    uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes) {
+  VkDescriptorPoolCreateInfo VkInit(info);
+  info.flags = flags;
   info.poolSizeCount = poolSizes.size();
   info.pPoolSizes = poolSizes.data();
   info.maxSets = maxSets;
@@ -53,14 +56,34 @@ int DescriptorSetLayout::ctorError(
   // Save the descriptor types that make up this layout.
   types.clear();
   types.reserve(bindings.size());
+  this->bindings.clear();
+  this->bindings.reserve(bindings.size());
   for (auto& binding : bindings) {
     types.emplace_back(binding.descriptorType);
+    this->bindings.emplace_back(binding);
+    this->bindings.back().pImmutableSamplers = nullptr;
   }
 
   VkDescriptorSetLayoutCreateInfo VkInit(info);
   info.bindingCount = bindings.size();
   info.pBindings = bindings.data();
 
+  VkDescriptorSetLayoutBindingFlagsCreateInfoEXT VkInit(flagsInfo);
+  if (!bindingFlags.empty()) {
+    if (bindingFlags.size() != bindings.size()) {
+      logE("DescriptorSetLayout: %zu bindingFlags but %zu bindings\n",
+           bindingFlags.size(), bindings.size());
+      return 1;
+    }
+    flagsInfo.bindingCount = bindingFlags.size();
+    flagsInfo.pBindingFlags = bindingFlags.data();
+    info.pNext = &flagsInfo;
+    if (isUpdateAfterBind()) {
+      info.flags |=
+          VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    }
+  }
+
 #if VK_HEADER_VERSION != 74
 /* Fix the excessive #ifndef __ANDROID__ below to just use the Android Loader
  * once KhronosGroup lands support. */
@@ -95,10 +118,15 @@ int DescriptorSetLayout::ctorError(
 }
 
 DescriptorSet::~DescriptorSet() {
+  // A pool without FREE_DESCRIPTOR_SET_BIT only releases its sets in reset().
+  if (vk == VK_NULL_HANDLE || !pool.vk ||
+      !(pool.flags & VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)) {
+    return;
+  }
   VkResult v = vkFreeDescriptorSets(pool.dev.dev, pool.vk, 1, &vk);
   if (v != VK_SUCCESS) {
+    // The set is leaked until the pool is reset or destroyed.
     logE("%s failed: %d (%s)\n", "vkFreeDescriptorSets", v, string_VkResult(v));
-    exit(1);
   }
 }
 
@@ -125,8 +153,9 @@ int DescriptorSet::ctorError(const DescriptorSetLayout& layout) {
 }
 
 int DescriptorSet::write(uint32_t binding,
-                         const std::vector<VkDescriptorImageInfo> imageInfo,
+                         const std::vector<VkDescriptorImageInfo>& imageInfo,
                          uint32_t arrayI /*= 0*/) {
+  VOLCANO_TRACE_SCOPE("DescriptorSet::write");
   if (binding > types.size()) {
     logE("DescriptorSet::write(%u, %s): binding=%u with only %zu bindings\n",
          binding, "imageInfo", binding, types.size());
@@ -155,8 +184,9 @@ int DescriptorSet::write(uint32_t binding,
 }
 
 int DescriptorSet::write(uint32_t binding,
-                         const std::vector<VkDescriptorBufferInfo> bufferInfo,
+                         const std::vector<VkDescriptorBufferInfo>& bufferInfo,
                          uint32_t arrayI /*= 0*/) {
+  VOLCANO_TRACE_SCOPE("DescriptorSet::write");
   if (binding > types.size()) {
     logE("DescriptorSet::write(%u, %s): binding=%u with only %zu bindings\n",
          binding, "bufferInfo", binding, types.size());
@@ -185,8 +215,9 @@ int DescriptorSet::write(uint32_t binding,
 }
 
 int DescriptorSet::write(uint32_t binding,
-                         const std::vector<VkBufferView> texelBufferViewInfo,
+                         const std::vector<VkBufferView>& texelBufferViewInfo,
                          uint32_t arrayI /*= 0*/) {
+  VOLCANO_TRACE_SCOPE("DescriptorSet::write");
   if (binding > types.size()) {
     logE("DescriptorSet::write(%u, %s): binding=%u with only %zu bindings\n",
          binding, "VkBufferView", binding, types.size());
@@ -212,4 +243,361 @@ int DescriptorSet::write(uint32_t binding,
   return 0;
 }
 
+namespace {  // an anonymous namespace hides its contents outside this file
+
+// imageInfoType returns true if t uses VkDescriptorImageInfo.
+bool imageInfoType(VkDescriptorType t) {
+  switch (t) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// bufferInfoType returns true if t uses VkDescriptorBufferInfo.
+bool bufferInfoType(VkDescriptorType t) {
+  switch (t) {
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// texelBufferViewType returns true if t uses VkBufferView.
+bool texelBufferViewType(VkDescriptorType t) {
+  return t == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER ||
+         t == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+}
+
+}  // anonymous namespace
+
+int DescriptorWriter::add(VkDescriptorSet set,
+                          const std::vector<VkDescriptorType>& types,
+                          uint32_t binding, uint32_t count, uint32_t arrayI,
+                          size_t firstI, bool (*typeOk)(VkDescriptorType),
+                          const char* what) {
+  if (binding >= types.size()) {
+    logE("DescriptorWriter::write(%u, %s): only %zu bindings\n", binding, what,
+         types.size());
+    return 1;
+  }
+  auto t = types.at(binding);
+  if (!typeOk(t)) {
+    logE("DescriptorWriter::write(%u, %s): binding=%u has type %s\n", binding,
+         what, binding, string_VkDescriptorType(t));
+    return 1;
+  }
+  writes.emplace_back();
+  auto& w = writes.back();
+  VkOverwrite(w);
+  w.dstSet = set;
+  w.dstBinding = binding;
+  w.dstArrayElement = arrayI;
+  w.descriptorType = t;
+  w.descriptorCount = count;
+  first.emplace_back(firstI);
+  return 0;
+}
+
+int DescriptorWriter::write(VkDescriptorSet set,
+                            const std::vector<VkDescriptorType>& types,
+                            uint32_t binding,
+                            const VkDescriptorImageInfo* imageInfo,
+                            uint32_t count, uint32_t arrayI) {
+  if (add(set, types, binding, count, arrayI, imageInfos.size(),
+          imageInfoType, "imageInfo")) {
+    return 1;
+  }
+  imageInfos.insert(imageInfos.end(), imageInfo, imageInfo + count);
+  return 0;
+}
+
+int DescriptorWriter::write(VkDescriptorSet set,
+                            const std::vector<VkDescriptorType>& types,
+                            uint32_t binding,
+                            const VkDescriptorBufferInfo* bufferInfo,
+                            uint32_t count, uint32_t arrayI) {
+  if (add(set, types, binding, count, arrayI, bufferInfos.size(),
+          bufferInfoType, "bufferInfo")) {
+    return 1;
+  }
+  bufferInfos.insert(bufferInfos.end(), bufferInfo, bufferInfo + count);
+  return 0;
+}
+
+int DescriptorWriter::write(VkDescriptorSet set,
+                            const std::vector<VkDescriptorType>& types,
+                            uint32_t binding,
+                            const VkBufferView* texelBufferView,
+                            uint32_t count, uint32_t arrayI) {
+  if (add(set, types, binding, count, arrayI, texelBufferViews.size(),
+          texelBufferViewType, "VkBufferView")) {
+    return 1;
+  }
+  texelBufferViews.insert(texelBufferViews.end(), texelBufferView,
+                          texelBufferView + count);
+  return 0;
+}
+
+int DescriptorWriter::copy(DescriptorSet& src, uint32_t srcBinding,
+                           DescriptorSet& dst, uint32_t dstBinding,
+                           uint32_t count /*= 1*/, uint32_t srcArrayI /*= 0*/,
+                           uint32_t dstArrayI /*= 0*/) {
+  if (srcBinding >= src.types.size() || dstBinding >= dst.types.size()) {
+    logE("DescriptorWriter::copy(%u, %u): only %zu and %zu bindings\n",
+         srcBinding, dstBinding, src.types.size(), dst.types.size());
+    return 1;
+  }
+  if (src.types.at(srcBinding) != dst.types.at(dstBinding)) {
+    logE("DescriptorWriter::copy(%u, %u): type %s != %s\n", srcBinding,
+         dstBinding, string_VkDescriptorType(src.types.at(srcBinding)),
+         string_VkDescriptorType(dst.types.at(dstBinding)));
+    return 1;
+  }
+  copies.emplace_back();
+  auto& c = copies.back();
+  VkOverwrite(c);
+  c.srcSet = src.vk;
+  c.srcBinding = srcBinding;
+  c.srcArrayElement = srcArrayI;
+  c.dstSet = dst.vk;
+  c.dstBinding = dstBinding;
+  c.dstArrayElement = dstArrayI;
+  c.descriptorCount = count;
+  return 0;
+}
+
+void DescriptorWriter::flush() {
+  VOLCANO_TRACE_SCOPE("DescriptorWriter::flush");
+  for (size_t i = 0; i < writes.size(); i++) {
+    auto& w = writes.at(i);
+    if (imageInfoType(w.descriptorType)) {
+      w.pImageInfo = imageInfos.data() + first.at(i);
+    } else if (bufferInfoType(w.descriptorType)) {
+      w.pBufferInfo = bufferInfos.data() + first.at(i);
+    } else {
+      w.pTexelBufferView = texelBufferViews.data() + first.at(i);
+    }
+  }
+  if (!writes.empty() || !copies.empty()) {
+    vkUpdateDescriptorSets(dev.dev, writes.size(), writes.data(),
+                           copies.size(), copies.data());
+  }
+  // clear() keeps the capacity for the next flush().
+  writes.clear();
+  first.clear();
+  imageInfos.clear();
+  bufferInfos.clear();
+  texelBufferViews.clear();
+  copies.clear();
+}
+
+int DescriptorAllocator::ctorError(size_t framesInFlight /*= 1*/) {
+  if (!framesInFlight || !setsPerPool) {
+    logE("DescriptorAllocator: framesInFlight=%zu setsPerPool=%u is invalid\n",
+         framesInFlight, setsPerPool);
+    return 1;
+  }
+  frames.clear();
+  frames.resize(framesInFlight);
+  frame_i = 0;
+  return 0;
+}
+
+int DescriptorAllocator::beginFrame(size_t frame_i) {
+  if (frame_i >= frames.size()) {
+    logE("DescriptorAllocator::beginFrame(%zu): only %zu framesInFlight\n",
+         frame_i, frames.size());
+    return 1;
+  }
+  auto& f = frames.at(frame_i);
+  // Only pools up to f.cur have had any sets allocated from them.
+  for (size_t i = 0; i < f.pools.size() && i <= f.cur; i++) {
+    if (f.pools.at(i)->reset()) {
+      logE("DescriptorAllocator::beginFrame(%zu): pool[%zu] reset failed\n",
+           frame_i, i);
+      return 1;
+    }
+  }
+  f.cur = 0;
+  this->frame_i = frame_i;
+  return 0;
+}
+
+int DescriptorAllocator::addPool(Frame& f) {
+  // Count each type once instead of inserting setsPerPool copies of it.
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  for (auto it = typesPerSet.begin(); it != typesPerSet.end();
+       it = typesPerSet.upper_bound(*it)) {
+    poolSizes.emplace_back();
+    auto& poolSize = poolSizes.back();
+    VkOverwrite(poolSize);
+    poolSize.type = *it;
+    poolSize.descriptorCount = typesPerSet.count(*it) * setsPerPool;
+  }
+  f.pools.emplace_back(new DescriptorPool(dev));
+  auto& pool = *f.pools.back();
+  // Sets are only released by DescriptorPool::reset.
+  pool.flags = 0;
+  if (pool.ctorError(setsPerPool, poolSizes)) {
+    logE("DescriptorAllocator: pool[%zu] ctorError failed\n",
+         f.pools.size() - 1);
+    f.pools.pop_back();
+    return 1;
+  }
+  return 0;
+}
+
+int DescriptorAllocator::alloc(const DescriptorSetLayout& layout,
+                               VkDescriptorSet& out) {
+  if (frames.empty()) {
+    logE("BUG: DescriptorAllocator::alloc before ctorError\n");
+    return 1;
+  }
+  if (typesPerSet.empty()) {
+    // layout.types has one entry per binding, but a binding may be an array.
+    for (auto& b : layout.bindings) {
+      for (uint32_t i = 0; i < b.descriptorCount; i++) {
+        typesPerSet.emplace(b.descriptorType);
+      }
+    }
+  }
+  auto& f = frames.at(frame_i);
+  const VkDescriptorSetLayout& setLayout = layout.vk;
+  VkDescriptorSetAllocateInfo VkInit(info);
+  info.descriptorSetCount = 1;
+  info.pSetLayouts = &setLayout;
+  for (bool retried = false;; f.cur++) {
+    if (f.cur >= f.pools.size()) {
+      if (retried) {
+        // A brand new pool could not hold layout: typesPerSet is too small.
+        logE("DescriptorAllocator::alloc: layout does not fit typesPerSet\n");
+        f.cur = f.pools.size() - 1;
+        return 1;
+      }
+      if (addPool(f)) {
+        return 1;
+      }
+      retried = true;
+      f.cur = f.pools.size() - 1;
+    }
+    info.descriptorPool = f.pools.at(f.cur)->vk;
+    VkResult v = vkAllocateDescriptorSets(dev.dev, &info, &out);
+    if (v == VK_SUCCESS) {
+      return 0;
+    }
+    // The spec allows any error code when a pool is exhausted, but these two
+    // are the expected ones. Anything else is a real failure.
+    if (v != VK_ERROR_OUT_OF_POOL_MEMORY && v != VK_ERROR_FRAGMENTED_POOL) {
+      logE("%s failed: %d (%s)\n", "vkAllocateDescriptorSets", v,
+           string_VkResult(v));
+      return 1;
+    }
+  }
+}
+
+int DescriptorIndexAllocator::alloc(uint32_t& out) {
+  if (!freeList.empty()) {
+    out = freeList.back();
+    freeList.pop_back();
+  } else if (next < capacity) {
+    out = next++;
+    inUse.resize(next);
+  } else {
+    logE("DescriptorIndexAllocator::alloc: all %u in use\n", capacity);
+    return 1;
+  }
+  inUse.at(out) = true;
+  return 0;
+}
+
+int DescriptorIndexAllocator::free(uint32_t index) {
+  if (index >= next || !inUse.at(index)) {
+    logE("BUG: DescriptorIndexAllocator::free(%u): not in use\n", index);
+    return 1;
+  }
+  inUse.at(index) = false;
+  freeList.emplace_back(index);
+  return 0;
+}
+
+#ifndef __ANDROID__
+int DescriptorUpdateTemplate::ctorError(const DescriptorSetLayout& layout) {
+  if (dev.apiVersionInUse() < VK_MAKE_VERSION(1, 1, 0)) {
+    logE("DescriptorUpdateTemplate: requires Vulkan 1.1\n");
+    return 1;
+  }
+  entries.clear();
+  size = 0;
+  for (auto& binding : layout.bindings) {
+    size_t stride;
+    if (imageInfoType(binding.descriptorType)) {
+      stride = sizeof(VkDescriptorImageInfo);
+    } else if (bufferInfoType(binding.descriptorType)) {
+      stride = sizeof(VkDescriptorBufferInfo);
+    } else if (texelBufferViewType(binding.descriptorType)) {
+      stride = sizeof(VkBufferView);
+    } else {
+      logE("DescriptorUpdateTemplate: binding=%u has type %s\n",
+           binding.binding, string_VkDescriptorType(binding.descriptorType));
+      return 1;
+    }
+    if (!binding.descriptorCount) {
+      continue;
+    }
+    entries.emplace_back();
+    auto& e = entries.back();
+    e.dstBinding = binding.binding;
+    e.dstArrayElement = 0;
+    e.descriptorCount = binding.descriptorCount;
+    e.descriptorType = binding.descriptorType;
+    e.offset = size;
+    e.stride = stride;
+    size += stride * binding.descriptorCount;
+  }
+
+  VkDescriptorUpdateTemplateCreateInfo VkInit(info);
+  info.descriptorUpdateEntryCount = entries.size();
+  info.pDescriptorUpdateEntries = entries.data();
+  info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+  info.descriptorSetLayout = layout.vk;
+
+  vk.reset(dev.dev);
+  VkResult v =
+      vkCreateDescriptorUpdateTemplate(dev.dev, &info, dev.dev.allocator, &vk);
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkCreateDescriptorUpdateTemplate", v,
+         string_VkResult(v));
+    return 1;
+  }
+  vk.allocator = dev.dev.allocator;
+  return 0;
+}
+
+int DescriptorUpdateTemplate::write(VkDescriptorSet set, const void* data,
+                                    size_t len) {
+  VOLCANO_TRACE_SCOPE("DescriptorUpdateTemplate::write");
+  if (!vk) {
+    logE("BUG: DescriptorUpdateTemplate::write before ctorError\n");
+    return 1;
+  }
+  if (len != size) {
+    logE("DescriptorUpdateTemplate::write: len=%zu but template size=%zu\n",
+         len, size);
+    return 1;
+  }
+  vkUpdateDescriptorSetWithTemplate(dev.dev, set, vk, data);
+  return 0;
+}
+#endif /* __ANDROID__ */
+
 }  // namespace memory
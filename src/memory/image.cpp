@@ -6,6 +6,18 @@
 
 namespace memory {
 
+bool hasLazilyAllocated(language::Device& dev, uint32_t memoryTypeBits) {
+  auto& p = dev.memProps.memoryProperties;
+  for (uint32_t i = 0; i < p.memoryTypeCount; i++) {
+    if ((memoryTypeBits & (1u << i)) &&
+        (p.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 int Image::validateImageCreateInfo() {
   if (!info.extent.width || !info.extent.height || !info.extent.depth ||
       !info.format || !info.usage || !info.mipLevels || !info.arrayLayers) {
@@ -17,6 +29,19 @@ int Image::validateImageCreateInfo() {
       info.flags & (VK_IMAGE_CREATE_BLOCK_TEXEL_VIEW_COMPATIBLE_BIT |
                     VK_IMAGE_CREATE_EXTENDED_USAGE_BIT),
       "Image::info flags=%x", info.flags);
+
+  // Tag mem for MemoryReport if the app did not.
+  if (mem.category == MEMORY_CATEGORY_OTHER) {
+    if (info.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)) {
+      mem.category = MEMORY_CATEGORY_ATTACHMENT;
+    } else if (info.usage &
+               (VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT)) {
+      mem.category = MEMORY_CATEGORY_TEXTURE;
+    }
+  }
   return 0;
 }
 
@@ -61,7 +86,7 @@ int Image::getSubresourceLayouts() {
   return 0;
 }
 
-int Image::ctorError(VkMemoryPropertyFlags props) {
+int Image::ctorWithoutMemory() {
   if (validateImageCreateInfo()) {
     return 1;
   }
@@ -73,6 +98,13 @@ int Image::ctorError(VkMemoryPropertyFlags props) {
     return 1;
   }
   currentLayout = info.initialLayout;
+  return getSubresourceLayouts();
+}
+
+int Image::ctorError(VkMemoryPropertyFlags props) {
+  if (ctorWithoutMemory()) {
+    return 1;
+  }
 
 #ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
   MemoryRequirements req(mem.dev, *this);
@@ -81,29 +113,46 @@ int Image::ctorError(VkMemoryPropertyFlags props) {
   MemoryRequirements req(mem.dev, *this, VMA_MEMORY_USAGE_UNKNOWN);
   req.info.requiredFlags = props;
 #endif
-  if (mem.alloc(req)) {
-    return 1;
-  }
-
-  return getSubresourceLayouts();
+  return mem.alloc(req);
 }
 
 #ifndef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
 int Image::ctorError(VmaMemoryUsage usage) {
-  if (validateImageCreateInfo()) {
+  return ctorWithoutMemory() || mem.alloc({mem.dev, *this, usage});
+}
+#endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+
+int Image::ctorTransient() {
+  const VkImageUsageFlags attachmentOnly =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  if (info.usage & ~attachmentOnly) {
+    logE("Image::ctorTransient: usage %x is not only attachments\n",
+         info.usage);
     return 1;
   }
-
-  vk.reset(mem.dev.dev);
-  VkResult v = vkCreateImage(mem.dev.dev, &info, mem.dev.dev.allocator, &vk);
-  if (v != VK_SUCCESS) {
-    logE("%s failed: %d (%s)\n", "vkCreateImage", v, string_VkResult(v));
+  info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  if (ctorWithoutMemory()) {
     return 1;
   }
-  currentLayout = info.initialLayout;
-  return mem.alloc({mem.dev, *this, usage}) || getSubresourceLayouts();
+
+  VkMemoryRequirements raw;
+  vkGetImageMemoryRequirements(mem.dev.dev, vk, &raw);
+  VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if (hasLazilyAllocated(mem.dev, raw.memoryTypeBits)) {
+    props |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+  }
+#ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
+  MemoryRequirements req(mem.dev, *this);
+  mem.vmaAlloc.requiredProps = props;
+#else
+  MemoryRequirements req(mem.dev, *this, VMA_MEMORY_USAGE_UNKNOWN);
+  req.info.requiredFlags = props;
+#endif
+  return mem.alloc(req);
 }
-#endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
 
 int Image::bindMemory(VkDeviceSize offset /*= 0*/) {
   VkResult v;
@@ -153,6 +202,7 @@ int Image::reset() {
 #ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
   mem.vmaAlloc.allocSize = 0;
   mem.vmaAlloc.vk.reset(mem.dev.dev);
+  mem.track(0, 0);
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
   vk.reset(mem.dev.dev);
   return 0;
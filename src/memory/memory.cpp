@@ -18,14 +18,17 @@ DeviceMemory::~DeviceMemory() {
     if (getAllocInfo(info)) {
       logF("~DeviceMemory: BUG: getAllocInfo failed\n");
     }
-    if (info.pMappedData) {
+    // vmaFreeMemory handles VMA_ALLOCATION_CREATE_MAPPED_BIT (mapped).
+    if (info.pMappedData && !mapped) {
       vmaUnmapMemory(dev.vmaAllocator, vmaAlloc);
     }
     vmaFreeMemory(dev.vmaAllocator, vmaAlloc);
+    track(0, 0);
   }
 }
 
 int DeviceMemory::alloc(MemoryRequirements req) {
+  VOLCANO_TRACE_SCOPE("DeviceMemory::alloc");
   if (!dev.vmaAllocator) {
     DeviceMemory::lock_guard_t lock(dev.lockmutex);
     if (!dev.phys || !dev.dev) {
@@ -83,18 +86,26 @@ int DeviceMemory::alloc(MemoryRequirements req) {
     logE("Please set MemoryRequirements::info.usage before calling alloc.\n");
     return 1;
   }
+  if (persistentMap) {
+    pInfo->flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  }
   DeviceMemory::lock_guard_t lock(lockmutex);
   VkResult r;
+  VmaAllocationInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(allocInfo));
   if (req.vkbuf) {
     if (req.vkimg) {
       logE("MemoryRequirements with both vkbuf and vkimg is invalid.\n");
       return 1;
     }
     r = vmaAllocateMemoryForBuffer(dev.vmaAllocator, req.vkbuf, pInfo,
-                                   &vmaAlloc, NULL);
+                                   &vmaAlloc, &allocInfo);
   } else if (req.vkimg) {
     r = vmaAllocateMemoryForImage(dev.vmaAllocator, req.vkimg, pInfo, &vmaAlloc,
-                                  NULL);
+                                  &allocInfo);
+  } else if (req.vkraw.size) {
+    r = vmaAllocateMemory(dev.vmaAllocator, &req.vkraw, pInfo, &vmaAlloc,
+                          &allocInfo);
   } else {
     logE("MemoryRequirements::get not called yet.\n");
     return 1;
@@ -104,6 +115,14 @@ int DeviceMemory::alloc(MemoryRequirements req) {
          string_VkResult(r));
     return 1;
   }
+  track(allocInfo.size, allocInfo.memoryType);
+  if (persistentMap) {
+    mapped = allocInfo.pMappedData;
+    if (!mapped) {
+      logE("alloc: persistentMap failed. Is the memory host visible?\n");
+      return 1;
+    }
+  }
   return 0;
 }
 
@@ -121,6 +140,10 @@ int DeviceMemory::getAllocInfo(VmaAllocationInfo& info) {
 int DeviceMemory::mmap(void** pData, VkDeviceSize offset /*= 0*/,
                        VkDeviceSize size /*= VK_WHOLE_SIZE*/,
                        VkMemoryMapFlags flags /*= 0*/) {
+  if (mapped) {
+    *pData = reinterpret_cast<void*>(reinterpret_cast<char*>(mapped) + offset);
+    return 0;
+  }
   lock_guard_t lock(lockmutex);
   (void)size;
   (void)flags;
@@ -144,14 +167,14 @@ void DeviceMemory::makeRange(VkMappedMemoryRange& range,
   range.size = info.size;
 }
 
-int DeviceMemory::flush() {
-  VmaAllocationInfo info;
-  if (getAllocInfo(info)) {
-    logE("flush: getAllocInfo failed\n");
-    return 1;
-  }
-  VkResult v =
-      vmaFlushAllocation(dev.vmaAllocator, vmaAlloc, info.offset, info.size);
+// flush and invalidate pass offsets relative to the start of vmaAlloc.
+int DeviceMemory::flush() { return flushRange(0, VK_WHOLE_SIZE); }
+
+int DeviceMemory::invalidate() { return invalidateRange(0, VK_WHOLE_SIZE); }
+
+int DeviceMemory::flushRange(VkDeviceSize offset, VkDeviceSize size) {
+  // vmaFlushAllocation aligns to nonCoherentAtomSize and skips coherent memory.
+  VkResult v = vmaFlushAllocation(dev.vmaAllocator, vmaAlloc, offset, size);
   if (v != VK_SUCCESS) {
     logE("%s failed: %d (%s)\n", "vmaFlushAllocation", v, string_VkResult(v));
     return 1;
@@ -159,14 +182,11 @@ int DeviceMemory::flush() {
   return 0;
 }
 
-int DeviceMemory::invalidate() {
-  VmaAllocationInfo info;
-  if (getAllocInfo(info)) {
-    logE("flush: getAllocInfo failed\n");
-    return 1;
-  }
-  VkResult v = vmaInvalidateAllocation(dev.vmaAllocator, vmaAlloc, info.offset,
-                                       info.size);
+int DeviceMemory::invalidateRange(VkDeviceSize offset, VkDeviceSize size) {
+  // vmaInvalidateAllocation aligns to nonCoherentAtomSize and skips coherent
+  // memory.
+  VkResult v =
+      vmaInvalidateAllocation(dev.vmaAllocator, vmaAlloc, offset, size);
   if (v != VK_SUCCESS) {
     logE("%s failed: %d (%s)\n", "vmaInvalidateAllocation", v,
          string_VkResult(v));
@@ -176,6 +196,9 @@ int DeviceMemory::invalidate() {
 }
 
 void DeviceMemory::munmap() {
+  if (mapped) {
+    return;
+  }
   lock_guard_t lock(lockmutex);
   vmaUnmapMemory(dev.vmaAllocator, vmaAlloc);
 }
@@ -187,9 +210,11 @@ DeviceMemory::~DeviceMemory() {
     vmaAlloc.mapped = 0;
     vkUnmapMemory(dev.dev, vmaAlloc.vk);
   }
+  track(0, 0);
 }
 
 int DeviceMemory::alloc(MemoryRequirements req) {
+  VOLCANO_TRACE_SCOPE("DeviceMemory::alloc");
   if (req.findVkalloc(vmaAlloc.requiredProps)) {
     return 1;
   }
@@ -201,12 +226,23 @@ int DeviceMemory::alloc(MemoryRequirements req) {
     logE("%s failed: %d (%s)\n", "vkAllocateMemory", v, string_VkResult(v));
     return 1;
   }
+  track(req.vkalloc.allocationSize, req.vkalloc.memoryTypeIndex);
+  if (persistentMap) {
+    if (mmap(&mapped)) {
+      logE("alloc: persistentMap failed\n");
+      return 1;
+    }
+  }
   return 0;
 }
 
 int DeviceMemory::mmap(void** pData, VkDeviceSize offset /*= 0*/,
                        VkDeviceSize size /*= VK_WHOLE_SIZE*/,
                        VkMemoryMapFlags flags /*= 0*/) {
+  if (mapped) {
+    *pData = reinterpret_cast<void*>(reinterpret_cast<char*>(mapped) + offset);
+    return 0;
+  }
   VkResult v = vkMapMemory(dev.dev, vmaAlloc.vk, offset, size, flags, pData);
   if (v != VK_SUCCESS) {
     logE("%s failed: %d (%s)\n", "vkMapMemory", v, string_VkResult(v));
@@ -251,7 +287,51 @@ int DeviceMemory::invalidate(const std::vector<VkMappedMemoryRange>& mem) {
   return 0;
 }
 
+// alignRange widens range to a multiple of nonCoherentAtomSize, but not past
+// the end of the allocation.
+static void alignRange(language::Device& dev, VkDeviceSize allocSize,
+                       VkMappedMemoryRange& range) {
+  VkDeviceSize atom = dev.physProp.properties.limits.nonCoherentAtomSize;
+  if (atom < 1) {
+    atom = 1;
+  }
+  if (range.offset >= allocSize) {
+    range.offset = allocSize;
+    range.size = 0;
+    return;
+  }
+  VkDeviceSize end = allocSize;
+  if (range.size != VK_WHOLE_SIZE && range.size < allocSize - range.offset) {
+    end = (range.offset + range.size + atom - 1) / atom * atom;
+  }
+  range.offset = range.offset / atom * atom;
+  range.size = (end < allocSize) ? end - range.offset : VK_WHOLE_SIZE;
+}
+
+int DeviceMemory::flushRange(VkDeviceSize offset, VkDeviceSize size) {
+  if (vmaAlloc.requiredProps & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+    return 0;
+  }
+  std::vector<VkMappedMemoryRange> mem(1);
+  makeRange(mem.at(0), offset, size);
+  alignRange(dev, vmaAlloc.allocSize, mem.at(0));
+  return flush(mem);
+}
+
+int DeviceMemory::invalidateRange(VkDeviceSize offset, VkDeviceSize size) {
+  if (vmaAlloc.requiredProps & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+    return 0;
+  }
+  std::vector<VkMappedMemoryRange> mem(1);
+  makeRange(mem.at(0), offset, size);
+  alignRange(dev, vmaAlloc.allocSize, mem.at(0));
+  return invalidate(mem);
+}
+
 void DeviceMemory::munmap() {
+  if (mapped) {
+    return;
+  }
   vkUnmapMemory(dev.dev, vmaAlloc.vk);
   vmaAlloc.mapped = 0;
 }
@@ -367,4 +447,59 @@ int MemoryRequirements::findVkalloc(VkMemoryPropertyFlags props) {
 }
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
 
+const char* memoryCategoryName(MemoryCategory c) {
+  switch (c) {
+    case MEMORY_CATEGORY_OTHER:
+      return "other";
+    case MEMORY_CATEGORY_VERTEX:
+      return "vertex";
+    case MEMORY_CATEGORY_TEXTURE:
+      return "texture";
+    case MEMORY_CATEGORY_UNIFORM:
+      return "uniform";
+    case MEMORY_CATEGORY_STAGING:
+      return "staging";
+    case MEMORY_CATEGORY_ATTACHMENT:
+      return "attachment";
+    case MEMORY_CATEGORY_COUNT:
+      break;
+  }
+  return "invalid";
+}
+
+void DeviceMemory::track(VkDeviceSize size, uint32_t memoryTypeIndex) {
+  language::Device::lock_guard_t lock(dev.lockmutex);
+  auto& mp = dev.memProps.memoryProperties;
+  dev.memoryCategoryBytes.resize(MEMORY_CATEGORY_COUNT);
+  dev.memoryCategoryCount.resize(MEMORY_CATEGORY_COUNT);
+  dev.memoryHeapBytes.resize(mp.memoryHeapCount);
+  if (trackedSize) {
+    dev.memoryCategoryBytes.at(trackedCategory) -= trackedSize;
+    dev.memoryCategoryCount.at(trackedCategory)--;
+    if (trackedType < mp.memoryTypeCount) {
+      auto heap = mp.memoryTypes[trackedType].heapIndex;
+      if (heap < dev.memoryHeapBytes.size()) {
+        dev.memoryHeapBytes.at(heap) -= trackedSize;
+      }
+    }
+  }
+  trackedSize = size;
+  trackedType = memoryTypeIndex;
+  trackedCategory = category;
+  if ((size_t)trackedCategory >= MEMORY_CATEGORY_COUNT) {
+    trackedCategory = MEMORY_CATEGORY_OTHER;
+  }
+  if (!size) {
+    return;
+  }
+  dev.memoryCategoryBytes.at(trackedCategory) += size;
+  dev.memoryCategoryCount.at(trackedCategory)++;
+  if (memoryTypeIndex < mp.memoryTypeCount) {
+    auto heap = mp.memoryTypes[memoryTypeIndex].heapIndex;
+    if (heap < dev.memoryHeapBytes.size()) {
+      dev.memoryHeapBytes.at(heap) += size;
+    }
+  }
+}
+
 }  // namespace memory
@@ -42,6 +42,24 @@ typedef struct VmaAllocation {
 } VmaAllocation;
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
 
+// MemoryCategory tags what a DeviceMemory holds, for MemoryReport.
+enum MemoryCategory {
+  MEMORY_CATEGORY_OTHER = 0,
+  // MEMORY_CATEGORY_VERTEX is vertex and index buffers.
+  MEMORY_CATEGORY_VERTEX,
+  // MEMORY_CATEGORY_TEXTURE is sampled and storage images.
+  MEMORY_CATEGORY_TEXTURE,
+  MEMORY_CATEGORY_UNIFORM,
+  // MEMORY_CATEGORY_STAGING is buffers only used for transfers.
+  MEMORY_CATEGORY_STAGING,
+  // MEMORY_CATEGORY_ATTACHMENT is render targets and depth buffers.
+  MEMORY_CATEGORY_ATTACHMENT,
+  MEMORY_CATEGORY_COUNT
+};
+
+// memoryCategoryName returns a short name for c, such as "vertex".
+const char* memoryCategoryName(MemoryCategory c);
+
 struct MemoryRequirements;
 
 // DeviceMemory represents a raw chunk of bytes that can be accessed by the
@@ -73,6 +91,14 @@ typedef struct DeviceMemory {
   // Explicit move constructor because of lockmutex:
   DeviceMemory(DeviceMemory&& other)
       : dev(other.dev), vmaAlloc(std::move(other.vmaAlloc)) {
+    persistentMap = other.persistentMap;
+    mapped = other.mapped;
+    other.mapped = nullptr;
+    category = other.category;
+    trackedSize = other.trackedSize;
+    trackedType = other.trackedType;
+    trackedCategory = other.trackedCategory;
+    other.trackedSize = 0;
 #ifndef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
     if (other.lockmutex.try_lock()) {
       other.vmaAlloc = 0;
@@ -100,6 +126,7 @@ typedef struct DeviceMemory {
   // mmap() calls vkMapMemory() and returns non-zero on error.
   // NOTE: The vkMapMemory spec currently says "flags is reserved for future
   // use." You probably can ignore the flags parameter.
+  // If persistentMap was set, mmap() just returns mapped + offset.
   WARN_UNUSED_RESULT int mmap(void** pData, VkDeviceSize offset = 0,
                               VkDeviceSize size = VK_WHOLE_SIZE,
                               VkMemoryMapFlags flags = 0);
@@ -135,9 +162,39 @@ typedef struct DeviceMemory {
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
   );
 
-  // munmap() calls vkUnmapMemory().
+  // flushRange is like flush but only for the bytes from offset to
+  // offset + size (relative to the start of this DeviceMemory). The range is
+  // widened to a multiple of nonCoherentAtomSize as Vulkan requires.
+  // Nothing is done if the memory is VK_MEMORY_PROPERTY_HOST_COHERENT_BIT.
+  WARN_UNUSED_RESULT int flushRange(VkDeviceSize offset, VkDeviceSize size);
+
+  // invalidateRange is like invalidate but only for the bytes from offset to
+  // offset + size (relative to the start of this DeviceMemory). The range is
+  // widened to a multiple of nonCoherentAtomSize as Vulkan requires.
+  // Nothing is done if the memory is VK_MEMORY_PROPERTY_HOST_COHERENT_BIT.
+  WARN_UNUSED_RESULT int invalidateRange(VkDeviceSize offset,
+                                         VkDeviceSize size);
+
+  // munmap() calls vkUnmapMemory(). It does nothing if persistentMap was set.
   void munmap();
 
+  // persistentMap can be set before alloc() to keep the memory mapped for its
+  // whole lifetime (using VMA_ALLOCATION_CREATE_MAPPED_BIT). The memory must
+  // be host visible. Then mapped can be written without any locking, followed
+  // by flushRange() if the memory is not host coherent.
+  bool persistentMap{false};
+  // mapped is set by alloc() if persistentMap is set. It stays valid until
+  // this DeviceMemory is destroyed.
+  void* mapped{nullptr};
+
+  // category can be set before alloc() to tag this memory in MemoryReport.
+  // Buffer and Image set it from info.usage if it is MEMORY_CATEGORY_OTHER.
+  MemoryCategory category{MEMORY_CATEGORY_OTHER};
+
+  // track updates the totals in dev that MemoryReport uses. alloc() calls it,
+  // and it is called with size 0 when the memory is freed.
+  void track(VkDeviceSize size, uint32_t memoryTypeIndex);
+
   language::Device& dev;
   // vmaAlloc is an internal struct if VOLCANO_DISABLE_VULKANMEMORYALLOCATOR:
   VmaAllocation vmaAlloc;
@@ -152,7 +209,16 @@ typedef struct DeviceMemory {
   // Instead of: std::lock_guard<std::recursive_mutex> lock(mem.lockmutex);
   // Do this:    DeviceMemory::lock_guard_t            lock(mem.lockmutex);
   // (Then uses of lock_guard_t do not assume lockmutex is a recursive_mutex.)
+#ifdef VOLCANO_TRACE
+  // With VOLCANO_TRACE, lock_guard_t also records contention on lockmutex.
+  struct LockName {
+    static const char* name() { return "DeviceMemory::lockmutex"; }
+  };
+  typedef language::trace::TracedLockGuard<std::recursive_mutex, LockName>
+      lock_guard_t;
+#else  /*VOLCANO_TRACE*/
   typedef std::lock_guard<std::recursive_mutex> lock_guard_t;
+#endif /*VOLCANO_TRACE*/
   // unique_lock_t: like c++17's constructor type inference, but in c++11
   // Instead of: std::unique_lock<std::recursive_mutex> lock(mem.lockmutex);
   // Do this:    DeviceMemory::unique_lock_t            lock(mem.lockmutex);
@@ -162,6 +228,12 @@ typedef struct DeviceMemory {
   // lockmutex is used internally when vulkanmemoryallocator requires a mutex.
   std::recursive_mutex lockmutex;
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+
+ protected:
+  // trackedSize, trackedType and trackedCategory are what track() last added.
+  VkDeviceSize trackedSize{0};
+  uint32_t trackedType{0};
+  MemoryCategory trackedCategory{MEMORY_CATEGORY_OTHER};
 } DeviceMemory;
 
 // Image represents a VkImage.
@@ -234,6 +306,24 @@ typedef struct Image {
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
   }
 
+  // ctorHostPersistent is like ctorHostVisible but mem.mapped is set and stays
+  // mapped. Use mem.flushRange() after writing to mem.mapped.
+  WARN_UNUSED_RESULT int ctorHostPersistent() {
+    mem.persistentMap = true;
+    return ctorHostVisible();
+  }
+
+  // ctorTransient is for an attachment that never leaves its RenderPass (its
+  // storeOp is DONT_CARE). info.usage may only have attachment bits.
+  // VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT is added, and if the device has
+  // VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT memory it is used, so a tile-based
+  // GPU may never back the image with real memory.
+  WARN_UNUSED_RESULT int ctorTransient();
+
+  // ctorWithoutMemory creates vk but does not allocate mem. It is used by
+  // AliasPool to bind several Images to one allocation.
+  WARN_UNUSED_RESULT int ctorWithoutMemory();
+
   // bindMemory() calls vkBindImageMemory which binds this->mem
   // or automatically upgrades to vkBindImageMemory2 if supported.
   // Note: do not call bindMemory() until a point after ctorError().
@@ -367,6 +457,15 @@ typedef struct Buffer {
                      queueFams);
   }
 
+  // ctorHostPersistent is like ctorHostVisible but mem.mapped is set and stays
+  // mapped, which suits buffers rewritten every frame (such as dynamic vertex
+  // or instance data). Use mem.flushRange() after writing to mem.mapped.
+  WARN_UNUSED_RESULT int ctorHostPersistent(
+      const std::vector<uint32_t>& queueFams = std::vector<uint32_t>()) {
+    mem.persistentMap = true;
+    return ctorHostVisible(queueFams);
+  }
+
   // bindMemory() calls vkBindBufferMemory which binds this->mem.
   // Note: do not call bindMemory() until a point after ctorError().
   WARN_UNUSED_RESULT int bindMemory(VkDeviceSize offset = 0);
@@ -446,6 +545,11 @@ typedef struct MemoryRequirements {
       logF("MemoryRequirements ctor: get(Buffer) failed\n");
     }
   }
+  // Use raw VkMemoryRequirements, e.g. for several Images in an AliasPool.
+  MemoryRequirements(language::Device& dev, const VkMemoryRequirements& raw)
+      : dev(dev) {
+    get(raw);
+  }
 #else  /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
   // Automatically get MemoryRequirements of a VkImage.
   MemoryRequirements(language::Device& dev, VkImage img, VmaMemoryUsage usage)
@@ -479,6 +583,13 @@ typedef struct MemoryRequirements {
     }
     info.usage = usage;
   }
+  // Use raw VkMemoryRequirements, e.g. for several Images in an AliasPool.
+  MemoryRequirements(language::Device& dev, const VkMemoryRequirements& raw,
+                     VmaMemoryUsage usage)
+      : dev(dev) {
+    get(raw);
+    info.usage = usage;
+  }
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
 
   // reset clears any previous requirements.
@@ -491,6 +602,7 @@ typedef struct MemoryRequirements {
 #else  /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
     vkbuf = VK_NULL_HANDLE;
     vkimg = VK_NULL_HANDLE;
+    memset(&vkraw, 0, sizeof(vkraw));
 #endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
   };
 
@@ -510,11 +622,24 @@ typedef struct MemoryRequirements {
   // get populates VkMemoryRequirements2 vk from memory::Buffer img.
   WARN_UNUSED_RESULT int get(Buffer& buf) { return get(buf.vk); }
 
+  // get sets the requirements to raw instead of querying an object.
+  void get(const VkMemoryRequirements& raw) {
+    reset();
+#ifdef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
+    vk.memoryRequirements = raw;
+#else  /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+    vkraw = raw;
+    memset(&info, 0, sizeof(info));
+#endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+  }
+
 #ifndef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
   // vkbuf and vkimg cannot both be non-NULL.
   VkBuffer vkbuf;
   // vkimg and vkbuf cnanot both be non-NULL.
   VkImage vkimg;
+  // vkraw is used if vkbuf and vkimg are both NULL.
+  VkMemoryRequirements vkraw;
   // info is initialized after get, and your app should then fill in
   // info.usage and optionally info.flags. Or, leave info.usage unset and
   // set info.requiredFlags.
@@ -660,6 +785,225 @@ typedef struct UniformBuffer : public Buffer {
   void* stageMmap{nullptr};
 } UniformBuffer;
 
+// StagingRing is one large host-visible Buffer, mapped once for its whole
+// lifetime and carved into one region per frame in flight. Each upload is
+// bump-allocated from the current frame's region and recorded into a single
+// command buffer for that frame, which end() submits with a Fence. The region
+// is reclaimed when begin() is called for the same frame again and its Fence
+// has signalled.
+//
+// Example usage:
+//   memory::StagingRing ring(cpool);
+//   ring.frameSize = 16 * 1024 * 1024;
+//   if (ring.ctorError()) { ... }
+//   // In the main loop:
+//   if (ring.begin(frame_i) || ring.upload(vertexBuffer, vertices.data(),
+//                                          verticesBytes) ||
+//       ring.upload(texture, pixels, pixelsBytes, region) || ring.end()) {
+//     ...
+//   }
+//
+// Note: the uploads must complete before they are used by later commands.
+// end() submits to cpool.q(poolQindex). Your app must use the same queue or
+// wait on a semaphore.
+typedef struct StagingRing {
+  StagingRing(command::CommandPool& cpool) : cpool(cpool), buf(cpool.dev) {}
+  virtual ~StagingRing();
+
+  command::CommandPool& cpool;
+  // framesInFlight can be set before ctorError().
+  size_t framesInFlight{2};
+  // frameSize can be set before ctorError(). It is the number of bytes that
+  // can be uploaded between begin() and end().
+  VkDeviceSize frameSize{4 * 1024 * 1024};
+  // poolQindex can be set before ctorError(). It selects the queue in cpool.
+  size_t poolQindex{ASSUME_POOL_QINDEX};
+
+  // Two-stage constructor: call ctorError() to build StagingRing.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // begin selects frame_i, waits until its previous uploads have completed
+  // and begins its command buffer.
+  WARN_UNUSED_RESULT int begin(size_t frame_i);
+
+  // alloc bump-allocates len bytes from the current frame, aligned to
+  // optimalBufferCopyOffsetAlignment and to align. mapped is set to the host
+  // pointer and offset is set to the offset in buf.
+  WARN_UNUSED_RESULT int alloc(VkDeviceSize len, void** mapped,
+                               VkDeviceSize* offset, VkDeviceSize align = 1);
+
+  // upload copies len bytes from src to dst at dstOffset.
+  WARN_UNUSED_RESULT int upload(Buffer& dst, const void* src, size_t len,
+                                VkDeviceSize dstOffset = 0);
+
+  // upload copies len bytes from src to dst as described by region.
+  // region.bufferOffset is ignored. dst is transitioned to finalLayout.
+  WARN_UNUSED_RESULT int upload(
+      Image& dst, const void* src, size_t len, VkBufferImageCopy region,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  // end submits the current frame's command buffer.
+  WARN_UNUSED_RESULT int end();
+
+  // cmd returns the current frame's command buffer. It can be used to record
+  // additional transfer commands between begin() and end().
+  command::CommandBuffer& cmd() { return *frames.at(cur).cmd; }
+
+  Buffer buf;
+
+ protected:
+  struct Frame {
+    std::unique_ptr<command::CommandBuffer> cmd;
+    std::unique_ptr<command::Fence> fence;
+    bool submitted{false};
+    // used is the number of bytes of this frame's region in use.
+    VkDeviceSize used{0};
+  };
+  std::vector<Frame> frames;
+  size_t cur{(size_t)-1};
+  char* mapped{nullptr};
+} StagingRing;
+
+// UniformArena is one large host-coherent uniform Buffer, mapped once for its
+// whole lifetime and carved into one region per frame in flight. Each draw
+// bump-allocates its uniforms from the current frame's region and gets back a
+// dynamic offset. All draws share one VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_-
+// DYNAMIC descriptor (see toDescriptor) and pass their offset to
+// CommandBuffer::bindDescriptorSets.
+//
+// Unlike UniformBuffer there is no staging copy: the shader reads the host
+// writes directly.
+//
+// Example usage:
+//   memory::UniformArena arena(dev);
+//   arena.range = sizeof(PerObject);
+//   if (arena.ctorError()) { ... }
+//   shaderLibrary.dynamicBuffers.emplace(0, 0);  // set=0, binding=0
+//   ... makeDescriptorLibrary, then write arena.toDescriptor() to binding 0
+//   // In the main loop, after frame_i's previous submit has completed:
+//   if (arena.reset(frame_i)) { ... }
+//   for (auto& obj : objects) {
+//     uint32_t offset;
+//     if (arena.alloc(obj.uniforms, offset) ||
+//         cmd.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+//                                1, &set, 1, &offset) || ...) { ... }
+//   }
+typedef struct UniformArena {
+  UniformArena(language::Device& dev) : dev(dev), buf(dev) {}
+
+  language::Device& dev;
+  // framesInFlight can be set before ctorError().
+  size_t framesInFlight{2};
+  // frameSize can be set before ctorError(). It is the number of bytes that
+  // can be allocated between calls to reset().
+  VkDeviceSize frameSize{1024 * 1024};
+  // range must be set before ctorError(). It is the size of the uniform block
+  // a shader sees at each dynamic offset, and the max len for alloc().
+  VkDeviceSize range{0};
+
+  // Two-stage constructor: call ctorError() to build UniformArena.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // reset selects frame_i and discards everything allocated in it. The GPU
+  // must have finished all commands that used frame_i's previous offsets.
+  WARN_UNUSED_RESULT int reset(size_t frame_i);
+
+  // alloc bump-allocates len bytes from the current frame, aligned to
+  // minUniformBufferOffsetAlignment. mapped is set to the host pointer and
+  // dynamicOffset is set to the offset to pass to bindDescriptorSets.
+  WARN_UNUSED_RESULT int alloc(VkDeviceSize len, void** mapped,
+                               uint32_t& dynamicOffset);
+
+  // alloc copies data to the current frame.
+  template <typename T>
+  WARN_UNUSED_RESULT int alloc(const T& data, uint32_t& dynamicOffset) {
+    void* p;
+    if (alloc(sizeof(data), &p, dynamicOffset)) {
+      return 1;
+    }
+    memcpy(p, &data, sizeof(data));
+    return 0;
+  }
+
+  // toDescriptor is a convenience method to write the arena to a
+  // VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC binding.
+  void toDescriptor(VkDescriptorBufferInfo* bufferInfo) {
+    bufferInfo->buffer = buf.vk;
+    bufferInfo->offset = 0;
+    bufferInfo->range = range;
+  }
+
+  Buffer buf;
+
+ protected:
+  // used is the number of bytes of the current frame's region in use.
+  VkDeviceSize used{0};
+  size_t cur{(size_t)-1};
+  char* mapped{nullptr};
+} UniformArena;
+
+// hasLazilyAllocated returns true if any memory type in memoryTypeBits has
+// VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT.
+bool hasLazilyAllocated(language::Device& dev, uint32_t memoryTypeBits);
+
+// AliasPool places Images in one memory allocation. Images that are in use at
+// the same time get separate memory, but Images whose lifetimes do not
+// overlap may share (alias) the same memory.
+//
+// A lifetime is an inclusive range of "steps" chosen by the app, such as the
+// index of the first and last pass that uses the Image (see
+// science::RenderGraph). The contents of an aliased Image are undefined at
+// the start of its lifetime: transition it from VK_IMAGE_LAYOUT_UNDEFINED.
+//
+// Example usage:
+//   memory::AliasPool pool(dev);
+//   if (bloom.ctorWithoutMemory() || blur.ctorWithoutMemory() ||
+//       pool.add(bloom, 0, 1) || pool.add(blur, 2, 3) || pool.alloc()) {
+//     ...
+//   }
+class AliasPool {
+ public:
+  AliasPool(language::Device& dev) : dev(dev), mem(dev) {}
+
+  // add registers img, which must have been created with ctorWithoutMemory()
+  // and VK_IMAGE_TILING_OPTIMAL. img is in use from step first to last.
+  WARN_UNUSED_RESULT int add(Image& img, size_t first, size_t last);
+
+  // alloc places all the Images, allocates one block of memory and binds the
+  // Images to it. If lazy is true and the device has LAZILY_ALLOCATED memory
+  // suitable for all the Images, it is used (every Image must then have
+  // VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT).
+  WARN_UNUSED_RESULT int alloc(bool lazy = false);
+
+  // overlaps returns true if the Images added at index i and j share memory.
+  // Only valid after alloc().
+  bool overlaps(size_t i, size_t j) const;
+
+  // size returns the number of bytes allocated. Only valid after alloc().
+  VkDeviceSize size() const { return total; }
+
+  // unaliasedSize returns the bytes needed if each Image had its own memory.
+  VkDeviceSize unaliasedSize() const;
+
+  language::Device& dev;
+  DeviceMemory mem;
+
+ protected:
+  typedef struct Entry {
+    Image* img;
+    size_t first;
+    size_t last;
+    VkMemoryRequirements req;
+    VkDeviceSize offset;
+  } Entry;
+
+  // place computes Entry::offset for every entry and sets total.
+  void place();
+
+  std::vector<Entry> entries;
+  VkDeviceSize total{0};
+};
+
 // DescriptorPool represents memory reserved for a DescriptorSet (or many).
 // The assumption is that your application knows in advance the max number of
 // DescriptorSet instances that will exist.
@@ -685,6 +1029,12 @@ typedef struct DescriptorPool {
   WARN_UNUSED_RESULT int ctorError(
       uint32_t maxSets, const std::multiset<VkDescriptorType>& descriptors);
 
+  // ctorError specialization that takes the VkDescriptorPoolSize directly.
+  WARN_UNUSED_RESULT int ctorError(
+      uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes);
+
+  // reset returns all DescriptorSet instances to the pool at once. Any
+  // DescriptorSet allocated from the pool must not be used after this.
   WARN_UNUSED_RESULT int reset() {
     VkResult v = vkResetDescriptorPool(dev.dev, vk, 0 /*flags is reserved*/);
     if (v != VK_SUCCESS) {
@@ -696,6 +1046,12 @@ typedef struct DescriptorPool {
   }
 
   language::Device& dev;
+  // flags is used by ctorError(). Clear VK_DESCRIPTOR_POOL_CREATE_FREE_-
+  // DESCRIPTOR_SET_BIT if sets will only be released by reset(): the driver
+  // can then use a simpler allocator, and ~DescriptorSet skips
+  // vkFreeDescriptorSets.
+  VkDescriptorPoolCreateFlags flags{
+      VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT};
   VkPtr<VkDescriptorPool> vk;
 } DescriptorPool;
 
@@ -717,7 +1073,40 @@ typedef struct DescriptorSetLayout {
       language::Device& dev,
       const std::vector<VkDescriptorSetLayoutBinding>& bindings);
 
+  // isUpdateAfterBind returns true if any binding has
+  // VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT. Sets with this layout must
+  // come from a pool with VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT.
+  bool isUpdateAfterBind() const {
+    for (auto f : bindingFlags) {
+      if (f & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // dynamicCount returns how many dynamic offsets bindDescriptorSets needs for
+  // a set with this layout.
+  uint32_t dynamicCount() const {
+    uint32_t n = 0;
+    for (auto& b : bindings) {
+      if (b.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC ||
+          b.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
+        n += b.descriptorCount;
+      }
+    }
+    return n;
+  }
+
+  // bindingFlags is optional (requires VK_EXT_descriptor_indexing). If it is
+  // not empty it must have one VkDescriptorBindingFlagsEXT per binding, and
+  // is used by ctorError(). For example, a "bindless" array of textures uses
+  // PARTIALLY_BOUND_BIT_EXT | UPDATE_AFTER_BIND_BIT_EXT.
+  std::vector<VkDescriptorBindingFlagsEXT> bindingFlags;
   std::vector<VkDescriptorType> types;
+  // bindings is a copy of the bindings passed to ctorError(), without
+  // pImmutableSamplers. It is used by DescriptorUpdateTemplate.
+  std::vector<VkDescriptorSetLayoutBinding> bindings;
   VkPtr<VkDescriptorSetLayout> vk;
 } DescriptorSetLayout;
 
@@ -752,20 +1141,20 @@ typedef struct DescriptorSet {
 
   // write populates the DescriptorSet with type and buffer.
   WARN_UNUSED_RESULT int write(
-      uint32_t binding, const std::vector<VkDescriptorImageInfo> imageInfo,
+      uint32_t binding, const std::vector<VkDescriptorImageInfo>& imageInfo,
       uint32_t arrayI = 0);
   // write populates the DescriptorSet with type and buffer.
   WARN_UNUSED_RESULT int write(
-      uint32_t binding, const std::vector<VkDescriptorBufferInfo> bufferInfo,
+      uint32_t binding, const std::vector<VkDescriptorBufferInfo>& bufferInfo,
       uint32_t arrayI = 0);
   // write populates the DescriptorSet with type and buffer.
   WARN_UNUSED_RESULT int write(
-      uint32_t binding, const std::vector<VkBufferView> texelBufferViewInfo,
+      uint32_t binding, const std::vector<VkBufferView>& texelBufferViewInfo,
       uint32_t arrayI = 0);
 
   // write populates the DescriptorSet with type and buffer.
   WARN_UNUSED_RESULT int write(uint32_t binding,
-                               const std::vector<Sampler*> samplers,
+                               const std::vector<Sampler*>& samplers,
                                uint32_t arrayI = 0) {
     std::vector<VkDescriptorImageInfo> imageInfo;
     imageInfo.resize(samplers.size());
@@ -777,7 +1166,7 @@ typedef struct DescriptorSet {
 
   // write populates the DescriptorSet with type and buffer.
   WARN_UNUSED_RESULT int write(uint32_t binding,
-                               const std::vector<Buffer*> buffers,
+                               const std::vector<Buffer*>& buffers,
                                uint32_t arrayI = 0) {
     std::vector<VkDescriptorBufferInfo> bufferInfos;
     bufferInfos.resize(buffers.size());
@@ -793,9 +1182,342 @@ typedef struct DescriptorSet {
 
   DescriptorPool& pool;
   std::vector<VkDescriptorType> types;
-  VkDescriptorSet vk;
+  VkDescriptorSet vk{VK_NULL_HANDLE};
 } DescriptorSet;
 
-// TODO: VkDescriptorUpdateTemplate
+// DescriptorWriter collects writes and copies for many DescriptorSets and
+// bindings, then applies them all with one vkUpdateDescriptorSets call in
+// flush(). DescriptorSet::write calls vkUpdateDescriptorSets every time.
+//
+// The descriptors are copied into arrays that keep their capacity after
+// flush(), so reusing a DescriptorWriter does not allocate.
+class DescriptorWriter {
+ public:
+  DescriptorWriter(language::Device& dev) : dev(dev) {}
+
+  // write adds count descriptors from imageInfo to set at binding.
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, uint32_t binding,
+                               const VkDescriptorImageInfo* imageInfo,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set.vk, set.types, binding, imageInfo, count, arrayI);
+  }
+  // write adds count descriptors from bufferInfo to set at binding.
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, uint32_t binding,
+                               const VkDescriptorBufferInfo* bufferInfo,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set.vk, set.types, binding, bufferInfo, count, arrayI);
+  }
+  // write adds count descriptors from texelBufferView to set at binding.
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, uint32_t binding,
+                               const VkBufferView* texelBufferView,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set.vk, set.types, binding, texelBufferView, count, arrayI);
+  }
+
+  // write adds count descriptors from imageInfo to a set from
+  // DescriptorAllocator, which was allocated with layout.
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const DescriptorSetLayout& layout,
+                               uint32_t binding,
+                               const VkDescriptorImageInfo* imageInfo,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set, layout.types, binding, imageInfo, count, arrayI);
+  }
+  // write adds count descriptors from bufferInfo to a set from
+  // DescriptorAllocator, which was allocated with layout.
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const DescriptorSetLayout& layout,
+                               uint32_t binding,
+                               const VkDescriptorBufferInfo* bufferInfo,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set, layout.types, binding, bufferInfo, count, arrayI);
+  }
+  // write adds count descriptors from texelBufferView to a set from
+  // DescriptorAllocator, which was allocated with layout.
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const DescriptorSetLayout& layout,
+                               uint32_t binding,
+                               const VkBufferView* texelBufferView,
+                               uint32_t count = 1, uint32_t arrayI = 0) {
+    return write(set, layout.types, binding, texelBufferView, count, arrayI);
+  }
+  // write adds sampler to set at binding.
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, uint32_t binding,
+                               Sampler& sampler, uint32_t arrayI = 0) {
+    VkDescriptorImageInfo imageInfo;
+    sampler.toDescriptor(&imageInfo);
+    return write(set, binding, &imageInfo, 1, arrayI);
+  }
+  // write adds all of buffer to set at binding.
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, uint32_t binding,
+                               Buffer& buffer, uint32_t arrayI = 0) {
+    VkDescriptorBufferInfo bufferInfo;
+    bufferInfo.buffer = buffer.vk;
+    bufferInfo.offset = 0;
+    bufferInfo.range = buffer.info.size;
+    return write(set, binding, &bufferInfo, 1, arrayI);
+  }
+
+  // copy adds a copy of count descriptors from src to dst.
+  WARN_UNUSED_RESULT int copy(DescriptorSet& src, uint32_t srcBinding,
+                              DescriptorSet& dst, uint32_t dstBinding,
+                              uint32_t count = 1, uint32_t srcArrayI = 0,
+                              uint32_t dstArrayI = 0);
+
+  // flush applies all writes and copies with one vkUpdateDescriptorSets.
+  void flush();
+
+  // size returns the number of writes and copies waiting for flush().
+  size_t size() const { return writes.size() + copies.size(); }
+
+  language::Device& dev;
+
+ protected:
+  // add appends a VkWriteDescriptorSet if typeOk accepts the binding's type.
+  // Its p*Info pointer is only set in flush(), because the arrays below may
+  // reallocate.
+  WARN_UNUSED_RESULT int add(VkDescriptorSet set,
+                             const std::vector<VkDescriptorType>& types,
+                             uint32_t binding, uint32_t count, uint32_t arrayI,
+                             size_t first, bool (*typeOk)(VkDescriptorType),
+                             const char* what);
+
+  // write is called by the public write methods. types are the
+  // VkDescriptorType of each binding in set.
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const std::vector<VkDescriptorType>& types,
+                               uint32_t binding,
+                               const VkDescriptorImageInfo* imageInfo,
+                               uint32_t count, uint32_t arrayI);
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const std::vector<VkDescriptorType>& types,
+                               uint32_t binding,
+                               const VkDescriptorBufferInfo* bufferInfo,
+                               uint32_t count, uint32_t arrayI);
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set,
+                               const std::vector<VkDescriptorType>& types,
+                               uint32_t binding,
+                               const VkBufferView* texelBufferView,
+                               uint32_t count, uint32_t arrayI);
+
+  std::vector<VkWriteDescriptorSet> writes;
+  // first holds the index of each write's first element in its array.
+  std::vector<size_t> first;
+  std::vector<VkDescriptorImageInfo> imageInfos;
+  std::vector<VkDescriptorBufferInfo> bufferInfos;
+  std::vector<VkBufferView> texelBufferViews;
+  std::vector<VkCopyDescriptorSet> copies;
+};
+
+// DescriptorAllocator hands out VkDescriptorSet handles from a chain of
+// DescriptorPool objects, one chain per frame in flight. When a pool runs out
+// (VK_ERROR_OUT_OF_POOL_MEMORY or VK_ERROR_FRAGMENTED_POOL) the next pool in
+// the chain is used, and a new one is created if needed.
+//
+// The sets are never freed one at a time. beginFrame() resets all the pools
+// of a frame with DescriptorPool::reset, so call it only after the GPU has
+// finished with that frame (e.g. after its fence has signalled). The pools
+// are kept for the next time the frame is used.
+//
+// Write to the sets with DescriptorWriter or DescriptorUpdateTemplate, which
+// accept a VkDescriptorSet.
+class DescriptorAllocator {
+ public:
+  DescriptorAllocator(language::Device& dev) : dev(dev) {}
+
+  // ctorError prepares framesInFlight chains. No pools are created until
+  // alloc() is called.
+  WARN_UNUSED_RESULT int ctorError(size_t framesInFlight = 1);
+
+  // beginFrame resets all pools used by frame_i and makes it the current
+  // frame for alloc().
+  WARN_UNUSED_RESULT int beginFrame(size_t frame_i);
+
+  // alloc allocates a set with layout from the current frame's pools.
+  WARN_UNUSED_RESULT int alloc(const DescriptorSetLayout& layout,
+                               VkDescriptorSet& out);
+
+  // poolCount returns the number of pools created for frame_i.
+  size_t poolCount(size_t frame_i) const {
+    return frames.at(frame_i).pools.size();
+  }
+
+  language::Device& dev;
+  // setsPerPool is the maxSets of each new pool.
+  uint32_t setsPerPool{256};
+  // typesPerSet is how many of each VkDescriptorType to expect in one set,
+  // with one entry per descriptor (an array binding adds descriptorCount
+  // entries). It is multiplied by setsPerPool to size each new pool. If it is
+  // empty, alloc() fills it from the first layout it sees.
+  std::multiset<VkDescriptorType> typesPerSet;
+
+ protected:
+  typedef struct Frame {
+    std::vector<std::unique_ptr<DescriptorPool>> pools;
+    // cur is the index in pools being allocated from.
+    size_t cur{0};
+  } Frame;
+
+  // addPool appends a new pool to f.pools.
+  WARN_UNUSED_RESULT int addPool(Frame& f);
+
+  std::vector<Frame> frames;
+  size_t frame_i{0};
+};
+
+// DescriptorIndexAllocator hands out the array elements of a large
+// ("bindless") descriptor array, such as a binding reflected by
+// science::ShaderLibrary from a runtime array:
+//   layout(set = 0, binding = 0) uniform sampler2D textures[];
+// A draw then passes its index (e.g. in a push constant) instead of binding
+// its own DescriptorSet.
+//
+// This only tracks which indices are in use on the host. Write the descriptor
+// at the returned index with DescriptorWriter (arrayI = index).
+class DescriptorIndexAllocator {
+ public:
+  DescriptorIndexAllocator(uint32_t capacity = 0) : capacity(capacity) {}
+
+  // alloc sets out to an unused index. Freed indices are reused first.
+  WARN_UNUSED_RESULT int alloc(uint32_t& out);
+
+  // free returns index to the free list. Only call this after the GPU has
+  // finished every command buffer that reads the descriptor at index.
+  WARN_UNUSED_RESULT int free(uint32_t index);
+
+  // size returns the number of indices in use.
+  size_t size() const { return next - freeList.size(); }
+
+  // capacity is the descriptorCount of the array.
+  uint32_t capacity;
+
+ protected:
+  std::vector<uint32_t> freeList;
+  // inUse detects a double free.
+  std::vector<bool> inUse;
+  // next is the lowest index that has never been handed out.
+  uint32_t next{0};
+};
+
+#ifndef __ANDROID__
+// DescriptorUpdateTemplate writes all the bindings of a DescriptorSet with a
+// single vkUpdateDescriptorSetWithTemplate call (requires Vulkan 1.1).
+//
+// The data is a packed struct with one field per descriptor in binding order:
+// * VkDescriptorImageInfo for SAMPLER, COMBINED_IMAGE_SAMPLER, SAMPLED_IMAGE,
+//   STORAGE_IMAGE and INPUT_ATTACHMENT
+// * VkDescriptorBufferInfo for UNIFORM_BUFFER, STORAGE_BUFFER and the
+//   _DYNAMIC variants
+// * VkBufferView for UNIFORM_TEXEL_BUFFER and STORAGE_TEXEL_BUFFER
+// A binding with descriptorCount > 1 is an array of the field type.
+//
+// For example, for a shader with a uniform buffer at binding=0 and a sampler
+// at binding=1:
+//   struct MyDescriptors {
+//     VkDescriptorBufferInfo ubo;
+//     VkDescriptorImageInfo tex;
+//   } data;
+//   ... fill in data ...
+//   if (tmpl.write(*set, data)) { handleErrors; }
+typedef struct DescriptorUpdateTemplate {
+  DescriptorUpdateTemplate(language::Device& dev)
+      : dev(dev), vk{dev.dev, vkDestroyDescriptorUpdateTemplate} {
+    vk.allocator = dev.dev.allocator;
+  }
+  DescriptorUpdateTemplate(DescriptorUpdateTemplate&&) = default;
+  DescriptorUpdateTemplate(const DescriptorUpdateTemplate&) = delete;
+
+  // ctorError creates the template for DescriptorSets made from layout.
+  WARN_UNUSED_RESULT int ctorError(const DescriptorSetLayout& layout);
+
+  // write updates all bindings in set from data, which is len bytes long.
+  // set may also be a VkDescriptorSet from DescriptorAllocator.
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set, const void* data,
+                               size_t len);
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, const void* data,
+                               size_t len) {
+    return write(set.vk, data, len);
+  }
+
+  // write updates all bindings in set from data. T must be a packed struct
+  // matching the template (see above).
+  template <typename T>
+  WARN_UNUSED_RESULT int write(DescriptorSet& set, const T& data) {
+    return write(set.vk, &data, sizeof(data));
+  }
+  template <typename T>
+  WARN_UNUSED_RESULT int write(VkDescriptorSet set, const T& data) {
+    return write(set, &data, sizeof(data));
+  }
+
+  language::Device& dev;
+  // entries holds the offset of each binding in the packed struct.
+  std::vector<VkDescriptorUpdateTemplateEntry> entries;
+  // size is the size of the packed struct.
+  size_t size{0};
+  VkPtr<VkDescriptorUpdateTemplate> vk;
+} DescriptorUpdateTemplate;
+#endif /* __ANDROID__ */
+
+// MemoryReport is a snapshot of device memory use: per-heap usage against the
+// budget the driver reports, and the bytes in each MemoryCategory.
+//
+// The budget comes from VK_EXT_memory_budget if the app added
+// VK_EXT_MEMORY_BUDGET_EXTENSION_NAME to Device::requiredExtensions (and the
+// Vulkan headers define it). Otherwise the budget is estimated as 80% of the
+// heap size and usage is only what Volcano itself allocated.
+//
+// Example usage:
+//   memory::MemoryReport report;
+//   if (report.get(dev)) { ... }
+//   if (report.overBudget()) {
+//     // Drop some textures.
+//   }
+//   if (report.writeJSON("memory.json")) { ... }
+typedef struct MemoryReport {
+  typedef struct Heap {
+    VkDeviceSize size{0};
+    VkMemoryHeapFlags flags{0};
+    // budget is how many bytes the app can use before risking eviction or
+    // allocation failure. usage is how much is in use by the whole process.
+    VkDeviceSize budget{0};
+    VkDeviceSize usage{0};
+    // blockBytes and allocationBytes are from vulkanmemoryallocator: VkMemory
+    // blocks obtained from the driver and the allocations inside them.
+    VkDeviceSize blockBytes{0};
+    VkDeviceSize allocationBytes{0};
+    uint32_t blockCount{0};
+    uint32_t allocationCount{0};
+    // trackedBytes is the total of all live DeviceMemory in this heap.
+    VkDeviceSize trackedBytes{0};
+  } Heap;
+
+  typedef struct Category {
+    VkDeviceSize bytes{0};
+    size_t count{0};
+  } Category;
+
+  // get fills in this MemoryReport. If detailedVmaJSON is set, vmaStats also
+  // gets the detailed JSON from vmaBuildStatsString.
+  WARN_UNUSED_RESULT int get(language::Device& dev,
+                             bool detailedVmaJSON = false);
+
+  // overBudget returns true if any heap's usage exceeds fraction * budget.
+  bool overBudget(float fraction = 0.9f) const;
+
+  // toJSON formats this MemoryReport as JSON.
+  std::string toJSON() const;
+
+  // writeJSON writes toJSON() to filename.
+  WARN_UNUSED_RESULT int writeJSON(const char* filename) const;
+
+  std::vector<Heap> heaps;
+  // categories is indexed by MemoryCategory.
+  Category categories[MEMORY_CATEGORY_COUNT];
+  // hasBudgetExt is true if heaps[].budget came from VK_EXT_memory_budget.
+  bool hasBudgetExt{false};
+  // vmaStats is only set if get() was called with detailedVmaJSON.
+  std::string vmaStats;
+} MemoryReport;
 
 }  // namespace memory
@@ -0,0 +1,49 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * Device::resetOffscreen() replaces the swapChain for a headless Device.
+ */
+#include "memory.h"
+
+namespace language {
+
+int Device::resetOffscreen(command::CommandPool& cpool, size_t poolQindex) {
+  if (!isHeadless()) {
+    logE("BUG: resetOffscreen called on a Device with a surface\n");
+    return 1;
+  }
+  if (!offscreenCount) {
+    logE("resetOffscreen: offscreenCount must be at least 1\n");
+    return 1;
+  }
+  auto& extent = swapChainInfo.imageExtent;
+  if (!extent.width || !extent.height) {
+    logE("resetOffscreen: imageExtent %u x %u is invalid\n", extent.width,
+         extent.height);
+    return 1;
+  }
+
+  // The old images are still referenced by framebufs until
+  // addOrUpdateFramebufs() replaces them, so keep them alive until then.
+  std::vector<std::shared_ptr<memory::Image>> old;
+  old.swap(offscreenImages);
+  std::vector<VkImage> images;
+  for (size_t i = 0; i < offscreenCount; i++) {
+    offscreenImages.emplace_back(std::make_shared<memory::Image>(*this));
+    auto& img = *offscreenImages.back();
+    img.info.format = swapChainInfo.imageFormat;
+    img.info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    img.info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    img.info.usage = swapChainInfo.imageUsage;
+    img.info.extent = {1, 1, 1};
+    img.info.extent.width = extent.width;
+    img.info.extent.height = extent.height;
+    if (img.ctorDeviceLocal() || img.bindMemory()) {
+      logE("resetOffscreen: offscreenImages[%zu] failed\n", i);
+      return 1;
+    }
+    images.emplace_back(img.vk);
+  }
+  return addOrUpdateFramebufs(images, cpool, poolQindex);
+}
+
+}  // namespace language
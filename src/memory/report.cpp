@@ -0,0 +1,153 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * MemoryReport gathers device memory usage and budgets.
+ */
+#include "memory.h"
+
+namespace memory {
+
+#if defined(VK_EXT_memory_budget) && !defined(__ANDROID__)
+namespace {  // an anonymous namespace hides its contents outside this file
+
+bool hasDeviceExtension(language::Device& dev, const char* name) {
+  for (auto ext : dev.requiredExtensions) {
+    if (!strcmp(ext, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // anonymous namespace
+#endif /*VK_EXT_memory_budget*/
+
+int MemoryReport::get(language::Device& dev,
+                      bool detailedVmaJSON /*= false*/) {
+  auto& mp = dev.memProps.memoryProperties;
+  heaps.clear();
+  heaps.resize(mp.memoryHeapCount);
+  hasBudgetExt = false;
+  vmaStats.clear();
+  for (uint32_t i = 0; i < mp.memoryHeapCount; i++) {
+    heaps.at(i).size = mp.memoryHeaps[i].size;
+    heaps.at(i).flags = mp.memoryHeaps[i].flags;
+  }
+
+  {
+    language::Device::lock_guard_t lock(dev.lockmutex);
+    for (size_t i = 0; i < dev.memoryHeapBytes.size() && i < heaps.size();
+         i++) {
+      heaps.at(i).trackedBytes = dev.memoryHeapBytes.at(i);
+    }
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+      categories[i] = Category();
+      if (i < dev.memoryCategoryBytes.size()) {
+        categories[i].bytes = dev.memoryCategoryBytes.at(i);
+        categories[i].count = dev.memoryCategoryCount.at(i);
+      }
+    }
+  }
+
+  bool haveVma = false;
+#ifndef VOLCANO_DISABLE_VULKANMEMORYALLOCATOR
+  if (dev.vmaAllocator) {
+    haveVma = true;
+    VmaStats stats;
+    vmaCalculateStats(dev.vmaAllocator, &stats);
+    for (size_t i = 0; i < heaps.size(); i++) {
+      auto& s = stats.memoryHeap[i];
+      auto& h = heaps.at(i);
+      h.blockBytes = s.usedBytes + s.unusedBytes;
+      h.allocationBytes = s.usedBytes;
+      h.blockCount = s.blockCount;
+      h.allocationCount = s.allocationCount;
+    }
+    if (detailedVmaJSON) {
+      char* str = nullptr;
+      vmaBuildStatsString(dev.vmaAllocator, &str, VK_TRUE);
+      if (str) {
+        vmaStats = str;
+        vmaFreeStatsString(dev.vmaAllocator, str);
+      }
+    }
+  }
+#else  /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+  (void)detailedVmaJSON;
+#endif /*VOLCANO_DISABLE_VULKANMEMORYALLOCATOR*/
+
+#if defined(VK_EXT_memory_budget) && !defined(__ANDROID__)
+  if (dev.apiVersionInUse() >= VK_MAKE_VERSION(1, 1, 0) &&
+      hasDeviceExtension(dev, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT VkInit(budget);
+    VkPhysicalDeviceMemoryProperties2 VkInit(props);
+    props.pNext = &budget;
+    vkGetPhysicalDeviceMemoryProperties2(dev.phys, &props);
+    for (size_t i = 0; i < heaps.size(); i++) {
+      heaps.at(i).budget = budget.heapBudget[i];
+      heaps.at(i).usage = budget.heapUsage[i];
+    }
+    hasBudgetExt = true;
+    return 0;
+  }
+#endif /*VK_EXT_memory_budget*/
+
+  // Without VK_EXT_memory_budget, estimate. Leave some of each heap for other
+  // processes and the driver.
+  for (auto& h : heaps) {
+    h.budget = h.size / 5 * 4;
+    h.usage = haveVma ? h.blockBytes : h.trackedBytes;
+  }
+  return 0;
+}
+
+bool MemoryReport::overBudget(float fraction /*= 0.9f*/) const {
+  for (auto& h : heaps) {
+    if (h.budget && h.usage > h.budget * fraction) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string MemoryReport::toJSON() const {
+  char buf[512];
+  snprintf(buf, sizeof(buf), "{\"hasBudgetExt\":%s,\"heaps\":[",
+           hasBudgetExt ? "true" : "false");
+  std::string out = buf;
+  for (size_t i = 0; i < heaps.size(); i++) {
+    auto& h = heaps.at(i);
+    snprintf(buf, sizeof(buf),
+             "%s\n{\"size\":%llu,\"deviceLocal\":%s,\"budget\":%llu,"
+             "\"usage\":%llu,\"blockBytes\":%llu,\"allocationBytes\":%llu,"
+             "\"blockCount\":%u,\"allocationCount\":%u,\"trackedBytes\":%llu}",
+             i ? "," : "", (unsigned long long)h.size,
+             (h.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false",
+             (unsigned long long)h.budget, (unsigned long long)h.usage,
+             (unsigned long long)h.blockBytes,
+             (unsigned long long)h.allocationBytes, h.blockCount,
+             h.allocationCount, (unsigned long long)h.trackedBytes);
+    out += buf;
+  }
+  out += "\n],\"categories\":{";
+  for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    snprintf(buf, sizeof(buf), "%s\n\"%s\":{\"bytes\":%llu,\"count\":%zu}",
+             i ? "," : "", memoryCategoryName((MemoryCategory)i),
+             (unsigned long long)categories[i].bytes, categories[i].count);
+    out += buf;
+  }
+  out += "\n}";
+  if (!vmaStats.empty()) {
+    // vmaBuildStatsString already returns a JSON object.
+    out += ",\n\"vma\":";
+    out += vmaStats;
+  }
+  out += "}\n";
+  return out;
+}
+
+int MemoryReport::writeJSON(const char* filename) const {
+  return language::writeTextFile(filename, toJSON(),
+                                 "MemoryReport::writeJSON");
+}
+
+}  // namespace memory
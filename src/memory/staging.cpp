@@ -0,0 +1,224 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ */
+#include "memory.h"
+
+#include <vulkan/vk_format_utils.h>
+#include <limits>
+
+namespace memory {
+
+namespace {  // an anonymous namespace hides its contents outside this file
+
+VkDeviceSize lcm(VkDeviceSize a, VkDeviceSize b) {
+  if (!a || !b) {
+    return a ? a : (b ? b : 1);
+  }
+  VkDeviceSize x = a, y = b;
+  while (y) {
+    VkDeviceSize t = x % y;
+    x = y;
+    y = t;
+  }
+  return a / x * b;
+}
+
+}  // anonymous namespace
+
+StagingRing::~StagingRing() {
+  std::vector<VkCommandBuffer> vk;
+  for (auto& f : frames) {
+    if (f.submitted) {
+      VkResult v =
+          f.fence->wait(cpool.dev, std::numeric_limits<uint64_t>::max());
+      if (v != VK_SUCCESS) {
+        logE("%s failed: %d (%s)\n", "vkWaitForFences", v,
+             string_VkResult(v));
+        continue;  // Leak f.cmd rather than free it while it may be in use.
+      }
+    }
+    if (f.cmd && f.cmd->vk) {
+      vk.emplace_back(f.cmd->vk);
+    }
+  }
+  cpool.free(vk);
+}
+
+int StagingRing::ctorError() {
+  if (!framesInFlight || !frameSize) {
+    logE("StagingRing: framesInFlight=%zu frameSize=0x%llx is invalid\n",
+         framesInFlight, (unsigned long long)frameSize);
+    return 1;
+  }
+  if (mapped) {
+    logE("BUG: StagingRing::ctorError called twice\n");
+    return 1;
+  }
+  // Round frameSize up so each frame's region starts aligned.
+  auto align =
+      cpool.dev.physProp.properties.limits.optimalBufferCopyOffsetAlignment;
+  if (align > 1) {
+    frameSize = (frameSize + align - 1) / align * align;
+  }
+  buf.info.size = frameSize * framesInFlight;
+  buf.info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buf.mem.persistentMap = true;
+  if (buf.ctorHostCoherent() || buf.bindMemory()) {
+    logE("StagingRing: buf.ctorHostCoherent failed\n");
+    return 1;
+  }
+  mapped = reinterpret_cast<char*>(buf.mem.mapped);
+
+  std::vector<VkCommandBuffer> vk(framesInFlight);
+  if (cpool.alloc(vk)) {
+    logE("StagingRing: cpool.alloc failed\n");
+    return 1;
+  }
+  frames.resize(framesInFlight);
+  for (size_t i = 0; i < framesInFlight; i++) {
+    // Set every cmd first so ~StagingRing frees them all if a fence fails.
+    auto& f = frames.at(i);
+    f.cmd.reset(new command::CommandBuffer(cpool));
+    f.cmd->vk = vk.at(i);
+  }
+  for (size_t i = 0; i < framesInFlight; i++) {
+    auto& f = frames.at(i);
+    f.fence.reset(new command::Fence(cpool.dev));
+    if (f.fence->ctorError(cpool.dev)) {
+      logE("StagingRing: frame[%zu] fence failed\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int StagingRing::begin(size_t frame_i) {
+  if (frame_i >= frames.size()) {
+    logE("StagingRing::begin(%zu): only %zu framesInFlight\n", frame_i,
+         frames.size());
+    return 1;
+  }
+  if (cur != (size_t)-1) {
+    logE("BUG: StagingRing::begin(%zu) without end()\n", frame_i);
+    return 1;
+  }
+  auto& f = frames.at(frame_i);
+  if (f.submitted) {
+    VkResult v = f.fence->wait(cpool.dev, std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+      return 1;
+    }
+    if (f.fence->reset(cpool.dev)) {
+      return 1;
+    }
+    f.submitted = false;
+  }
+  f.used = 0;
+  if (f.cmd->beginOneTimeUse()) {
+    logE("StagingRing::begin(%zu): beginOneTimeUse failed\n", frame_i);
+    return 1;
+  }
+  cur = frame_i;
+  return 0;
+}
+
+int StagingRing::alloc(VkDeviceSize len, void** pMapped, VkDeviceSize* offset,
+                       VkDeviceSize align /*= 1*/) {
+  if (cur == (size_t)-1) {
+    logE("BUG: StagingRing::alloc before begin()\n");
+    return 1;
+  }
+  auto& f = frames.at(cur);
+  auto copyAlign =
+      cpool.dev.physProp.properties.limits.optimalBufferCopyOffsetAlignment;
+  // align need not be a power of 2: a texel block can be 3, 6 or 12 bytes.
+  // frameSize is not a multiple of every align, so align the offset in buf,
+  // not the offset in the frame.
+  align = lcm(align, copyAlign);
+  VkDeviceSize base = frameSize * cur;
+  VkDeviceSize start = (base + f.used + align - 1) / align * align - base;
+  if (start + len > frameSize) {
+    logE("StagingRing::alloc(0x%llx): frameSize=0x%llx used=0x%llx\n",
+         (unsigned long long)len, (unsigned long long)frameSize,
+         (unsigned long long)f.used);
+    return 1;
+  }
+  f.used = start + len;
+  *offset = base + start;
+  *pMapped = mapped + *offset;
+  return 0;
+}
+
+int StagingRing::upload(Buffer& dst, const void* src, size_t len,
+                        VkDeviceSize dstOffset /*= 0*/) {
+  if (dstOffset + len > dst.info.size) {
+    logE("StagingRing::upload(len=0x%zx, dstOffset=0x%llx): size=0x%llx\n",
+         len, (unsigned long long)dstOffset, (unsigned long long)dst.info.size);
+    return 1;
+  }
+  void* p;
+  VkBufferCopy region = {};
+  if (alloc(len, &p, &region.srcOffset)) {
+    return 1;
+  }
+  memcpy(p, src, len);
+  region.dstOffset = dstOffset;
+  region.size = len;
+  return cmd().copyBuffer(buf.vk, dst.vk, std::vector<VkBufferCopy>{region});
+}
+
+int StagingRing::upload(Image& dst, const void* src, size_t len,
+                        VkBufferImageCopy region,
+                        VkImageLayout finalLayout /*= SHADER_READ_ONLY*/) {
+  void* p;
+  // vkCmdCopyBufferToImage requires bufferOffset to be a multiple of 4 and
+  // of the texel block size of dst.
+  VkDeviceSize align = lcm(4, FormatElementSize(dst.info.format));
+  if (alloc(len, &p, &region.bufferOffset, align)) {
+    return 1;
+  }
+  memcpy(p, src, len);
+  auto& c = cmd();
+  if (c.barrier(dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) ||
+      c.copyBufferToImage(buf.vk, dst.vk, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          std::vector<VkBufferImageCopy>{region})) {
+    logE("StagingRing::upload(Image): copyBufferToImage failed\n");
+    return 1;
+  }
+  if (finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
+      c.barrier(dst, finalLayout)) {
+    logE("StagingRing::upload(Image): barrier failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+int StagingRing::end() {
+  if (cur == (size_t)-1) {
+    logE("BUG: StagingRing::end before begin()\n");
+    return 1;
+  }
+  auto& f = frames.at(cur);
+
+  // Make the transfers visible to all later commands in the queue.
+  command::CommandBuffer::BarrierSet b;
+  b.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  b.dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkMemoryBarrier VkInit(mb);
+  mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  mb.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  b.mem.emplace_back(mb);
+  if (f.cmd->waitBarrier(b) || f.cmd->end()) {
+    logE("StagingRing::end: end failed\n");
+    return 1;
+  }
+  if (f.cmd->submit(poolQindex, {}, {}, {}, f.fence->vk)) {
+    logE("StagingRing::end: submit failed\n");
+    return 1;
+  }
+  f.submitted = true;
+  cur = (size_t)-1;
+  return 0;
+}
+
+}  // namespace memory
@@ -0,0 +1,96 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ */
+#include "memory.h"
+
+#include <limits>
+
+namespace memory {
+
+int UniformArena::ctorError() {
+  if (!framesInFlight || !frameSize || !range) {
+    logE("UniformArena: framesInFlight=%zu frameSize=0x%llx range=0x%llx %s\n",
+         framesInFlight, (unsigned long long)frameSize,
+         (unsigned long long)range, "is invalid");
+    return 1;
+  }
+  if (mapped) {
+    logE("BUG: UniformArena::ctorError called twice\n");
+    return 1;
+  }
+  auto& limits = dev.physProp.properties.limits;
+  if (range > limits.maxUniformBufferRange) {
+    logE("UniformArena: range=0x%llx exceeds maxUniformBufferRange=0x%x\n",
+         (unsigned long long)range, limits.maxUniformBufferRange);
+    return 1;
+  }
+  // Round frameSize up so each frame's region starts aligned.
+  auto align = limits.minUniformBufferOffsetAlignment;
+  if (align > 1) {
+    frameSize = (frameSize + align - 1) / align * align;
+  }
+  // A dynamic offset is a uint32_t, and the last one must still leave room
+  // for a whole range.
+  if (frameSize * framesInFlight >
+      std::numeric_limits<uint32_t>::max() - range) {
+    logE("UniformArena: frameSize=0x%llx x %zu is too large\n",
+         (unsigned long long)frameSize, framesInFlight);
+    return 1;
+  }
+  // The last allocation may start up to frameSize - 1, and the descriptor
+  // always reads a whole range from there.
+  buf.info.size = frameSize * framesInFlight + range;
+  buf.info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  buf.mem.persistentMap = true;
+  if (buf.ctorHostCoherent() || buf.bindMemory()) {
+    logE("UniformArena: buf.ctorHostCoherent failed\n");
+    return 1;
+  }
+  mapped = reinterpret_cast<char*>(buf.mem.mapped);
+  return 0;
+}
+
+int UniformArena::reset(size_t frame_i) {
+  if (!mapped) {
+    logE("BUG: UniformArena::reset before ctorError\n");
+    return 1;
+  }
+  if (frame_i >= framesInFlight) {
+    logE("UniformArena::reset(%zu): only %zu framesInFlight\n", frame_i,
+         framesInFlight);
+    return 1;
+  }
+  cur = frame_i;
+  used = 0;
+  return 0;
+}
+
+int UniformArena::alloc(VkDeviceSize len, void** pMapped,
+                        uint32_t& dynamicOffset) {
+  if (cur == (size_t)-1) {
+    logE("BUG: UniformArena::alloc before reset()\n");
+    return 1;
+  }
+  if (len > range) {
+    logE("UniformArena::alloc(0x%llx): range is only 0x%llx\n",
+         (unsigned long long)len, (unsigned long long)range);
+    return 1;
+  }
+  auto align = dev.physProp.properties.limits.minUniformBufferOffsetAlignment;
+  if (align < 1) {
+    align = 1;
+  }
+  VkDeviceSize start = (used + align - 1) / align * align;
+  if (start + len > frameSize) {
+    logE("UniformArena::alloc(0x%llx): frameSize=0x%llx used=0x%llx\n",
+         (unsigned long long)len, (unsigned long long)frameSize,
+         (unsigned long long)used);
+    return 1;
+  }
+  used = start + len;
+  VkDeviceSize offset = frameSize * cur + start;
+  dynamicOffset = (uint32_t)offset;
+  *pMapped = mapped + offset;
+  return 0;
+}
+
+}  // namespace memory
@@ -0,0 +1,226 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * GpuProfiler reads back vkCmdWriteTimestamp results for named scopes.
+ */
+#include "science.h"
+
+namespace science {
+
+namespace {  // an anonymous namespace hides its contents outside this file
+
+// appendJSONString appends s to out as a quoted JSON string.
+void appendJSONString(std::string& out, const std::string& s) {
+  out += '"';
+  for (auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// signedTicks interprets a masked timestamp difference as signed, so a t0
+// slightly before the epoch is negative and not a huge positive number.
+int64_t signedTicks(uint64_t delta, uint64_t tickMask) {
+  delta &= tickMask;
+  if (delta > tickMask / 2) {
+    return -(int64_t)(~delta & tickMask) - 1;
+  }
+  return (int64_t)delta;
+}
+
+}  // anonymous namespace
+
+int GpuProfiler::ctorError() {
+  if (!frames.empty()) {
+    logE("BUG: GpuProfiler::ctorError called twice\n");
+    return 1;
+  }
+  if (!framesInFlight || !maxScopes) {
+    logE("GpuProfiler: framesInFlight=%zu maxScopes=%u is invalid\n",
+         framesInFlight, maxScopes);
+    return 1;
+  }
+  auto qfam_i = dev.getQfamI(queueFamily);
+  if (qfam_i == (size_t)-1) {
+    logE("GpuProfiler::ctorError: dev.getQfamI(%d) failed\n", queueFamily);
+    return 1;
+  }
+  auto bits = dev.qfams.at(qfam_i).queueFamilyProperties.timestampValidBits;
+  auto& limits = dev.physProp.properties.limits;
+  if (!bits || limits.timestampPeriod <= 0) {
+    logE("GpuProfiler: queue family %zu does not support timestamps\n",
+         (size_t)qfam_i);
+    return 1;
+  }
+  tickMask = bits < 64 ? (1ull << bits) - 1 : ~0ull;
+  nsPerTick = limits.timestampPeriod;
+
+  for (size_t i = 0; i < framesInFlight; i++) {
+    frames.emplace_back(dev);
+    if (frames.back().pool.ctorError(dev, VK_QUERY_TYPE_TIMESTAMP,
+                                     maxScopes * 2)) {
+      logE("GpuProfiler: frame[%zu] QueryPool failed\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int GpuProfiler::collect(Frame& f) {
+  results.clear();
+  if (!f.used) {
+    return 0;
+  }
+  // Each query is a pair: the timestamp, then its availability.
+  std::vector<uint64_t> data(f.used * 2);
+  VkResult v = vkGetQueryPoolResults(
+      dev.dev, f.pool.vk, 0, f.used, data.size() * sizeof(data.at(0)),
+      data.data(), 2 * sizeof(data.at(0)),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (v != VK_SUCCESS && v != VK_NOT_READY) {
+    logE("%s failed: %d (%s)\n", "vkGetQueryPoolResults", v,
+         string_VkResult(v));
+    return 1;
+  }
+  if (!haveEpoch) {
+    // f.scopes is in CPU order, but another lane may have started earlier on
+    // the GPU. The epoch is the earliest t0 in the frame.
+    for (auto& p : f.scopes) {
+      if (!data.at(p.query * 2 + 1) || !data.at(p.query * 2 + 3)) {
+        continue;
+      }
+      uint64_t t0 = data.at(p.query * 2) & tickMask;
+      if (!haveEpoch || signedTicks(t0 - epoch, tickMask) < 0) {
+        epoch = t0;
+        haveEpoch = true;
+      }
+    }
+  }
+  for (auto& p : f.scopes) {
+    if (!data.at(p.query * 2 + 1) || !data.at(p.query * 2 + 3)) {
+      continue;  // Not available (or end() was never called).
+    }
+    uint64_t t0 = data.at(p.query * 2) & tickMask;
+    uint64_t t1 = data.at(p.query * 2 + 2) & tickMask;
+    results.emplace_back();
+    auto& s = results.back();
+    s.name = p.name;
+    s.depth = p.depth;
+    s.lane = p.lane;
+    s.frame = f.frame;
+    // Masking the difference handles a counter that wrapped around. A later
+    // frame may still start before epoch, so start is signed.
+    s.start = std::chrono::nanoseconds(
+        (long long)(signedTicks(t0 - epoch, tickMask) * nsPerTick));
+    s.duration = std::chrono::nanoseconds(
+        (long long)(((t1 - t0) & tickMask) * nsPerTick));
+  }
+  for (auto& s : results) {
+    if (trace.size() >= traceLimit) {
+      break;
+    }
+    trace.emplace_back(s);
+  }
+  return 0;
+}
+
+int GpuProfiler::beginFrame(size_t frame_i, command::CommandBuffer& cmd) {
+  if (frame_i >= frames.size()) {
+    logE("GpuProfiler::beginFrame(%zu): only %zu framesInFlight\n", frame_i,
+         frames.size());
+    return 1;
+  }
+  std::lock_guard<std::mutex> lock(lockmutex);
+  for (auto& o : open) {
+    if (!o.second.empty() && o.second.back() != (size_t)-1) {
+      logW("GpuProfiler: scope \"%s\" was never ended\n",
+           frames.at(cur).scopes.at(o.second.back()).name.c_str());
+    }
+  }
+  open.clear();
+  lanes.clear();
+
+  auto& f = frames.at(frame_i);
+  if (collect(f)) {
+    logE("GpuProfiler::beginFrame(%zu): collect failed\n", frame_i);
+    return 1;
+  }
+  f.scopes.clear();
+  f.used = 0;
+  f.frame = frameCount++;
+  cur = frame_i;
+  return cmd.resetQueryPool(f.pool.vk, 0, maxScopes * 2);
+}
+
+int GpuProfiler::begin(command::CommandBuffer& cmd, const char* name,
+                       VkPipelineStageFlagBits stage /*= TOP_OF_PIPE*/) {
+  std::lock_guard<std::mutex> lock(lockmutex);
+  if (cur == (size_t)-1) {
+    logE("BUG: GpuProfiler::begin before beginFrame\n");
+    return 1;
+  }
+  auto& f = frames.at(cur);
+  auto& stack = open[cmd.vk];
+  if (f.used + 2 > maxScopes * 2) {
+    // Push a placeholder so end() still pairs up with this begin().
+    stack.emplace_back((size_t)-1);
+    return 0;
+  }
+  auto lane = lanes.emplace(cmd.vk, lanes.size()).first->second;
+  stack.emplace_back(f.scopes.size());
+  f.scopes.emplace_back(Pending{name, stack.size() - 1, lane, f.used});
+  f.used += 2;
+  return cmd.writeTimestamp(stage, f.pool.vk, f.scopes.back().query);
+}
+
+int GpuProfiler::end(command::CommandBuffer& cmd,
+                     VkPipelineStageFlagBits stage /*= BOTTOM_OF_PIPE*/) {
+  std::lock_guard<std::mutex> lock(lockmutex);
+  auto it = open.find(cmd.vk);
+  if (cur == (size_t)-1 || it == open.end() || it->second.empty()) {
+    logE("BUG: GpuProfiler::end without begin\n");
+    return 1;
+  }
+  auto scope_i = it->second.back();
+  it->second.pop_back();
+  if (scope_i == (size_t)-1) {
+    return 0;
+  }
+  auto& f = frames.at(cur);
+  return cmd.writeTimestamp(stage, f.pool.vk,
+                            f.scopes.at(scope_i).query + 1);
+}
+
+std::string GpuProfiler::chromeTrace() const {
+  std::string out = "{\"traceEvents\":[";
+  char buf[256];
+  for (size_t i = 0; i < trace.size(); i++) {
+    auto& s = trace.at(i);
+    out += i ? ",\n" : "\n";
+    out += "{\"name\":";
+    appendJSONString(out, s.name);
+    snprintf(buf, sizeof(buf),
+             ",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+             "\"args\":{\"frame\":%llu}}",
+             s.lane, s.start.count() / 1e3, s.duration.count() / 1e3,
+             (unsigned long long)s.frame);
+    out += buf;
+  }
+  out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+  return out;
+}
+
+int GpuProfiler::writeChromeTrace(const char* filename) const {
+  return language::writeTextFile(filename, chromeTrace(),
+                                 "GpuProfiler::writeChromeTrace");
+}
+
+}  // namespace science
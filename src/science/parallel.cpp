@@ -0,0 +1,234 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * ParallelRecorder records secondary command buffers on worker threads.
+ */
+#include "science.h"
+
+#include <atomic>
+
+namespace science {
+
+ParallelRecorder::~ParallelRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(workerMutex);
+    workerQuit = true;
+  }
+  workerWake.notify_all();
+  for (auto& t : workers) {
+    t.join();
+  }
+  // The CommandPools must not be destroyed while the GPU may still be
+  // executing their command buffers.
+  for (auto& frame : frames) {
+    if (frame.fenceInUse && frame.fence && waitFence(frame)) {
+      logE("~ParallelRecorder: waitFence failed\n");
+    }
+  }
+}
+
+int ParallelRecorder::ctorError() {
+  if (!workers.empty()) {
+    logE("BUG: ParallelRecorder::ctorError called twice\n");
+    return 1;
+  }
+  if (!nThreads) {
+    nThreads = std::thread::hardware_concurrency();
+    if (!nThreads) {
+      nThreads = 1;
+    }
+  }
+  if (!framesInFlight) {
+    logE("ParallelRecorder: framesInFlight must be at least 1\n");
+    return 1;
+  }
+
+  frames.resize(framesInFlight);
+  for (size_t frame_i = 0; frame_i < frames.size(); frame_i++) {
+    auto& frame = frames.at(frame_i);
+    frame.threads.resize(nThreads);
+    for (size_t thread_i = 0; thread_i < nThreads; thread_i++) {
+      auto& t = frame.threads.at(thread_i);
+      t.pool.reset(new command::CommandPool(dev));
+      t.pool->queueFamily = queueFamily;
+      // All command buffers are recycled at once by resetting the whole pool,
+      // so VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT is not needed.
+      if (t.pool->ctorError(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)) {
+        logE("ParallelRecorder: frame[%zu] thread[%zu] pool failed\n", frame_i,
+             thread_i);
+        return 1;
+      }
+    }
+    frame.fence.reset(new command::Fence(dev));
+    if (frame.fence->ctorError(dev)) {
+      logE("ParallelRecorder: frame[%zu] fence failed\n", frame_i);
+      return 1;
+    }
+  }
+
+  for (size_t thread_i = 0; thread_i < nThreads; thread_i++) {
+    workers.emplace_back(&ParallelRecorder::workerMain, this, thread_i);
+  }
+  return 0;
+}
+
+void ParallelRecorder::workerMain(size_t thread_i) {
+  size_t seen = 0;
+  std::unique_lock<std::mutex> lock(workerMutex);
+  for (;;) {
+    workerWake.wait(lock,
+                    [&] { return workerQuit || workerGeneration != seen; });
+    if (workerQuit) {
+      return;
+    }
+    seen = workerGeneration;
+    auto fn = workerFn;
+    lock.unlock();
+    fn(thread_i);
+    lock.lock();
+    if (!--workersRunning) {
+      workerDone.notify_all();
+    }
+  }
+}
+
+void ParallelRecorder::runOnWorkers(std::function<void(size_t thread_i)> fn) {
+  std::unique_lock<std::mutex> lock(workerMutex);
+  workerFn = fn;
+  workersRunning = workers.size();
+  workerGeneration++;
+  workerWake.notify_all();
+  workerDone.wait(lock, [&] { return !workersRunning; });
+  workerFn = nullptr;
+}
+
+int ParallelRecorder::waitFence(Frame& frame) {
+  VkResult v = frame.fence->wait(dev, fenceTimeout);
+  if (v == VK_TIMEOUT) {
+    logE("BUG: ParallelRecorder: fence timed out. Submit primary with "
+         "fence(frame_i) or call cancel(frame_i) after record().\n");
+    return 1;
+  }
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+    return 1;
+  }
+  return 0;
+}
+
+int ParallelRecorder::recycle(Frame& frame) {
+  if (frame.fenceInUse) {
+    if (waitFence(frame)) {
+      return 1;
+    }
+    if (frame.fence->reset(dev)) {
+      logE("ParallelRecorder: fence reset failed\n");
+      return 1;
+    }
+    frame.fenceInUse = false;
+  }
+  for (auto& t : frame.threads) {
+    if (!t.used) {
+      continue;
+    }
+    // Keep the memory allocated by the pool: the next frame will likely need
+    // about the same amount.
+    if (t.pool->reset((VkCommandPoolResetFlagBits)0)) {
+      logE("ParallelRecorder: pool reset failed\n");
+      return 1;
+    }
+    t.used = 0;
+  }
+  return 0;
+}
+
+int ParallelRecorder::record(size_t frame_i, command::CommandBuffer& primary,
+                             command::RenderPass& pass, uint32_t subpass,
+                             language::Framebuf& framebuf, size_t jobCount,
+                             Job job) {
+  if (workers.empty()) {
+    logE("BUG: ParallelRecorder::record before ctorError\n");
+    return 1;
+  }
+  if (frame_i >= frames.size()) {
+    logE("ParallelRecorder::record(%zu): only %zu framesInFlight\n", frame_i,
+         frames.size());
+    return 1;
+  }
+  auto& frame = frames.at(frame_i);
+  if (recycle(frame)) {
+    return 1;
+  }
+
+  std::vector<VkCommandBuffer> out(jobCount, VK_NULL_HANDLE);
+  std::atomic<size_t> next{0};
+  std::atomic<int> failed{0};
+  VkFramebuffer vkFramebuf = framebuf.vk;
+  runOnWorkers([&](size_t thread_i) {
+    auto& t = frame.threads.at(thread_i);
+    // Only this worker records into t.pool, so a Job can use a lock-free
+    // CommandBuffer::RecordingScope.
+    t.pool->owner = std::this_thread::get_id();
+    for (size_t job_i; (job_i = next++) < jobCount && !failed;) {
+      if (t.used == t.bufs.size()) {
+        std::vector<VkCommandBuffer> vk(1);
+        if (t.pool->alloc(vk, VK_COMMAND_BUFFER_LEVEL_SECONDARY)) {
+          logE("ParallelRecorder: job[%zu] alloc failed\n", job_i);
+          failed = 1;
+          return;
+        }
+        t.bufs.emplace_back(*t.pool);
+        t.bufs.back().vk = vk.at(0);
+      }
+      auto& buf = t.bufs.at(t.used);
+      t.used++;
+      if (buf.beginSecondary(pass, subpass, vkFramebuf)) {
+        logE("ParallelRecorder: job[%zu] beginSecondary failed\n", job_i);
+        failed = 1;
+        return;
+      }
+      if (job(buf, job_i)) {
+        logE("ParallelRecorder: job[%zu] failed\n", job_i);
+        failed = 1;
+        return;
+      }
+      if (buf.end()) {
+        logE("ParallelRecorder: job[%zu] end failed\n", job_i);
+        failed = 1;
+        return;
+      }
+      out.at(job_i) = buf.vk;
+    }
+  });
+
+  if (failed) {
+    // Nothing was submitted, so the pools can be reset without a fence wait.
+    if (recycle(frame)) {
+      logE("ParallelRecorder: recycle after failed job also failed\n");
+    }
+    return 1;
+  }
+  if (jobCount && primary.executeCommands(out.size(), out.data())) {
+    logE("ParallelRecorder: executeCommands failed\n");
+    return 1;
+  }
+  frame.fenceInUse = true;
+  return 0;
+}
+
+int ParallelRecorder::cancel(size_t frame_i) {
+  if (frame_i >= frames.size()) {
+    logE("ParallelRecorder::cancel(%zu): only %zu framesInFlight\n", frame_i,
+         frames.size());
+    return 1;
+  }
+  auto& frame = frames.at(frame_i);
+  if (!frame.fenceInUse) {
+    logE("BUG: ParallelRecorder::cancel(%zu) without record()\n", frame_i);
+    return 1;
+  }
+  // fence was never submitted, so the pools can be reset without a wait.
+  frame.fenceInUse = false;
+  return recycle(frame);
+}
+
+}  // namespace science
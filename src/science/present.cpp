@@ -102,4 +102,112 @@ int PresentSemaphore::waitIdle() {
   return 0;
 }
 
+FrameScheduler::~FrameScheduler() {
+  if (freeFrames()) {
+    logF("~FrameScheduler: freeFrames failed\n");
+  }
+}
+
+int FrameScheduler::freeFrames() {
+  // The GPU may still be executing each frame's cmd.
+  if (waitIdle()) {
+    return 1;
+  }
+  std::vector<VkCommandBuffer> vk;
+  for (auto& f : frames) {
+    if (f->cmd.vk) {
+      vk.emplace_back(f->cmd.vk);
+      f->cmd.vk = VK_NULL_HANDLE;
+    }
+  }
+  parent.cpool.free(vk);
+  frames.clear();
+  return 0;
+}
+
+int FrameScheduler::ctorError() {
+  if (!framesInFlight) {
+    logE("FrameScheduler: framesInFlight must be at least 1\n");
+    return 1;
+  }
+  auto& dev = parent.cpool.dev;
+  if (freeFrames()) {
+    logE("FrameScheduler: freeFrames failed\n");
+    return 1;
+  }
+  std::vector<VkCommandBuffer> vk(framesInFlight);
+  if (parent.cpool.alloc(vk)) {
+    logE("FrameScheduler: alloc failed\n");
+    return 1;
+  }
+  for (size_t i = 0; i < framesInFlight; i++) {
+    frames.emplace_back(new Frame(parent));
+    auto& f = *frames.back();
+    f.cmd.vk = vk.at(i);
+    if (f.imageAvailable.ctorError(dev) || f.renderFinished.ctorError() ||
+        f.fence.ctorError(dev)) {
+      logE("FrameScheduler: frame[%zu] failed\n", i);
+      return 1;
+    }
+  }
+  frame_i = 0;
+  return 0;
+}
+
+int FrameScheduler::waitFrame(Frame& f) {
+  if (!f.submitted) {
+    return 0;
+  }
+  auto& dev = parent.cpool.dev;
+  VkResult v = f.fence.wait(dev, std::numeric_limits<uint64_t>::max());
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+    return 1;
+  }
+  if (f.fence.reset(dev)) {
+    return 1;
+  }
+  f.submitted = false;
+  return 0;
+}
+
+int FrameScheduler::acquire(uint32_t* image_i) {
+  if (frames.empty()) {
+    logE("BUG: FrameScheduler::acquire before ctorError\n");
+    return 1;
+  }
+  auto& f = frame();
+  auto t0 = std::chrono::steady_clock::now();
+  if (waitFrame(f)) {
+    return 1;
+  }
+  lastCpuWait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - t0);
+  totalCpuWait += lastCpuWait;
+  return parent.acquireNextImage(frameNumber, image_i, f.imageAvailable);
+}
+
+int FrameScheduler::submitAndPresent(command::CommandBuffer& cmd,
+                                     uint32_t* image_i) {
+  auto& f = frame();
+  if (cmd.submit(memory::ASSUME_POOL_QINDEX, {f.imageAvailable.vk},
+                 {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
+                 {f.renderFinished.vk}, f.fence.vk)) {
+    return 1;
+  }
+  f.submitted = true;
+  frame_i = (frame_i + 1) % frames.size();
+  frameNumber++;
+  return f.renderFinished.present(image_i);
+}
+
+int FrameScheduler::waitIdle() {
+  for (auto& f : frames) {
+    if (waitFrame(*f)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 }  // namespace science
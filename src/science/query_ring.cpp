@@ -0,0 +1,165 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * QueryRing reads back occlusion and pipeline statistics queries through a
+ * host-visible Buffer.
+ */
+#include "science.h"
+
+namespace science {
+
+int QueryRing::ctorError() {
+  if (!frames.empty()) {
+    logE("BUG: QueryRing::ctorError called twice\n");
+    return 1;
+  }
+  if (!framesInFlight || !maxQueries) {
+    logE("QueryRing: framesInFlight=%zu maxQueries=%u is invalid\n",
+         framesInFlight, maxQueries);
+    return 1;
+  }
+  if (type == VK_QUERY_TYPE_TIMESTAMP) {
+    logE("QueryRing: use GpuProfiler for VK_QUERY_TYPE_TIMESTAMP\n");
+    return 1;
+  }
+  frames.resize(framesInFlight);
+  for (size_t i = 0; i < framesInFlight; i++) {
+    auto& f = frames.at(i);
+    f.pool.reset(new command::QueryPool(dev));
+    if (f.pool->ctorError(dev, type, maxQueries, pipelineStatistics)) {
+      logE("QueryRing: frame[%zu] QueryPool failed\n", i);
+      return 1;
+    }
+  }
+  stride = frames.at(0).pool->valuesPerQuery() * sizeof(uint64_t);
+
+  buf.info.size = stride * maxQueries * framesInFlight;
+  buf.info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buf.mem.persistentMap = true;
+  if (buf.ctorHostCoherent() || buf.bindMemory()) {
+    logE("QueryRing: buf.ctorHostCoherent failed\n");
+    return 1;
+  }
+  mapped = reinterpret_cast<char*>(buf.mem.mapped);
+  return 0;
+}
+
+int QueryRing::beginFrame(size_t frame_i, command::CommandBuffer& cmd) {
+  if (frame_i >= frames.size()) {
+    logE("QueryRing::beginFrame(%zu): only %zu framesInFlight\n", frame_i,
+         frames.size());
+    return 1;
+  }
+  std::lock_guard<std::mutex> lock(lockmutex);
+  if (!active.empty()) {
+    logW("QueryRing: %zu queries were never ended\n", active.size());
+    active.clear();
+  }
+
+  auto& f = frames.at(frame_i);
+  results.clear();
+  if (f.copied) {
+    // The app waited on this frame's fence, so the copy is done.
+    auto values = f.pool->valuesPerQuery();
+    const char* base = mapped + stride * maxQueries * frame_i;
+    for (size_t i = 0; i < f.ids.size(); i++) {
+      results.emplace_back();
+      auto& r = results.back();
+      r.id = f.ids.at(i);
+      r.frame = f.frame;
+      r.values.resize(values);
+      memcpy(r.values.data(), base + stride * i, stride);
+    }
+  }
+  f.ids.clear();
+  f.copied = false;
+  f.frame = frameCount++;
+  cur = frame_i;
+  return cmd.resetQueryPool(f.pool->vk, 0, maxQueries);
+}
+
+int QueryRing::begin(command::CommandBuffer& cmd, size_t id) {
+  std::lock_guard<std::mutex> lock(lockmutex);
+  if (cur == (size_t)-1) {
+    logE("BUG: QueryRing::begin before beginFrame\n");
+    return 1;
+  }
+  auto& f = frames.at(cur);
+  if (f.ids.size() >= maxQueries) {
+    logE("QueryRing::begin(%zu): all %u queries used\n", id, maxQueries);
+    return 1;
+  }
+  if (!active.emplace(cmd.vk, (uint32_t)f.ids.size()).second) {
+    logE("BUG: QueryRing::begin(%zu): a query is already active\n", id);
+    return 1;
+  }
+  f.ids.emplace_back(id);
+  return cmd.beginQuery(f.pool->vk, f.ids.size() - 1, controlFlags);
+}
+
+int QueryRing::end(command::CommandBuffer& cmd) {
+  std::lock_guard<std::mutex> lock(lockmutex);
+  auto it = active.find(cmd.vk);
+  if (cur == (size_t)-1 || it == active.end()) {
+    logE("BUG: QueryRing::end without begin\n");
+    return 1;
+  }
+  auto query = it->second;
+  active.erase(it);
+  return cmd.endQuery(frames.at(cur).pool->vk, query);
+}
+
+int QueryRing::endFrame(command::CommandBuffer& cmd) {
+  std::lock_guard<std::mutex> lock(lockmutex);
+  if (cur == (size_t)-1) {
+    logE("BUG: QueryRing::endFrame before beginFrame\n");
+    return 1;
+  }
+  if (!active.empty()) {
+    // WAIT_BIT below would wait forever for a query that never ends.
+    logE("BUG: QueryRing::endFrame: %zu queries were never ended\n",
+         active.size());
+    return 1;
+  }
+  auto frame_i = cur;
+  auto& f = frames.at(frame_i);
+  cur = (size_t)-1;
+  if (f.ids.empty()) {
+    return 0;
+  }
+  // WAIT_BIT makes the GPU (not the CPU) wait for the results.
+  if (cmd.copyQueryPoolResults(
+          f.pool->vk, 0, f.ids.size(), buf.vk,
+          stride * maxQueries * frame_i, stride,
+          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT)) {
+    logE("QueryRing::endFrame: copyQueryPoolResults failed\n");
+    return 1;
+  }
+  // Make the copy visible to the host once the fence signals.
+  command::CommandBuffer::BarrierSet b;
+  b.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  b.dstStageMask = VK_PIPELINE_STAGE_HOST_BIT;
+  VkMemoryBarrier VkInit(mb);
+  mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  mb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  b.mem.emplace_back(mb);
+  if (cmd.waitBarrier(b)) {
+    logE("QueryRing::endFrame: waitBarrier failed\n");
+    return 1;
+  }
+  f.copied = true;
+  return 0;
+}
+
+uint64_t QueryRing::statistic(const Result& r,
+                              VkQueryPipelineStatisticFlagBits bit) const {
+  if (frames.empty()) {
+    return 0;
+  }
+  int i = frames.at(0).pool->statisticIndex(bit);
+  if (i < 0 || (size_t)i >= r.values.size()) {
+    return 0;
+  }
+  return r.values.at(i);
+}
+
+}  // namespace science
@@ -97,6 +97,60 @@ static void print_stage(spirv_cross::CompilerGLSL& compiler,
   print_resources("separate_samplers", resources.separate_samplers, compiler);
 }
 
+// runtimeArrayFlags returns the VkDescriptorBindingFlagsEXT for a runtime
+// array of type t, using only the features enabled in dev.
+static VkDescriptorBindingFlagsEXT runtimeArrayFlags(language::Device& dev,
+                                                     VkDescriptorType t) {
+  auto& f = dev.enabledFeatures.descriptorIndexing;
+  VkDescriptorBindingFlagsEXT flags = 0;
+  if (f.descriptorBindingPartiallyBound) {
+    flags |= VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+  }
+  VkBool32 updateAfterBind = VK_FALSE;
+  switch (t) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+      updateAfterBind = f.descriptorBindingSampledImageUpdateAfterBind;
+      break;
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+      updateAfterBind = f.descriptorBindingStorageImageUpdateAfterBind;
+      break;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+      updateAfterBind = f.descriptorBindingUniformBufferUpdateAfterBind;
+      break;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+      updateAfterBind = f.descriptorBindingStorageBufferUpdateAfterBind;
+      break;
+    default:
+      break;
+  }
+  if (updateAfterBind) {
+    flags |= VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+  }
+  return flags;
+}
+
+// makeDynamic changes layout to the _DYNAMIC variant of its buffer type.
+static int makeDynamic(VkDescriptorSetLayoutBinding& layout, bool isRuntime) {
+  if (isRuntime) {
+    logE("makeDynamic: a runtime array cannot be dynamic\n");
+    return 1;
+  }
+  switch (layout.descriptorType) {
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+      layout.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      return 0;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+      layout.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      return 0;
+    default:
+      logE("makeDynamic: type %s cannot be dynamic\n",
+           string_VkDescriptorType(layout.descriptorType));
+      return 1;
+  }
+}
+
 }  // anonymous namespace
 
 struct ShaderLibraryInternal {
@@ -112,6 +166,9 @@ struct ShaderLibraryInternal {
 
   struct ShaderBinding {
     vector<VkDescriptorSetLayoutBinding> layouts;
+    // isRuntimeArray is true for each layout that was declared as a runtime
+    // array, e.g. "uniform sampler2D textures[]".
+    vector<bool> isRuntimeArray;
     uint32_t allStageBits{0};
   };
 
@@ -130,10 +187,50 @@ struct ShaderLibraryInternal {
     return 0;
   }
 
+  // reflectArray sets count to the total number of descriptors in res, which
+  // is more than 1 if res is an array. A runtime array gets
+  // ShaderLibrary::runtimeArrayCount.
+  int reflectArray(VkShaderStageFlagBits stageBits,
+                   spirv_cross::CompilerGLSL& compiler,
+                   const spirv_cross::Resource& res, uint32_t& count,
+                   bool& isRuntime) {
+    auto& t = compiler.get_type(res.type_id);
+    count = 1;
+    isRuntime = false;
+    for (size_t i = 0; i < t.array.size(); i++) {
+      if (!t.array_size_literal.at(i)) {
+        logE("ERROR: shader at stage %s: id %u: array size is a %s\n",
+             string_VkShaderStageFlagBits(stageBits), res.id,
+             "specialization constant, which is not supported");
+        return 1;
+      }
+      if (t.array.at(i)) {
+        count *= t.array.at(i);
+        continue;
+      }
+      // spirv_cross puts the outermost dimension last. Only the outermost
+      // dimension can be a runtime array.
+      if (i != t.array.size() - 1) {
+        logE("ERROR: shader at stage %s: id %u: invalid runtime array\n",
+             string_VkShaderStageFlagBits(stageBits), res.id);
+        return 1;
+      }
+      isRuntime = true;
+      count *= self.runtimeArrayCount;
+    }
+    return 0;
+  }
+
   int reflectResource(VkShaderStageFlagBits stageBits,
                       spirv_cross::CompilerGLSL& compiler,
                       ResourceTypeMap& rtm) {
     for (auto& res : rtm.resources) {
+      uint32_t count;
+      bool isRuntime;
+      if (reflectArray(stageBits, compiler, res, count, isRuntime)) {
+        return 1;
+      }
+
       uint32_t setI = 0;
       auto bitset = compiler.get_decoration_bitset(res.id);
       if (bitset.get(spv::DecorationDescriptorSet)) {
@@ -158,13 +255,14 @@ struct ShaderLibraryInternal {
       if (bindingI == binding.layouts.size()) {
         VkDescriptorSetLayoutBinding VkInit(layoutBinding);
         layoutBinding.binding = bindingI;
-        layoutBinding.descriptorCount = 1;
+        layoutBinding.descriptorCount = count;
         layoutBinding.descriptorType = rtm.descriptorType;
         layoutBinding.pImmutableSamplers = nullptr;
         // layoutBinding1.stageFlags is set in
         // ShaderLibrary::makeDescriptorLibrary to the OR of all stageBits. It
         // is being collected in binding.allStageBits above.
         binding.layouts.emplace_back(layoutBinding);
+        binding.isRuntimeArray.emplace_back(isRuntime);
       } else if (bindingI > binding.layouts.size()) {
         logE("ERROR: shader at stage %s: binding=%u skips binding=%zu\n",
              string_VkShaderStageFlagBits(stageBits), bindingI,
@@ -179,11 +277,37 @@ struct ShaderLibraryInternal {
              string_VkShaderStageFlagBits(stageBits), bindingI,
              binding.layouts.at(bindingI).descriptorType);
         return 1;
+      } else if (binding.layouts.at(bindingI).descriptorCount != count ||
+                 binding.isRuntimeArray.at(bindingI) != isRuntime) {
+        logE("ERROR: shader stage %s: binding=%u has %u descriptors%s,\n",
+             string_VkShaderStageFlagBits(stageBits), bindingI, count,
+             isRuntime ? " (runtime array)" : "");
+        logE("ERROR: but another shader declared it with %u%s\n",
+             binding.layouts.at(bindingI).descriptorCount,
+             binding.isRuntimeArray.at(bindingI) ? " (runtime array)" : "");
+        return 1;
       }
     }
     return 0;
   }
 
+  // findState validates the arguments to ShaderLibrary::stage().
+  ShaderState* findState(shared_ptr<Shader> shader,
+                         VkShaderStageFlagBits stageBits) {
+    if (!stageBits) {
+      logE("BUG: %sstage with stageBits == 0\n", "ShaderLibrary::");
+      return nullptr;
+    }
+    auto state = states.find(shader);
+    if (state == states.end()) {
+      logE("BUG: %sstage before %sload.\n", "ShaderLibrary::",
+           "ShaderLibrary::");
+      logE("Where did the shared_ptr<Shader> come from?\n");
+      return nullptr;
+    }
+    return &state->second;
+  }
+
   int addStage(ShaderState& state, VkShaderStageFlagBits stageBits) {
     state.isStaged = true;
 
@@ -272,26 +396,40 @@ int ShaderLibrary::stage(RenderPass& renderPass, PipeBuilder& pipeb,
     logE("BUG: %sstage before %sload\n", "ShaderLibrary::", "ShaderLibrary::");
     return 1;
   }
-  if (!stageBits) {
-    logE("BUG: %sstage with stageBits == 0\n", "ShaderLibrary::");
-    return 1;
-  }
-  auto state = _i->states.find(shader);
-  if (state == _i->states.end()) {
-    logE("BUG: %sstage before %sload.\n", "ShaderLibrary::", "ShaderLibrary::");
-    logE("Where did the shared_ptr<Shader> come from?\n");
+  auto* s = _i->findState(shader, stageBits);
+  if (!s) {
     return 1;
   }
 
   auto& info = pipeb.info();
-  auto& s = state->second;
-  if (_i->addStage(s, stageBits) ||
+  if (_i->addStage(*s, stageBits) ||
       info.addShader(shader, renderPass, stageBits, entryPointName)) {
     logE("ShaderLibrary: addStage or addShader failed\n");
     return 1;
   }
-  info.pushConstants.insert(info.pushConstants.end(), s.pushConsts.begin(),
-                            s.pushConsts.end());
+  info.pushConstants.insert(info.pushConstants.end(), s->pushConsts.begin(),
+                            s->pushConsts.end());
+  return 0;
+}
+
+int ShaderLibrary::stage(ComputePipeline& pipe, shared_ptr<Shader> shader,
+                         string entryPointName /*= "main"*/) {
+  if (!_i) {
+    logE("BUG: %sstage before %sload\n", "ShaderLibrary::", "ShaderLibrary::");
+    return 1;
+  }
+  auto* s = _i->findState(shader, VK_SHADER_STAGE_COMPUTE_BIT);
+  if (!s) {
+    return 1;
+  }
+
+  if (_i->addStage(*s, VK_SHADER_STAGE_COMPUTE_BIT)) {
+    logE("ShaderLibrary: addStage failed\n");
+    return 1;
+  }
+  pipe.info.setShader(shader, entryPointName);
+  pipe.info.pushConstants.insert(pipe.info.pushConstants.end(),
+                                 s->pushConsts.begin(), s->pushConsts.end());
   return 0;
 }
 
@@ -324,29 +462,58 @@ int ShaderLibrary::makeDescriptorLibrary(
 
   descriptorLibrary.layouts.clear();
   descriptorLibrary.layouts.reserve(_i->bindings.size());
+  bool updateAfterBind = false;
   for (size_t bindingI = 0; bindingI < _i->bindings.size(); bindingI++) {
     auto binding = _i->bindings.at(bindingI);
     maxSets++;
 
     vector<VkDescriptorSetLayoutBinding> libBindings(binding.layouts.size());
+    vector<VkDescriptorBindingFlagsEXT> libFlags(binding.layouts.size(), 0);
+    bool hasRuntimeArray = false;
     for (size_t layoutI = 0; layoutI < binding.layouts.size(); layoutI++) {
       auto& layout = binding.layouts.at(layoutI);
-      types.emplace(layout.descriptorType);
+      if (dynamicBuffers.count(
+              make_pair((uint32_t)bindingI, (uint32_t)layoutI))) {
+        if (makeDynamic(layout, binding.isRuntimeArray.at(layoutI))) {
+          logE("%smakeDescriptorLibrary: set=%zu binding=%zu failed\n",
+               "ShaderLibrary::", bindingI, layoutI);
+          return 1;
+        }
+      }
+      for (uint32_t i = 0; i < layout.descriptorCount; i++) {
+        types.emplace(layout.descriptorType);
+      }
 
       // This could be more efficient if stage bits could be broken down
       // to per-stage granularity.
       layout.stageFlags =
           static_cast<VkShaderStageFlagBits>(binding.allStageBits);
       libBindings.at(layoutI) = layout;
+
+      if (binding.isRuntimeArray.at(layoutI)) {
+        if (!dev.enabledFeatures.descriptorIndexing.runtimeDescriptorArray) {
+          logE("%smakeDescriptorLibrary: set=%zu binding=%zu is a runtime\n",
+               "ShaderLibrary::", bindingI, layoutI);
+          logE("array but runtimeDescriptorArray is not enabled (%s)\n",
+               VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+          return 1;
+        }
+        hasRuntimeArray = true;
+        libFlags.at(layoutI) = runtimeArrayFlags(dev, layout.descriptorType);
+      }
     }
 
     descriptorLibrary.layouts.emplace_back(dev);
     auto& libLayout = descriptorLibrary.layouts.at(bindingI);
+    if (hasRuntimeArray) {
+      libLayout.bindingFlags = libFlags;
+    }
     if (libLayout.ctorError(dev, libBindings)) {
       fprintf(stderr, "descriptorLibrary.layouts[%zu].ctorError failed\n",
               bindingI);
       return 1;
     }
+    updateAfterBind |= libLayout.isUpdateAfterBind();
   }
 
   if (wantTypes.size()) {
@@ -360,10 +527,29 @@ int ShaderLibrary::makeDescriptorLibrary(
     }
   }
 
+#ifndef __ANDROID__
+  descriptorLibrary.templates.clear();
+  if (dev.apiVersionInUse() >= VK_MAKE_VERSION(1, 1, 0)) {
+    descriptorLibrary.templates.reserve(descriptorLibrary.layouts.size());
+    for (size_t i = 0; i < descriptorLibrary.layouts.size(); i++) {
+      descriptorLibrary.templates.emplace_back(dev);
+      if (descriptorLibrary.templates.back().ctorError(
+              descriptorLibrary.layouts.at(i))) {
+        logE("descriptorLibrary.templates[%zu].ctorError failed\n", i);
+        return 1;
+      }
+    }
+  }
+#endif /* __ANDROID__ */
+
   multiset<VkDescriptorType> typesMultiple;
   for (size_t i = 0; i < descriptorSetMaxCopies; i++) {
     typesMultiple.insert(types.begin(), types.end());
   }
+  if (updateAfterBind) {
+    descriptorLibrary.pool.flags |=
+        VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+  }
   if (descriptorLibrary.pool.ctorError(maxSets * descriptorSetMaxCopies,
                                        typesMultiple)) {
     fprintf(stderr, "DescriptorPool::ctorError failed\n");
@@ -0,0 +1,504 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * RenderGraph computes the barriers between passes from their declared
+ * reads and writes.
+ */
+#include "science.h"
+
+namespace science {
+
+namespace {  // an anonymous namespace hides its contents outside this file
+
+// usageFor returns the VkImageUsageFlags an image needs for access a.
+VkImageUsageFlags usageFor(const RenderGraph::Access& a) {
+  switch (a.layout) {
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+      return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+      return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+      if (a.access & VK_ACCESS_SHADER_READ_BIT) {
+        return VK_IMAGE_USAGE_SAMPLED_BIT;
+      }
+      return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+      if (a.access & VK_ACCESS_INPUT_ATTACHMENT_READ_BIT) {
+        return VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+      }
+      return VK_IMAGE_USAGE_SAMPLED_BIT;
+    case VK_IMAGE_LAYOUT_GENERAL:
+      return VK_IMAGE_USAGE_STORAGE_BIT;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+      return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+      return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    default:
+      return 0;
+  }
+}
+
+}  // anonymous namespace
+
+size_t RenderGraph::importImage(
+    memory::Image& img, VkImageLayout finalLayout /*= UNDEFINED*/) {
+  resources.emplace_back();
+  auto& r = resources.back();
+  r.img = &img;
+  r.finalLayout = finalLayout;
+  r.keep = finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+  compiled = false;
+  return resources.size() - 1;
+}
+
+size_t RenderGraph::importBuffer(memory::Buffer& buf, bool keep /*= false*/) {
+  resources.emplace_back();
+  auto& r = resources.back();
+  r.buf = &buf;
+  r.keep = keep;
+  compiled = false;
+  return resources.size() - 1;
+}
+
+size_t RenderGraph::createImage(const VkImageCreateInfo& info) {
+  resources.emplace_back();
+  auto& r = resources.back();
+  r.info = info;
+  r.info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  r.owned.reset(new memory::Image(dev));
+  compiled = false;
+  return resources.size() - 1;
+}
+
+int RenderGraph::rebindImage(size_t res, memory::Image& img) {
+  if (res >= resources.size()) {
+    logE("RenderGraph::rebindImage(%zu): only %zu resources\n", res,
+         resources.size());
+    return 1;
+  }
+  auto& r = resources.at(res);
+  if (!r.img) {
+    logE("RenderGraph::rebindImage(%zu): not from importImage\n", res);
+    return 1;
+  }
+  r.img = &img;
+  compiled = false;
+  return 0;
+}
+
+void RenderGraph::clearResources() {
+  passes.clear();
+  finalBarriers.reset();
+  finalBarriers.srcStageMask = 0;
+  finalBarriers.dstStageMask = 0;
+  // Destroy the images before aliasPool frees the memory bound to them.
+  resources.clear();
+  aliasPool.reset();
+  compiled = false;
+}
+
+memory::Image& RenderGraph::image(size_t res) {
+  auto& r = resources.at(res);
+  return r.owned ? *r.owned : *r.img;
+}
+
+size_t RenderGraph::addPass(const char* name, Record record,
+                            bool keep /*= false*/) {
+  passes.emplace_back();
+  auto& p = passes.back();
+  p.name = name;
+  p.record = record;
+  p.keep = keep;
+  compiled = false;
+  return passes.size() - 1;
+}
+
+int RenderGraph::use(size_t pass, size_t res, const Access& a, bool isWrite) {
+  if (pass >= passes.size() || res >= resources.size()) {
+    logE("RenderGraph::use(%zu, %zu): only %zu passes, %zu resources\n", pass,
+         res, passes.size(), resources.size());
+    return 1;
+  }
+  auto& r = resources.at(res);
+  if (!r.buf && a.layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+    logE("RenderGraph: pass \"%s\" uses an image with layout UNDEFINED\n",
+         passes.at(pass).name.c_str());
+    return 1;
+  }
+  passes.at(pass).uses.emplace_back(Use{res, a, isWrite});
+  compiled = false;
+  return 0;
+}
+
+void RenderGraph::cull() {
+  // Walk backwards: a pass is live if it writes something a live pass (or
+  // the app) still needs. Once a resource is needed it stays needed, so every
+  // earlier writer is kept too (e.g. a clear before a LOAD_OP_LOAD pass).
+  std::vector<bool> needed(resources.size());
+  for (size_t i = 0; i < resources.size(); i++) {
+    needed.at(i) = resources.at(i).keep;
+  }
+  for (size_t i = passes.size(); i-- > 0;) {
+    auto& p = passes.at(i);
+    p.live = p.keep;
+    for (auto& u : p.uses) {
+      if (u.isWrite && needed.at(u.res)) {
+        p.live = true;
+      }
+    }
+    if (!p.live) {
+      continue;
+    }
+    for (auto& u : p.uses) {
+      if (!u.isWrite) {
+        needed.at(u.res) = true;
+      }
+    }
+  }
+
+  for (auto& r : resources) {
+    r.first = r.last = (size_t)-1;
+  }
+  for (size_t i = 0; i < passes.size(); i++) {
+    if (!passes.at(i).live) {
+      continue;
+    }
+    for (auto& u : passes.at(i).uses) {
+      auto& r = resources.at(u.res);
+      if (r.first == (size_t)-1) {
+        r.first = i;
+      }
+      r.last = i;
+    }
+  }
+}
+
+int RenderGraph::createTransients() {
+  const VkImageUsageFlags attachmentOnly =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  std::vector<VkImageUsageFlags> usage(resources.size());
+  std::vector<bool> lazy(resources.size());
+  // place marks the resources that need a new image from placeTransients().
+  std::vector<bool> place(resources.size());
+  bool replace = false;
+  for (size_t res = 0; res < resources.size(); res++) {
+    auto& r = resources.at(res);
+    if (!r.owned || r.first == (size_t)-1) {
+      continue;
+    }
+    auto& u = usage.at(res);
+    u = r.info.usage;
+    for (size_t i = r.first; i <= r.last; i++) {
+      if (!passes.at(i).live) {
+        continue;
+      }
+      for (auto& use : passes.at(i).uses) {
+        if (use.res == res) {
+          u |= usageFor(use.a);
+        }
+      }
+    }
+    // An attachment used by only one pass never needs to be stored.
+    lazy.at(res) = r.first == r.last && !(u & ~attachmentOnly);
+    bool alias = aliasTransients && !lazy.at(res) &&
+                 r.info.tiling == VK_IMAGE_TILING_OPTIMAL;
+    bool fits = r.owned->vk && (r.owned->info.usage & u) == u &&
+                r.lazy == lazy.at(res) && r.aliased == alias;
+    if (fits && alias) {
+      fits = r.first >= r.placedFirst && r.last <= r.placedLast;
+    }
+    if (fits) {
+      continue;  // Reuse the image from the last compile().
+    }
+    if (alias || r.aliased) {
+      // Every image in aliasPool is placed again.
+      place.at(res) = true;
+      replace = true;
+      continue;
+    }
+    if (newTransient(r, u, lazy.at(res))) {
+      logE("RenderGraph: resource[%zu] newTransient failed\n", res);
+      return 1;
+    }
+  }
+  return replace ? placeTransients(usage, lazy, place) : 0;
+}
+
+int RenderGraph::newTransient(Resource& r, VkImageUsageFlags usage,
+                              bool lazy) {
+  r.owned.reset(new memory::Image(dev));
+  r.owned->info = r.info;
+  r.owned->info.usage = usage;
+  r.lazy = lazy;
+  r.aliased = false;
+  r.aliases.clear();
+  r.endStage = 0;
+  r.endAccess = 0;
+  if (lazy) {
+    return r.owned->ctorTransient() || r.owned->bindMemory();
+  }
+  if (aliasTransients && r.info.tiling == VK_IMAGE_TILING_OPTIMAL) {
+    // placeTransients() binds the memory.
+    return r.owned->ctorWithoutMemory();
+  }
+  return r.owned->ctorDeviceLocal() || r.owned->bindMemory();
+}
+
+int RenderGraph::placeTransients(const std::vector<VkImageUsageFlags>& usage,
+                                 const std::vector<bool>& lazy,
+                                 const std::vector<bool>& place) {
+  // Destroy every image bound to aliasPool, and every image createTransients()
+  // found did not fit (such as a lazy image that now needs SAMPLED usage),
+  // before aliasPool frees the memory.
+  for (size_t res = 0; res < resources.size(); res++) {
+    auto& r = resources.at(res);
+    if (r.aliased || place.at(res)) {
+      r.owned.reset(new memory::Image(dev));
+      r.aliased = false;
+      r.aliases.clear();
+    }
+  }
+  aliasPool.reset();
+
+  std::vector<size_t> placed;
+  for (size_t res = 0; res < resources.size(); res++) {
+    auto& r = resources.at(res);
+    if (!r.owned || r.first == (size_t)-1 || r.owned->vk) {
+      continue;
+    }
+    if (newTransient(r, usage.at(res), lazy.at(res))) {
+      logE("RenderGraph: resource[%zu] newTransient failed\n", res);
+      return 1;
+    }
+    if (aliasTransients && !lazy.at(res) &&
+        r.info.tiling == VK_IMAGE_TILING_OPTIMAL) {
+      placed.emplace_back(res);
+    }
+  }
+  if (placed.empty()) {
+    return 0;
+  }
+
+  aliasPool.reset(new memory::AliasPool(dev));
+  for (auto res : placed) {
+    auto& r = resources.at(res);
+    if (aliasPool->add(*r.owned, r.first, r.last)) {
+      logE("RenderGraph: resource[%zu] AliasPool::add failed\n", res);
+      return 1;
+    }
+    r.aliased = true;
+    r.placedFirst = r.first;
+    r.placedLast = r.last;
+  }
+  if (aliasPool->alloc()) {
+    logE("RenderGraph: AliasPool::alloc failed\n");
+    return 1;
+  }
+  for (size_t i = 0; i < placed.size(); i++) {
+    for (size_t j = i + 1; j < placed.size(); j++) {
+      if (aliasPool->overlaps(i, j)) {
+        resources.at(placed.at(i)).aliases.emplace_back(placed.at(j));
+        resources.at(placed.at(j)).aliases.emplace_back(placed.at(i));
+      }
+    }
+  }
+  return 0;
+}
+
+void RenderGraph::addBarrier(command::CommandBuffer::BarrierSet& b,
+                             Resource& r, State& s, const Access& a,
+                             bool isWrite) {
+  bool isImage = !r.buf;
+  bool layoutChange = isImage && a.layout != s.layout;
+  VkPipelineStageFlags src = 0;
+  VkAccessFlags srcAccess = 0;
+  if (layoutChange || isWrite) {
+    // Wait for all earlier reads and writes. A read only needs an execution
+    // dependency (write-after-read); an earlier write also needs its memory
+    // made available.
+    src = s.writeStage | s.readStage;
+    srcAccess = s.writeAccess;
+    if (!src && !layoutChange) {
+      // The first write to a resource needs no barrier.
+      s.writeStage = a.stage;
+      s.writeAccess = a.access;
+      return;
+    }
+  } else {
+    // Read-after-read needs no barrier. Read-after-write needs one unless an
+    // earlier barrier since the write already covered this stage and access.
+    if (!s.writeStage || ((a.stage & ~s.readStage) == 0 &&
+                          (a.access & ~s.readAccess) == 0)) {
+      s.readStage |= a.stage;
+      s.readAccess |= a.access;
+      return;
+    }
+    src = s.writeStage;
+    srcAccess = s.writeAccess;
+  }
+
+  b.srcStageMask |= src ? src : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  b.dstStageMask |= a.stage;
+  if (isImage) {
+    auto& img = r.owned ? *r.owned : *r.img;
+    VkImageMemoryBarrier VkInit(imb);
+    imb.srcAccessMask = srcAccess;
+    imb.dstAccessMask = a.access;
+    imb.oldLayout = s.layout;
+    imb.newLayout = a.layout;
+    imb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imb.image = img.vk;
+    imb.subresourceRange = img.getSubresourceRange();
+    b.img.emplace_back(imb);
+  } else if (srcAccess) {
+    VkBufferMemoryBarrier VkInit(bmb);
+    bmb.srcAccessMask = srcAccess;
+    bmb.dstAccessMask = a.access;
+    bmb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bmb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bmb.buffer = r.buf->vk;
+    bmb.offset = 0;
+    bmb.size = VK_WHOLE_SIZE;
+    b.buf.emplace_back(bmb);
+  }
+  // else: write-after-read on a buffer is only an execution dependency.
+
+  s.layout = isImage ? a.layout : s.layout;
+  if (isWrite) {
+    s.writeStage = a.stage;
+    s.writeAccess = a.access;
+    s.readStage = 0;
+    s.readAccess = 0;
+  } else if (layoutChange) {
+    // The layout transition is a write. Later reads in other stages chain
+    // their execution dependency through a.stage.
+    s.writeStage = a.stage;
+    s.writeAccess = 0;
+    s.readStage = a.stage;
+    s.readAccess = a.access;
+  } else {
+    s.readStage |= a.stage;
+    s.readAccess |= a.access;
+  }
+}
+
+int RenderGraph::compile() {
+  cull();
+  if (createTransients()) {
+    return 1;
+  }
+
+  std::vector<State> states(resources.size());
+  for (size_t i = 0; i < resources.size(); i++) {
+    auto& r = resources.at(i);
+    auto& s = states.at(i);
+    s.readStage = 0;
+    s.readAccess = 0;
+    if (r.owned) {
+      // Discard the contents, but wait for the previous execute() to finish
+      // with the image.
+      s.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      s.writeStage = r.endStage;
+      s.writeAccess = r.endAccess;
+      // An alias may have been the last to use the memory.
+      for (auto j : r.aliases) {
+        s.writeStage |= resources.at(j).endStage;
+        s.writeAccess |= resources.at(j).endAccess;
+      }
+    } else {
+      // Nothing is known about how the app used the resource before.
+      s.layout = r.img ? r.img->currentLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+      s.writeStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      s.writeAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+  }
+
+  for (size_t i = 0; i < passes.size(); i++) {
+    auto& p = passes.at(i);
+    p.barriers.reset();
+    p.barriers.srcStageMask = 0;
+    p.barriers.dstStageMask = 0;
+    if (!p.live) {
+      continue;
+    }
+    for (auto& u : p.uses) {
+      auto& r = resources.at(u.res);
+      auto& s = states.at(u.res);
+      if (r.first == i && s.layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+        // Wait for any alias that used the memory earlier in this frame.
+        for (auto j : r.aliases) {
+          if (resources.at(j).last < i) {
+            auto& o = states.at(j);
+            s.writeStage |= o.writeStage | o.readStage;
+            s.writeAccess |= o.writeAccess;
+          }
+        }
+      }
+      addBarrier(p.barriers, r, s, u.a, u.isWrite);
+    }
+  }
+
+  finalBarriers.reset();
+  finalBarriers.srcStageMask = 0;
+  finalBarriers.dstStageMask = 0;
+  for (size_t i = 0; i < resources.size(); i++) {
+    auto& r = resources.at(i);
+    auto& s = states.at(i);
+    r.endLayout = s.layout;
+    r.endStage = s.writeStage | s.readStage;
+    r.endAccess = s.writeAccess;
+    if (r.first == (size_t)-1 || !r.img ||
+        r.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        r.finalLayout == s.layout) {
+      continue;
+    }
+    Access a{VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT,
+             r.finalLayout};
+    addBarrier(finalBarriers, r, s, a, false);
+    r.endLayout = r.finalLayout;
+  }
+  compiled = true;
+  return 0;
+}
+
+int RenderGraph::execute(command::CommandBuffer& cmd) {
+  if (!compiled) {
+    logE("BUG: RenderGraph::execute before compile\n");
+    return 1;
+  }
+  for (auto& p : passes) {
+    if (!p.live) {
+      continue;
+    }
+    if (p.barriers.srcStageMask && cmd.waitBarrier(p.barriers)) {
+      logE("RenderGraph: pass \"%s\" waitBarrier failed\n", p.name.c_str());
+      return 1;
+    }
+    if (p.record(cmd)) {
+      logE("RenderGraph: pass \"%s\" failed\n", p.name.c_str());
+      return 1;
+    }
+  }
+  if (finalBarriers.srcStageMask && cmd.waitBarrier(finalBarriers)) {
+    logE("RenderGraph: final waitBarrier failed\n");
+    return 1;
+  }
+  for (auto& r : resources) {
+    if (r.first == (size_t)-1) {
+      continue;
+    }
+    if (r.owned) {
+      r.owned->currentLayout = r.endLayout;
+    } else if (r.img) {
+      r.img->currentLayout = r.endLayout;
+    }
+  }
+  // The barriers assumed the layouts from before this execute().
+  compiled = false;
+  return 0;
+}
+
+}  // namespace science
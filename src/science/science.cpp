@@ -40,12 +40,22 @@ void ImageCopies::addSingleMipLevel(memory::Image& src, uint32_t srcMipLevel,
 
 SmartCommandBuffer::~SmartCommandBuffer() {
   if (wantAutoSubmit) {
+    // Wait on a fence for just this buffer. vkQueueWaitIdle would also wait
+    // for everything else in the queue.
+    command::Fence fence(cpool.dev);
     if (end()) {
       logF("~SmartCommandBuffer: end failed\n");
     }
-    if (submit(poolQindex)) {
+    if (fence.ctorError(cpool.dev)) {
+      logF("~SmartCommandBuffer: fence.ctorError failed\n");
+    }
+    if (submit(poolQindex, {}, {}, {}, fence.vk)) {
       logF("~SmartCommandBuffer: submit(%zu) failed\n", poolQindex);
     }
+    VkResult v = fence.wait(cpool.dev, std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logF("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+    }
   }
   if (ctorErrorSuccess) {
     if (cpool.unborrowOneTimeBuffer(vk)) {
@@ -53,12 +63,80 @@ SmartCommandBuffer::~SmartCommandBuffer() {
     }
   }
   vk = VK_NULL_HANDLE;
-  if (wantAutoSubmit) {
-    VkResult v = vkQueueWaitIdle(cpool.q(poolQindex));
-    if (v != VK_SUCCESS) {
-      logF("%s failed: %d (%s)\n", "vkQueueWaitIdle", v, string_VkResult(v));
-    }
+}
+
+int SmartCommandBuffer::submitAsync(
+    std::shared_ptr<AsyncSubmit>& done,
+    std::function<void()> onDone /*= nullptr*/,
+    const std::vector<VkSemaphore>& signalSemaphores /*= {}*/,
+    const std::vector<VkSemaphore>& waitSemaphores /*= {}*/,
+    const std::vector<VkPipelineStageFlags>& waitStages /*= {}*/) {
+  if (!ctorErrorSuccess) {
+    logE("SmartCommandBuffer:%s failed\n",
+         " ctorError not called, submitAsync");
+    return 1;
+  }
+  std::shared_ptr<AsyncSubmit> next =
+      std::make_shared<AsyncSubmit>(cpool, onDone);
+  if (end() || next->fence.ctorError(cpool.dev) ||
+      submit(poolQindex, waitSemaphores, waitStages, signalSemaphores,
+             next->fence.vk)) {
+    logE("SmartCommandBuffer::submitAsync(%zu) failed\n", poolQindex);
+    return 1;
+  }
+  // next now owns vk.
+  next->buf = vk;
+  vk = VK_NULL_HANDLE;
+  ctorErrorSuccess = false;
+  wantAutoSubmit = false;
+  done = next;
+  return 0;
+}
+
+AsyncSubmit::~AsyncSubmit() {
+  if (!isDone() && wait()) {
+    logF("~AsyncSubmit: wait failed\n");
+  }
+}
+
+int AsyncSubmit::retire() {
+  if (cpool.unborrowOneTimeBuffer(buf)) {
+    logE("AsyncSubmit: unborrowOneTimeBuffer failed\n");
+    return 1;
+  }
+  buf = VK_NULL_HANDLE;
+  if (onDone) {
+    onDone();
+  }
+  return 0;
+}
+
+int AsyncSubmit::poll() {
+  if (isDone()) {
+    return 0;
+  }
+  VkResult v = fence.getStatus(cpool.dev);
+  switch (v) {
+    case VK_NOT_READY:
+      return 0;
+    case VK_SUCCESS:
+      return retire();
+    default:
+      logE("%s failed: %d (%s)\n", "vkGetFenceStatus", v, string_VkResult(v));
+      return 1;
+  }
+}
+
+int AsyncSubmit::wait() {
+  if (isDone()) {
+    return 0;
+  }
+  VkResult v = fence.wait(cpool.dev, std::numeric_limits<uint64_t>::max());
+  if (v != VK_SUCCESS) {
+    logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+    return 1;
   }
+  return retire();
 }
 
 int PipeBuilder::alphaBlendWithPreviousPass(
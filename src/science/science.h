@@ -11,7 +11,12 @@
 #include <src/language/language.h>
 #include <src/memory/memory.h>
 #include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <limits>
+#include <map>
+#include <thread>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -200,6 +205,124 @@ class PresentSemaphore : public command::Semaphore {
   language::SurfaceSupport queueFamily{language::PRESENT};
 };
 
+// FrameScheduler keeps framesInFlight frames queued on the GPU at once, so the
+// CPU can prepare the next frame while the GPU renders the previous one. Each
+// frame has its own semaphores, fence and command buffer, and the CPU only
+// waits when it wraps around to a frame that is still in flight.
+//
+// Example usage:
+//   science::FrameScheduler sched(container);
+//   if (sched.ctorError()) { ... }
+//   // In the main loop:
+//   uint32_t image_i;
+//   if (sched.acquire(&image_i)) { ... }
+//   if (image_i == (uint32_t)-1) continue;  // swapChain was resized.
+//   // Record sched.frame().cmd using the resources of sched.frameIndex().
+//   if (sched.submitAndPresent(sched.frame().cmd, &image_i)) { ... }
+class FrameScheduler {
+ public:
+  FrameScheduler(CommandPoolContainer& parent) : parent(parent) {}
+  virtual ~FrameScheduler();
+
+  CommandPoolContainer& parent;
+
+  // framesInFlight can be set before ctorError(). More than 2 or 3 only adds
+  // latency.
+  size_t framesInFlight{2};
+
+  // Two-stage constructor: call ctorError() to build the per-frame objects.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // Frame holds the objects used by one frame in flight.
+  struct Frame {
+    Frame(CommandPoolContainer& parent)
+        : imageAvailable(parent.cpool.dev),
+          renderFinished(parent),
+          fence(parent.cpool.dev),
+          cmd(parent.cpool) {}
+
+    command::Semaphore imageAvailable;
+    PresentSemaphore renderFinished;
+    // fence is signalled when the GPU is done with this frame.
+    command::Fence fence;
+    // cmd is a primary command buffer allocated from parent.cpool. It is safe
+    // to re-record cmd after acquire() returns.
+    command::CommandBuffer cmd;
+    // submitted is true if fence will be signalled by a pending submit.
+    bool submitted{false};
+  };
+  std::vector<std::unique_ptr<Frame>> frames;
+
+  // frame returns the current Frame (the one acquire() waited on).
+  Frame& frame() { return *frames.at(frame_i); }
+
+  // frameIndex returns the index of frame() in frames. Use it to select
+  // per-frame resources, such as a uniform buffer for each frame.
+  size_t frameIndex() const { return frame_i; }
+
+  // acquire waits until the current Frame is no longer in use by the GPU,
+  // then calls parent.acquireNextImage(). image_i is set the same way as
+  // CommandPoolContainer::acquireNextImage(): (uint32_t)-1 means the app must
+  // immediately jump to the top of its main loop.
+  WARN_UNUSED_RESULT int acquire(uint32_t* image_i);
+
+  // submitAndPresent submits cmd to the GRAPHICS queue, waiting on
+  // frame().imageAvailable and signalling frame().renderFinished and
+  // frame().fence, then presents image_i and advances to the next Frame.
+  // image_i is set to (uint32_t)-1 as in PresentSemaphore::present().
+  WARN_UNUSED_RESULT int submitAndPresent(command::CommandBuffer& cmd,
+                                          uint32_t* image_i);
+
+  // waitIdle waits until all frames in flight are done.
+  WARN_UNUSED_RESULT int waitIdle();
+
+  // frameNumber counts the frames presented so far.
+  uint32_t frameNumber{0};
+  // lastCpuWait is how long the CPU waited for the GPU in the last acquire().
+  std::chrono::nanoseconds lastCpuWait{0};
+  // totalCpuWait is the sum of lastCpuWait over all frames.
+  std::chrono::nanoseconds totalCpuWait{0};
+
+ protected:
+  size_t frame_i{0};
+  // waitFrame waits for f.fence if f.submitted, then resets it.
+  WARN_UNUSED_RESULT int waitFrame(Frame& f);
+  // freeFrames waits for all frames, then frees each cmd and clears frames.
+  WARN_UNUSED_RESULT int freeFrames();
+};
+
+// AsyncSubmit is the completion handle returned by
+// SmartCommandBuffer::submitAsync(). The borrowed VkCommandBuffer is returned
+// to the CommandPool when the GPU is done with it, which is detected by poll(),
+// wait() or ~AsyncSubmit() (which waits if necessary).
+class AsyncSubmit {
+ public:
+  AsyncSubmit(command::CommandPool& cpool, std::function<void()> onDone)
+      : cpool(cpool), fence(cpool.dev), onDone(onDone) {}
+  AsyncSubmit(const AsyncSubmit&) = delete;
+  virtual ~AsyncSubmit();
+
+  command::CommandPool& cpool;
+  command::Fence fence;
+  // onDone, if set, is called once when the GPU is done.
+  std::function<void()> onDone;
+
+  // isDone returns true after poll() or wait() find that the GPU is done.
+  bool isDone() const { return buf == VK_NULL_HANDLE; }
+
+  // poll checks the fence without blocking. Check isDone() after it returns 0.
+  WARN_UNUSED_RESULT int poll();
+
+  // wait blocks until the GPU is done.
+  WARN_UNUSED_RESULT int wait();
+
+ protected:
+  friend struct SmartCommandBuffer;
+  VkCommandBuffer buf{VK_NULL_HANDLE};
+  // retire returns buf to cpool and calls onDone.
+  WARN_UNUSED_RESULT int retire();
+};
+
 // SmartCommandBuffer builds on top of CommandBuffer with convenience method
 // AutoSubmit()
 typedef struct SmartCommandBuffer : public command::CommandBuffer {
@@ -238,9 +361,9 @@ typedef struct SmartCommandBuffer : public command::CommandBuffer {
   }
 
   // autoSubmit() will set a flag so that ~SmartCommandBuffer() will
-  // "auto-submit" the buffer by calling end(), submit(), and vkQueueWaitIdle.
-  // Automatically submitting a buffer when it goes out of scope is useful for
-  // init commands.
+  // "auto-submit" the buffer by calling end(), submit(), and then waiting for
+  // just this buffer to complete. Automatically submitting a buffer when it
+  // goes out of scope is useful for init commands.
   WARN_UNUSED_RESULT int autoSubmit() {
     if (!ctorErrorSuccess) {
       logE("SmartCommandBuffer:%s failed\n",
@@ -251,6 +374,28 @@ typedef struct SmartCommandBuffer : public command::CommandBuffer {
     return 0;
   }
 
+  // submitAsync calls end() and submit() immediately without waiting. done
+  // is set to a completion handle which owns the borrowed command buffer
+  // until the GPU is done with it. onDone, if set, is called at that time.
+  //
+  // Any resources used by the commands (such as a staging Buffer) must be
+  // kept alive until done->isDone() or onDone is called.
+  //
+  // After submitAsync, this SmartCommandBuffer is empty: autoSubmit() is
+  // cancelled.
+  //
+  // signalSemaphores are signalled when the GPU is done, for another queue.
+  // waitSemaphores are waited on at waitStages before the commands run.
+  WARN_UNUSED_RESULT int submitAsync(
+      std::shared_ptr<AsyncSubmit>& done,
+      std::function<void()> onDone = nullptr,
+      const std::vector<VkSemaphore>& signalSemaphores =
+          std::vector<VkSemaphore>(),
+      const std::vector<VkSemaphore>& waitSemaphores =
+          std::vector<VkSemaphore>(),
+      const std::vector<VkPipelineStageFlags>& waitStages =
+          std::vector<VkPipelineStageFlags>());
+
   const size_t poolQindex{0};
 
  protected:
@@ -258,6 +403,123 @@ typedef struct SmartCommandBuffer : public command::CommandBuffer {
   bool wantAutoSubmit{false};
 } SmartCommandBuffer;
 
+// TransferQueue runs uploads on a dedicated transfer queue family, so large
+// uploads do not compete with rendering on the GRAPHICS queue. Add
+// language::TRANSFER to Instance::optionalSurfaceSupport before
+// Instance::open() to get one. If the Device has no dedicated transfer queue,
+// TransferQueue uses the GRAPHICS queue family instead.
+//
+// Each upload is split in two halves, as Vulkan requires to transfer queue
+// family ownership of an EXCLUSIVE Buffer or Image:
+// 1. copy() records the copy and a "release" barrier on the transfer queue.
+//    submit() then submits all copies and signals a Semaphore.
+// 2. acquire() records the matching "acquire" barriers into the GRAPHICS
+//    command buffer that uses the data, and returns a Handoff. Submit that
+//    command buffer with Handoff::waitSemaphores and Handoff::waitStages.
+//
+// Copying into an EXCLUSIVE Image again after acquire() needs the reverse
+// transfer: the GRAPHICS queue family owns it now. submit() then first
+// submits a "release" barrier on GRAPHICS queue 0 (the queue acquire() is
+// assumed to be used on), and the transfer queue waits for it and acquires
+// the Image, keeping its contents. Call submit() after the GRAPHICS work that
+// uses the Image has been submitted.
+//
+// Example usage:
+//   science::TransferQueue xfer(dev);
+//   if (xfer.ctorError()) { ... }
+//   if (xfer.copy(texture, staging, regions) || xfer.submit()) { ... }
+//   // later, while recording a GRAPHICS command buffer:
+//   std::shared_ptr<science::TransferQueue::Handoff> handoff;
+//   if (xfer.acquire(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, handoff) ||
+//       cmd.end() || cmd.submit(0, handoff->waitSemaphores,
+//                               handoff->waitStages, {}, fence.vk)) { ... }
+//   // Keep handoff until fence has signalled.
+class TransferQueue {
+ public:
+  TransferQueue(language::Device& dev) : dev(dev), cpool(dev), gpool(dev) {}
+  virtual ~TransferQueue();
+
+  language::Device& dev;
+  // cpool allocates command buffers on the transfer queue family.
+  command::CommandPool cpool;
+  // gpool allocates command buffers on the GRAPHICS queue family to give
+  // Images back to the transfer queue. It is only used if isDedicated().
+  command::CommandPool gpool;
+
+  // Two-stage constructor: call ctorError() after Instance::open().
+  WARN_UNUSED_RESULT int ctorError();
+
+  // isDedicated returns true if the Device has a dedicated transfer queue.
+  bool isDedicated() const { return transferFamily != graphicsFamily; }
+
+  // copy records a copy of all of src into dst. dstAccess describes how dst
+  // will be used on the GRAPHICS queue.
+  WARN_UNUSED_RESULT int copy(
+      memory::Buffer& dst, memory::Buffer& src,
+      VkAccessFlags dstAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_UNIFORM_READ_BIT);
+
+  // copy records a copy of src into dst using regions. dst is left in
+  // finalLayout. dstAccess describes how dst will be used on the GRAPHICS
+  // queue.
+  WARN_UNUSED_RESULT int copy(
+      memory::Image& dst, memory::Buffer& src,
+      const std::vector<VkBufferImageCopy>& regions,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT);
+
+  // submit submits all copies recorded since the last submit(). src Buffers
+  // must be kept alive until the Handoff from acquire() is released.
+  WARN_UNUSED_RESULT int submit();
+
+  // Handoff holds what the GRAPHICS queue needs to safely use the data. Keep
+  // it until the GRAPHICS submit that waits on waitSemaphores is done.
+  struct Handoff {
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<std::unique_ptr<command::Semaphore>> semaphores;
+    std::vector<std::shared_ptr<AsyncSubmit>> done;
+  };
+
+  // acquire records the acquire barriers for everything submitted since the
+  // last acquire() into cmd, a GRAPHICS command buffer. dstStage is the
+  // earliest pipeline stage that will use the data.
+  WARN_UNUSED_RESULT int acquire(command::CommandBuffer& cmd,
+                                 VkPipelineStageFlags dstStage,
+                                 std::shared_ptr<Handoff>& handoff);
+
+  uint32_t transferFamily{0};
+  uint32_t graphicsFamily{0};
+
+ protected:
+  // Batch is the copies recorded between two calls to submit().
+  struct Batch {
+    std::unique_ptr<SmartCommandBuffer> cmd;
+    std::unique_ptr<command::Semaphore> semaphore;
+    std::shared_ptr<AsyncSubmit> done;
+    command::CommandBuffer::BarrierSet release;
+    command::CommandBuffer::BarrierSet acquire;
+    // reclaim releases Images from the GRAPHICS queue family to the transfer
+    // queue family. It is submitted on gpool before cmd, which waits for
+    // reclaimSemaphore.
+    command::CommandBuffer::BarrierSet reclaim;
+    std::unique_ptr<command::Semaphore> reclaimSemaphore;
+    std::shared_ptr<AsyncSubmit> reclaimDone;
+  };
+  std::unique_ptr<Batch> recording;
+  std::vector<std::unique_ptr<Batch>> submitted;
+
+  // getRecording returns recording, creating it if needed.
+  Batch* getRecording();
+  // toTransferDst transitions dst to TRANSFER_DST_OPTIMAL in b using only
+  // stages a transfer-only queue supports. If the GRAPHICS queue family owns
+  // dst, it also adds the matching release barrier to b.reclaim.
+  WARN_UNUSED_RESULT int toTransferDst(Batch& b, memory::Image& dst);
+  // submitReclaim submits b.reclaim on gpool and signals b.reclaimSemaphore.
+  WARN_UNUSED_RESULT int submitReclaim(Batch& b);
+};
+
 // PipeBuilder is a builder for command::Pipeline.
 // PipeBuilder immediately installs a new command::Pipeline in the
 // command::RenderPass it gets in its constructor, so instantiating a
@@ -354,6 +616,580 @@ typedef struct PipeBuilder {
   std::vector<VkVertexInputAttributeDescription> attributeInputs;
 } PipeBuilder;
 
+// ParallelRecorder records secondary command buffers on several worker threads
+// at once. Each worker thread has its own CommandPool for each frame in
+// flight, so the workers never contend for a CommandPool::lockmutex. Each
+// pool's owner is its worker thread, so a Job can record through a lock-free
+// command::CommandBuffer::RecordingScope.
+//
+// Example usage:
+//   science::ParallelRecorder rec(dev);
+//   if (rec.ctorError()) { ... }
+//   // In the main loop:
+//   if (primary.beginOneTimeUse() ||
+//       primary.beginSecondaryPass(pass, framebuf) ||
+//       rec.record(frame_i, primary, pass, 0, framebuf, objects.size(),
+//                  [&](command::CommandBuffer& buf, size_t job_i) -> int {
+//                    return buf.draw(...);
+//                  }) ||
+//       primary.endRenderPass() || primary.end() ||
+//       primary.submit(0, ..., rec.fence(frame_i).vk)) { ... }
+//
+// The CommandPools of frame_i are reset (recycling all their command buffers)
+// the next time record() is called with frame_i, after fence(frame_i) signals.
+// ~ParallelRecorder also waits for fence(frame_i), so once record() succeeds
+// either submit primary with fence(frame_i) or call cancel(frame_i). A fence
+// that was never submitted never signals: the wait then fails after
+// fenceTimeout instead of blocking forever.
+class ParallelRecorder {
+ public:
+  ParallelRecorder(language::Device& dev) : dev(dev) {}
+  virtual ~ParallelRecorder();
+
+  language::Device& dev;
+
+  // nThreads can be set before ctorError(). 0 means use one thread per CPU.
+  size_t nThreads{0};
+  // framesInFlight can be set before ctorError().
+  size_t framesInFlight{2};
+  // queueFamily can be set before ctorError(). It must match the queueFamily
+  // of the primary command buffers.
+  language::SurfaceSupport queueFamily{language::GRAPHICS};
+  // fenceTimeout is how many nanoseconds record() and ~ParallelRecorder wait
+  // for fence(frame_i) before deciding it was never submitted.
+  uint64_t fenceTimeout{10000000000ull};
+
+  // Two-stage constructor: call ctorError() to build the CommandPools and
+  // start the worker threads.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // Job records the commands of job_i into buf. buf has already been begun
+  // with beginSecondary() and will be ended after Job returns.
+  // Job is called from a worker thread. Return non-zero to signal an error.
+  typedef std::function<int(command::CommandBuffer& buf, size_t job_i)> Job;
+
+  // record runs job jobCount times in parallel, each time in a new secondary
+  // command buffer, then calls primary.executeCommands() with all of the
+  // secondary command buffers in order of job_i.
+  //
+  // primary must already be inside subpass of pass using
+  // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+  //
+  // If record() succeeds, primary must be submitted with fence(frame_i), or
+  // cancel(frame_i) must be called.
+  WARN_UNUSED_RESULT int record(size_t frame_i, command::CommandBuffer& primary,
+                                command::RenderPass& pass, uint32_t subpass,
+                                language::Framebuf& framebuf, size_t jobCount,
+                                Job job);
+
+  // fence returns the Fence that the primary command buffer for frame_i must
+  // signal when it is submitted.
+  command::Fence& fence(size_t frame_i) { return *frames.at(frame_i).fence; }
+
+  // cancel tells ParallelRecorder that the primary command buffer passed to
+  // record() for frame_i will not be submitted, for example because
+  // primary.end() failed. It resets the CommandPools of frame_i without
+  // waiting for fence(frame_i). primary must be reset or discarded, since it
+  // refers to the secondary command buffers that were freed.
+  WARN_UNUSED_RESULT int cancel(size_t frame_i);
+
+ protected:
+  struct PerThread {
+    std::unique_ptr<command::CommandPool> pool;
+    std::vector<command::CommandBuffer> bufs;
+    size_t used{0};
+  };
+  struct Frame {
+    std::vector<PerThread> threads;
+    std::unique_ptr<command::Fence> fence;
+    // fenceInUse is set when record() has handed out fence.
+    bool fenceInUse{false};
+  };
+  std::vector<Frame> frames;
+
+  // recycle waits for frame.fence, then resets all its CommandPools.
+  WARN_UNUSED_RESULT int recycle(Frame& frame);
+  // waitFence waits up to fenceTimeout for frame.fence.
+  WARN_UNUSED_RESULT int waitFence(Frame& frame);
+
+  // runOnWorkers calls fn(thread_i) once on every worker thread and waits.
+  void runOnWorkers(std::function<void(size_t thread_i)> fn);
+  void workerMain(size_t thread_i);
+
+  std::vector<std::thread> workers;
+  std::mutex workerMutex;
+  std::condition_variable workerWake;
+  std::condition_variable workerDone;
+  std::function<void(size_t thread_i)> workerFn;
+  size_t workerGeneration{0};
+  size_t workersRunning{0};
+  bool workerQuit{false};
+};
+
+// RenderGraph records a frame as a list of passes. Each pass declares the
+// images and buffers it reads and writes. compile() then:
+// * culls passes whose results are never used,
+// * creates the transient images declared with createImage(), and
+// * computes one batched vkCmdPipelineBarrier per pass with the minimal
+//   stages, access masks and layout transitions.
+// execute() records the barriers and calls each pass.
+//
+// Example usage:
+//   science::RenderGraph graph(dev);
+//   auto gbuf = graph.createImage(gbufInfo);
+//   auto back = graph.importImage(*swapImage, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+//   auto p = graph.addPass("gbuffer", [&](command::CommandBuffer& cmd) {
+//     return cmd.beginRenderPass(...) || ... || cmd.endRenderPass();
+//   });
+//   if (graph.write(p, gbuf, RenderGraph::colorAttachment())) { ... }
+//   p = graph.addPass("light", ...);
+//   if (graph.read(p, gbuf, RenderGraph::sampled()) ||
+//       graph.write(p, back, RenderGraph::colorAttachment()) ||
+//       graph.compile() || graph.execute(cmd)) { ... }
+//   // Next frame: call graph.rebindImage(back, *nextSwapImage), then
+//   // graph.compile() and graph.execute() again.
+//
+// A pass that uses a command::RenderPass must give each attachment the same
+// initialLayout and finalLayout as the layout it declared here: the graph,
+// not the RenderPass, does the layout transitions.
+class RenderGraph {
+ public:
+  RenderGraph(language::Device& dev) : dev(dev) {}
+
+  language::Device& dev;
+
+  // Access describes how a pass uses a resource.
+  typedef struct Access {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    // layout is ignored for a buffer.
+    VkImageLayout layout;
+  } Access;
+
+  static Access colorAttachment() {
+    return Access{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  }
+  static Access depthAttachment() {
+    return Access{VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                  VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  }
+  static Access sampled(VkPipelineStageFlags stage =
+                            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+    return Access{stage, VK_ACCESS_SHADER_READ_BIT,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  }
+  static Access storage(VkPipelineStageFlags stage =
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) {
+    return Access{stage, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_IMAGE_LAYOUT_GENERAL};
+  }
+  static Access uniform(VkPipelineStageFlags stage =
+                            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT) {
+    return Access{stage, VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+  }
+  static Access vertexInput() {
+    return Access{VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                      VK_ACCESS_INDEX_READ_BIT,
+                  VK_IMAGE_LAYOUT_UNDEFINED};
+  }
+  static Access indirect() {
+    return Access{VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                  VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                  VK_IMAGE_LAYOUT_UNDEFINED};
+  }
+  static Access transferSrc() {
+    return Access{VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+  }
+  static Access transferDst() {
+    return Access{VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+  }
+
+  // importImage adds an Image owned by the app. Its currentLayout is used as
+  // the starting layout, and is updated by execute(). If finalLayout is not
+  // VK_IMAGE_LAYOUT_UNDEFINED, execute() leaves the image in finalLayout and
+  // the image is never culled (e.g. a swapChain image).
+  size_t importImage(memory::Image& img,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+  // importBuffer adds a Buffer owned by the app. If keep is true, passes that
+  // write to it are never culled.
+  size_t importBuffer(memory::Buffer& buf, bool keep = false);
+
+  // createImage adds a transient image that compile() creates if any pass
+  // that is not culled uses it. info.usage is filled in from the declared
+  // accesses; info.initialLayout is ignored. Its contents are undefined at
+  // the start of each execute(). The image is kept across compile() calls,
+  // unless a new access needs more usage bits or its lifetime grows past
+  // where aliasTransients placed it: then it is recreated, so the GPU must
+  // not be using it.
+  //
+  // An image only used as an attachment by a single pass is created with
+  // memory::Image::ctorTransient(). The pass should use
+  // VK_ATTACHMENT_STORE_OP_DONT_CARE for it.
+  size_t createImage(const VkImageCreateInfo& info);
+
+  // aliasTransients places transient images in a memory::AliasPool, so
+  // images whose passes do not overlap share memory. Set it before compile().
+  bool aliasTransients{true};
+
+  // image returns the memory::Image for res. A transient image is only valid
+  // after compile().
+  memory::Image& image(size_t res);
+
+  // Record is called by execute() to record a pass.
+  typedef std::function<int(command::CommandBuffer& cmd)> Record;
+
+  // addPass adds a pass, which will be recorded in the order it was added.
+  // If keep is true the pass is never culled.
+  size_t addPass(const char* name, Record record, bool keep = false);
+
+  // read declares that pass reads res.
+  WARN_UNUSED_RESULT int read(size_t pass, size_t res, const Access& a) {
+    return use(pass, res, a, false);
+  }
+  // write declares that pass writes res (including read-modify-write).
+  WARN_UNUSED_RESULT int write(size_t pass, size_t res, const Access& a) {
+    return use(pass, res, a, true);
+  }
+
+  // compile culls passes, creates transient images and computes barriers.
+  // The barriers start from each imported image's currentLayout, so compile()
+  // must be called again before every execute().
+  WARN_UNUSED_RESULT int compile();
+
+  // execute records all live passes and their barriers into cmd. It updates
+  // the currentLayout of the images, so the next execute() needs a compile().
+  WARN_UNUSED_RESULT int execute(command::CommandBuffer& cmd);
+
+  // clearPasses removes all passes, ready to build the next frame. Resources
+  // and transient images are kept.
+  void clearPasses() {
+    passes.clear();
+    compiled = false;
+  }
+
+  // rebindImage replaces the Image of a resource added by importImage(), e.g.
+  // to use the next swapChain image without adding a new resource.
+  WARN_UNUSED_RESULT int rebindImage(size_t res, memory::Image& img);
+
+  // clearResources removes all passes and resources and destroys the
+  // transient images, so the GPU must not be using them. Any resource index
+  // is invalid after this.
+  void clearResources();
+
+  // isCulled returns true if compile() culled pass.
+  bool isCulled(size_t pass) const { return !passes.at(pass).live; }
+
+ protected:
+  typedef struct Use {
+    size_t res;
+    Access a;
+    bool isWrite;
+  } Use;
+
+  typedef struct Pass {
+    std::string name;
+    Record record;
+    std::vector<Use> uses;
+    bool keep;
+    bool live{false};
+    command::CommandBuffer::BarrierSet barriers;
+  } Pass;
+
+  typedef struct Resource {
+    memory::Image* img{nullptr};
+    memory::Buffer* buf{nullptr};
+    // owned is set for a transient image.
+    std::unique_ptr<memory::Image> owned;
+    VkImageCreateInfo info;
+    VkImageLayout finalLayout{VK_IMAGE_LAYOUT_UNDEFINED};
+    bool keep{false};
+    // first and last are the first and last live pass that use this.
+    size_t first{(size_t)-1};
+    size_t last{(size_t)-1};
+    // endLayout, endStage and endAccess are the state after execute().
+    VkImageLayout endLayout{VK_IMAGE_LAYOUT_UNDEFINED};
+    VkPipelineStageFlags endStage{0};
+    VkAccessFlags endAccess{0};
+    // lazy is set if owned was created with ctorTransient().
+    bool lazy{false};
+    // aliased is set if owned is bound to aliasPool. placedFirst and
+    // placedLast are the lifetime it was placed with.
+    bool aliased{false};
+    size_t placedFirst{0};
+    size_t placedLast{0};
+    // aliases are the resources that share memory with this one.
+    std::vector<size_t> aliases;
+  } Resource;
+
+  // State tracks a resource's pending accesses while computing barriers.
+  typedef struct State {
+    VkImageLayout layout;
+    VkPipelineStageFlags writeStage;
+    VkAccessFlags writeAccess;
+    // readStage accumulates all reads since the last write.
+    VkPipelineStageFlags readStage;
+    VkAccessFlags readAccess;
+  } State;
+
+  WARN_UNUSED_RESULT int use(size_t pass, size_t res, const Access& a,
+                             bool isWrite);
+  void cull();
+  WARN_UNUSED_RESULT int createTransients();
+  WARN_UNUSED_RESULT int newTransient(Resource& r, VkImageUsageFlags usage,
+                                      bool lazy);
+  WARN_UNUSED_RESULT int placeTransients(
+      const std::vector<VkImageUsageFlags>& usage,
+      const std::vector<bool>& lazy, const std::vector<bool>& place);
+  void addBarrier(command::CommandBuffer::BarrierSet& b, Resource& r,
+                  State& s, const Access& a, bool isWrite);
+
+  std::vector<Pass> passes;
+  std::vector<Resource> resources;
+  // finalBarriers transition imported images to their finalLayout.
+  command::CommandBuffer::BarrierSet finalBarriers;
+  bool compiled{false};
+  std::unique_ptr<memory::AliasPool> aliasPool;
+};
+
+// GpuProfiler measures how long the GPU spends in named scopes using
+// vkCmdWriteTimestamp. Scopes nest, and each command buffer has its own stack
+// of scopes, so several command buffers can be profiled in the same frame
+// (even from different threads).
+//
+// Each frame in flight has its own VkQueryPool. The results of frame_i are
+// read back the next time beginFrame(frame_i) is called, when the app has
+// already waited for frame_i's fence, so reading them never stalls.
+//
+// Example usage:
+//   science::GpuProfiler prof(dev);
+//   if (prof.ctorError()) { ... }
+//   // In the main loop, after waiting for the fence of frame_i:
+//   if (cmd.beginOneTimeUse() || prof.beginFrame(frame_i, cmd) ||
+//       prof.begin(cmd, "shadows") || drawShadows(cmd) || prof.end(cmd) ||
+//       ...) { ... }
+//   for (auto& s : prof.results) {
+//     logI("%s: %lld ns\n", s.name.c_str(), (long long)s.duration.count());
+//   }
+class GpuProfiler {
+ public:
+  GpuProfiler(language::Device& dev) : dev(dev) {}
+
+  language::Device& dev;
+
+  // framesInFlight can be set before ctorError().
+  size_t framesInFlight{2};
+  // maxScopes is the number of scopes per frame. It can be set before
+  // ctorError().
+  uint32_t maxScopes{256};
+  // queueFamily can be set before ctorError(). It must match the queue the
+  // profiled command buffers are submitted to.
+  language::SurfaceSupport queueFamily{language::GRAPHICS};
+
+  // Two-stage constructor: call ctorError() to build the VkQueryPools.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // beginFrame collects the results of the previous frame that used frame_i,
+  // then resets frame_i's queries in cmd. cmd must be outside a RenderPass
+  // and must be submitted before any command buffer that uses begin() in
+  // this frame.
+  WARN_UNUSED_RESULT int beginFrame(size_t frame_i,
+                                    command::CommandBuffer& cmd);
+
+  // begin starts a scope named name in cmd. If the frame runs out of
+  // maxScopes, the scope is silently not measured.
+  WARN_UNUSED_RESULT int begin(
+      command::CommandBuffer& cmd, const char* name,
+      VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+  // end ends the innermost scope that is open in cmd.
+  WARN_UNUSED_RESULT int end(
+      command::CommandBuffer& cmd,
+      VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+  typedef struct Scope {
+    std::string name;
+    // depth is 0 for a scope that is not inside another scope.
+    size_t depth;
+    // lane is the order in which the scope's command buffer first called
+    // begin() in its frame.
+    size_t lane;
+    // frame is the frame number, counted by beginFrame().
+    uint64_t frame;
+    // start is relative to the earliest timestamp in the first frame
+    // GpuProfiler read back.
+    std::chrono::nanoseconds start;
+    std::chrono::nanoseconds duration;
+  } Scope;
+
+  // results are the scopes of the last frame collected by beginFrame(), in
+  // the order begin() was called. A scope whose timestamps were not yet
+  // available is left out.
+  std::vector<Scope> results;
+
+  // traceLimit is how many Scopes to keep for chromeTrace(). 0 disables.
+  size_t traceLimit{0};
+  // trace accumulates results until it has traceLimit Scopes.
+  std::vector<Scope> trace;
+
+  // chromeTrace formats trace as JSON for chrome://tracing.
+  std::string chromeTrace() const;
+
+  // writeChromeTrace writes chromeTrace() to filename.
+  WARN_UNUSED_RESULT int writeChromeTrace(const char* filename) const;
+
+ protected:
+  typedef struct Pending {
+    std::string name;
+    size_t depth;
+    size_t lane;
+    // query is the begin timestamp. query + 1 is the end timestamp.
+    uint32_t query;
+  } Pending;
+
+  typedef struct Frame {
+    Frame(language::Device& dev) : pool{dev} {}
+
+    command::QueryPool pool;
+    std::vector<Pending> scopes;
+    uint32_t used{0};
+    uint64_t frame{0};
+  } Frame;
+
+  // collect reads back f's timestamps without waiting and sets results.
+  WARN_UNUSED_RESULT int collect(Frame& f);
+
+  std::vector<Frame> frames;
+  size_t cur{(size_t)-1};
+  uint64_t frameCount{0};
+  // open is the stack of open scopes (indices into Frame::scopes) per
+  // command buffer.
+  std::map<VkCommandBuffer, std::vector<size_t>> open;
+  std::map<VkCommandBuffer, size_t> lanes;
+  // nsPerTick is VkPhysicalDeviceLimits::timestampPeriod.
+  double nsPerTick{1};
+  // tickMask removes the bits above the queue's timestampValidBits.
+  uint64_t tickMask{~0ull};
+  uint64_t epoch{0};
+  bool haveEpoch{false};
+  std::mutex lockmutex;
+};
+
+// QueryRing collects occlusion or pipeline statistics queries without
+// stalling the CPU. Each frame in flight has its own command::QueryPool and
+// its own region of buf, a persistently mapped host-coherent Buffer.
+// endFrame() records vkCmdCopyQueryPoolResults into that region, and the
+// values are read the next time beginFrame() is called with the same frame_i,
+// after the app has waited on that frame's fence.
+//
+// Example usage:
+//   science::QueryRing occ(dev);  // VK_QUERY_TYPE_OCCLUSION by default.
+//   if (occ.ctorError()) { ... }
+//   // In the main loop, after waiting for the fence of frame_i:
+//   if (cmd.beginOneTimeUse() || occ.beginFrame(frame_i, cmd) ||
+//       cmd.beginRenderPass(...)) { ... }
+//   for (size_t i = 0; i < objects.size(); i++) {
+//     if (occ.begin(cmd, i) || drawBoundingBox(cmd, i) || occ.end(cmd)) {
+//       ...
+//     }
+//   }
+//   if (cmd.endRenderPass() || occ.endFrame(cmd) || cmd.end() || ...) { ... }
+//   for (auto& r : occ.results) {
+//     visible.at(r.id) = r.values.at(0) != 0;
+//   }
+class QueryRing {
+ public:
+  QueryRing(language::Device& dev) : dev(dev), buf(dev) {}
+
+  language::Device& dev;
+
+  // type can be set before ctorError(). VK_QUERY_TYPE_TIMESTAMP is not
+  // supported: see GpuProfiler.
+  VkQueryType type{VK_QUERY_TYPE_OCCLUSION};
+  // pipelineStatistics can be set before ctorError(). It is only used if type
+  // is VK_QUERY_TYPE_PIPELINE_STATISTICS.
+  VkQueryPipelineStatisticFlags pipelineStatistics{
+      VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT};
+  // controlFlags is passed to beginQuery(). Set VK_QUERY_CONTROL_PRECISE_BIT
+  // for exact occlusion sample counts (requires occlusionQueryPrecise).
+  VkQueryControlFlags controlFlags{0};
+  // framesInFlight can be set before ctorError().
+  size_t framesInFlight{2};
+  // maxQueries is the number of queries per frame. It can be set before
+  // ctorError().
+  uint32_t maxQueries{256};
+
+  // Two-stage constructor: call ctorError() to build the QueryPools and buf.
+  WARN_UNUSED_RESULT int ctorError();
+
+  // beginFrame reads the values of the previous frame that used frame_i into
+  // results, then resets frame_i's queries in cmd. cmd must be outside a
+  // RenderPass.
+  WARN_UNUSED_RESULT int beginFrame(size_t frame_i,
+                                    command::CommandBuffer& cmd);
+
+  // begin starts a query in cmd. id is chosen by the app and is reported in
+  // results. Only one query can be active in a command buffer at a time.
+  WARN_UNUSED_RESULT int begin(command::CommandBuffer& cmd, size_t id);
+
+  // end ends the query that is active in cmd.
+  WARN_UNUSED_RESULT int end(command::CommandBuffer& cmd);
+
+  // endFrame copies this frame's results into buf. cmd must be outside a
+  // RenderPass and must be submitted after all the queries in this frame.
+  // Every begin() must have a matching end() first, or endFrame fails.
+  WARN_UNUSED_RESULT int endFrame(command::CommandBuffer& cmd);
+
+  typedef struct Result {
+    size_t id;
+    // frame is the frame number, counted by beginFrame().
+    uint64_t frame;
+    // values has QueryPool::valuesPerQuery() values.
+    std::vector<uint64_t> values;
+  } Result;
+
+  // results are the queries of the last frame collected by beginFrame(), in
+  // the order begin() was called.
+  std::vector<Result> results;
+
+  // statistic returns the value of bit from r, or 0 if bit was not queried.
+  uint64_t statistic(const Result& r,
+                     VkQueryPipelineStatisticFlagBits bit) const;
+
+  // buf receives the query results.
+  memory::Buffer buf;
+
+ protected:
+  typedef struct Frame {
+    std::unique_ptr<command::QueryPool> pool;
+    std::vector<size_t> ids;
+    uint64_t frame{0};
+    // copied is set when endFrame() recorded the copy into buf.
+    bool copied{false};
+  } Frame;
+
+  std::vector<Frame> frames;
+  size_t cur{(size_t)-1};
+  uint64_t frameCount{0};
+  // stride is the bytes used by one query in buf.
+  VkDeviceSize stride{0};
+  char* mapped{nullptr};
+  // active is the query that is active in each command buffer.
+  std::map<VkCommandBuffer, uint32_t> active;
+  std::mutex lockmutex;
+};
+
 #ifdef USE_SPIRV_CROSS_REFLECTION
 
 // DescriptorLibrary is the DescriptorSet objects and DescriptorPool they are
@@ -364,6 +1200,14 @@ class DescriptorLibrary {
 
   std::vector<memory::DescriptorSetLayout> layouts;
 
+#ifndef __ANDROID__
+  // templates.at(layoutI) updates a DescriptorSet from makeSet(layoutI) in
+  // one call. templates is only populated if the Device supports Vulkan 1.1.
+  // (A template for a layout with a runtime array needs data for every array
+  // element. Use DescriptorWriter to update only some elements.)
+  std::vector<memory::DescriptorUpdateTemplate> templates;
+#endif /* __ANDROID__ */
+
   // makeSet creates a new DescriptorSet from layouts[layoutI].
   // Use the layoutI the shader declared with "layout(set = layoutI)".
   //
@@ -405,6 +1249,22 @@ class ShaderLibrary {
   // descriptor pool for multiple copies of the types found by reflection.
   size_t descriptorSetMaxCopies{1};
 
+  // runtimeArrayCount is the descriptorCount given to a runtime array, e.g.
+  //   layout(set = 0, binding = 0) uniform sampler2D textures[];
+  // A runtime array needs VK_EXT_descriptor_indexing: add it to
+  // dev.requiredExtensions and set enabledFeatures.descriptorIndexing
+  // .runtimeDescriptorArray before open(). If descriptorBindingPartiallyBound
+  // and the *UpdateAfterBind features are also enabled, the binding uses them
+  // and makeDescriptorLibrary creates an UPDATE_AFTER_BIND pool. Use
+  // memory::DescriptorIndexAllocator to hand out the array elements.
+  uint32_t runtimeArrayCount{4096};
+
+  // dynamicBuffers lists the (set, binding) pairs that makeDescriptorLibrary
+  // should turn into VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC (or
+  // STORAGE_BUFFER_DYNAMIC). SPIR-V does not say whether a buffer is dynamic,
+  // so the app must list them. See memory::UniformArena.
+  std::set<std::pair<uint32_t, uint32_t>> dynamicBuffers;
+
   // load creates and calls loadSPV() on a Shader. If loadSPV() fails, it
   // returns an empty shared_ptr.
   std::shared_ptr<command::Shader> load(const uint32_t* spvBegin, size_t len);
@@ -446,6 +1306,11 @@ class ShaderLibrary {
                                std::shared_ptr<command::Shader> shader,
                                std::string entryPointName = "main");
 
+  // stage puts a compute shader into a ComputePipeline.
+  WARN_UNUSED_RESULT int stage(command::ComputePipeline& pipe,
+                               std::shared_ptr<command::Shader> shader,
+                               std::string entryPointName = "main");
+
   // makeDescriptorLibrary inits a DescriptorLibrary to the ShaderLibrary and
   // inits its layouts from the layouts in the shaders in ShaderLibrary.
   //
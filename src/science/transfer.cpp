@@ -0,0 +1,263 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * TransferQueue uploads on a dedicated transfer queue family.
+ */
+#include "science.h"
+
+namespace science {
+
+TransferQueue::~TransferQueue() {}
+
+int TransferQueue::ctorError() {
+  auto g = dev.getQfamI(language::GRAPHICS);
+  if (g == (decltype(g))(-1)) {
+    logE("TransferQueue::ctorError: no GRAPHICS queue family\n");
+    return 1;
+  }
+  graphicsFamily = g;
+  transferFamily = g;
+  cpool.queueFamily = language::GRAPHICS;
+  for (size_t i = 0; i < dev.qfams.size(); i++) {
+    auto& fam = dev.qfams.at(i);
+    if (fam.isDedicatedTransfer() && fam.queues.size()) {
+      transferFamily = i;
+      cpool.queueFamily = language::TRANSFER;
+      break;
+    }
+  }
+  if (cpool.ctorError()) {
+    logE("TransferQueue::ctorError: cpool failed\n");
+    return 1;
+  }
+  if (isDedicated()) {
+    gpool.queueFamily = language::GRAPHICS;
+    if (gpool.ctorError()) {
+      logE("TransferQueue::ctorError: gpool failed\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+TransferQueue::Batch* TransferQueue::getRecording() {
+  if (recording) {
+    return recording.get();
+  }
+  std::unique_ptr<Batch> b(new Batch());
+  b->cmd.reset(new SmartCommandBuffer(cpool, memory::ASSUME_POOL_QINDEX));
+  if (b->cmd->ctorError()) {
+    logE("TransferQueue: SmartCommandBuffer failed\n");
+    return nullptr;
+  }
+  b->release.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  b->release.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  b->reclaim.srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  b->reclaim.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  recording = std::move(b);
+  return recording.get();
+}
+
+int TransferQueue::copy(memory::Buffer& dst, memory::Buffer& src,
+                        VkAccessFlags dstAccess) {
+  auto b = getRecording();
+  if (!b || dst.copy(*b->cmd, src)) {
+    return 1;
+  }
+  VkBufferMemoryBarrier VkInit(bmb);
+  bmb.buffer = dst.vk;
+  bmb.offset = 0;
+  bmb.size = VK_WHOLE_SIZE;
+  bmb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  bmb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  if (!isDedicated()) {
+    // Same queue: a plain memory barrier in the GRAPHICS command buffer.
+    bmb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bmb.dstAccessMask = dstAccess;
+    b->acquire.buf.emplace_back(bmb);
+    return 0;
+  }
+  if (dst.info.sharingMode != VK_SHARING_MODE_EXCLUSIVE) {
+    // The semaphore is enough: there is no ownership to transfer.
+    return 0;
+  }
+  bmb.srcQueueFamilyIndex = transferFamily;
+  bmb.dstQueueFamilyIndex = graphicsFamily;
+  bmb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  bmb.dstAccessMask = 0;
+  b->release.buf.emplace_back(bmb);
+  bmb.srcAccessMask = 0;
+  bmb.dstAccessMask = dstAccess;
+  b->acquire.buf.emplace_back(bmb);
+  return 0;
+}
+
+int TransferQueue::toTransferDst(Batch& b, memory::Image& dst) {
+  if (!isDedicated()) {
+    return b.cmd->barrier(dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  }
+  // An Image that is not UNDEFINED or PREINITIALIZED has been used on a
+  // queue. acquire() gave it to the GRAPHICS queue family, which must release
+  // it first or the layout transition and contents are undefined.
+  bool reclaim = dst.info.sharingMode == VK_SHARING_MODE_EXCLUSIVE &&
+                 dst.currentLayout != VK_IMAGE_LAYOUT_UNDEFINED &&
+                 dst.currentLayout != VK_IMAGE_LAYOUT_PREINITIALIZED;
+  if (!reclaim && dst.currentLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    return 0;
+  }
+  // A transfer-only queue only supports the TRANSFER, TOP_OF_PIPE and
+  // BOTTOM_OF_PIPE stages. The lazy barrier() would pick a stage from the
+  // old layout, such as FRAGMENT_SHADER, so build the barrier here. Earlier
+  // uses of dst were on another queue and are ordered by a semaphore.
+  command::CommandBuffer::BarrierSet toDst;
+  toDst.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  toDst.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  toDst.img.emplace_back(
+      dst.makeTransition(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+  auto& imb = toDst.img.back();
+  if (!imb.image) {
+    logE("TransferQueue: makeTransition failed\n");
+    return 1;
+  }
+  imb.subresourceRange = dst.getSubresourceRange();
+  imb.srcAccessMask = 0;
+  imb.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  if (reclaim) {
+    imb.srcQueueFamilyIndex = graphicsFamily;
+    imb.dstQueueFamilyIndex = transferFamily;
+    b.reclaim.img.emplace_back(imb);
+    auto& rel = b.reclaim.img.back();
+    rel.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    rel.dstAccessMask = 0;
+    // submit() waits for reclaimSemaphore at the TRANSFER stage. Start the
+    // acquire barrier there too, so it runs after the release.
+    toDst.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  }
+  dst.currentLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  return b.cmd->waitBarrier(toDst);
+}
+
+int TransferQueue::submitReclaim(Batch& b) {
+  SmartCommandBuffer g(gpool, memory::ASSUME_POOL_QINDEX);
+  b.reclaimSemaphore.reset(new command::Semaphore(dev));
+  if (g.ctorError() || g.waitBarrier(b.reclaim) ||
+      b.reclaimSemaphore->ctorError(dev)) {
+    logE("TransferQueue::submit: reclaim barrier failed\n");
+    return 1;
+  }
+  if (g.submitAsync(b.reclaimDone, nullptr, {b.reclaimSemaphore->vk})) {
+    logE("TransferQueue::submit: reclaim submitAsync failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+int TransferQueue::copy(memory::Image& dst, memory::Buffer& src,
+                        const std::vector<VkBufferImageCopy>& regions,
+                        VkImageLayout finalLayout, VkAccessFlags dstAccess) {
+  auto b = getRecording();
+  if (!b || toTransferDst(*b, dst) || b->cmd->copyImage(src, dst, regions)) {
+    return 1;
+  }
+  // The release and acquire barriers must both do the same layout transition.
+  VkImageMemoryBarrier VkInit(imb);
+  imb.image = dst.vk;
+  imb.subresourceRange = dst.getSubresourceRange();
+  imb.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  imb.newLayout = finalLayout;
+  imb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  dst.currentLayout = finalLayout;
+  if (!isDedicated()) {
+    // Same queue: a plain image barrier in the GRAPHICS command buffer.
+    imb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imb.dstAccessMask = dstAccess;
+    b->acquire.img.emplace_back(imb);
+    return 0;
+  }
+  imb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  imb.dstAccessMask = 0;
+  if (dst.info.sharingMode != VK_SHARING_MODE_EXCLUSIVE) {
+    // No ownership to transfer. Do the layout transition on this queue.
+    b->release.img.emplace_back(imb);
+    return 0;
+  }
+  imb.srcQueueFamilyIndex = transferFamily;
+  imb.dstQueueFamilyIndex = graphicsFamily;
+  b->release.img.emplace_back(imb);
+  imb.srcAccessMask = 0;
+  imb.dstAccessMask = dstAccess;
+  b->acquire.img.emplace_back(imb);
+  return 0;
+}
+
+int TransferQueue::submit() {
+  if (!recording) {
+    return 0;
+  }
+  auto& b = *recording;
+  if ((b.release.buf.size() || b.release.img.size()) &&
+      b.cmd->waitBarrier(b.release)) {
+    logE("TransferQueue::submit: release barrier failed\n");
+    return 1;
+  }
+  std::vector<VkSemaphore> wait;
+  std::vector<VkPipelineStageFlags> waitStages;
+  if (b.reclaim.img.size()) {
+    if (submitReclaim(b)) {
+      return 1;
+    }
+    wait.emplace_back(b.reclaimSemaphore->vk);
+    waitStages.emplace_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+  }
+  std::vector<VkSemaphore> signal;
+  if (isDedicated()) {
+    b.semaphore.reset(new command::Semaphore(dev));
+    if (b.semaphore->ctorError(dev)) {
+      logE("TransferQueue::submit: Semaphore failed\n");
+      return 1;
+    }
+    signal.emplace_back(b.semaphore->vk);
+  }
+  if (b.cmd->submitAsync(b.done, nullptr, signal, wait, waitStages)) {
+    logE("TransferQueue::submit: submitAsync failed\n");
+    return 1;
+  }
+  submitted.emplace_back(std::move(recording));
+  return 0;
+}
+
+int TransferQueue::acquire(command::CommandBuffer& cmd,
+                           VkPipelineStageFlags dstStage,
+                           std::shared_ptr<Handoff>& handoff) {
+  handoff = std::make_shared<Handoff>();
+  command::CommandBuffer::BarrierSet all;
+  // A dedicated queue's writes are made available by the semaphore.
+  all.srcStageMask = isDedicated() ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                                   : VK_PIPELINE_STAGE_TRANSFER_BIT;
+  all.dstStageMask = dstStage;
+  for (auto& b : submitted) {
+    all.buf.insert(all.buf.end(), b->acquire.buf.begin(),
+                   b->acquire.buf.end());
+    all.img.insert(all.img.end(), b->acquire.img.begin(),
+                   b->acquire.img.end());
+    if (b->semaphore) {
+      handoff->waitSemaphores.emplace_back(b->semaphore->vk);
+      handoff->waitStages.emplace_back(dstStage);
+      handoff->semaphores.emplace_back(std::move(b->semaphore));
+    }
+    if (b->reclaimSemaphore) {
+      // cmd waits for reclaimSemaphore, so keep it until b->done.
+      handoff->semaphores.emplace_back(std::move(b->reclaimSemaphore));
+      handoff->done.emplace_back(b->reclaimDone);
+    }
+    handoff->done.emplace_back(b->done);
+  }
+  submitted.clear();
+  if ((all.buf.size() || all.img.size()) && cmd.waitBarrier(all)) {
+    logE("TransferQueue::acquire: waitBarrier failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace science
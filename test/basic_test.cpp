@@ -63,10 +63,12 @@ class SimplePipeline : public science::CommandPoolContainer {
         std::make_pair(onResizeFramebuf, this));
   }
 
-  std::vector<command::CommandBuffer> cmdBuffers;
+  // sched keeps several frames in flight. Each frame records into its own
+  // sched.frame().cmd and writes its own region of uniform.
+  science::FrameScheduler sched{*this};
 
   int ctorError(GLFWwindow* window) {
-    if (cpool.ctorError()) {
+    if (cpool.ctorError() || sched.ctorError()) {
       return 1;
     }
     glfwSetWindowUserPointer(window, this);
@@ -94,7 +96,10 @@ class SimplePipeline : public science::CommandPoolContainer {
   unsigned lastDisplayedFrameCount = 0;
   int timeDelta = 0;
 
-  int updateUniformBuffer() {
+  // updateUniformBuffer writes this frame's uniforms directly to its region of
+  // uniform. It does not submit anything to the GPU: acquire() already waited
+  // until the GPU was done with the region.
+  int updateUniformBuffer(uint32_t& dynamicOffset) {
     auto currentTime = std::chrono::high_resolution_clock::now();
     float time = std::chrono::duration_cast<std::chrono::milliseconds>(
                      currentTime - startTime)
@@ -132,7 +137,30 @@ class SimplePipeline : public science::CommandPoolContainer {
     proj[1][1] *= -1;
     memcpy(&ubo.proj[0][0], &proj[0][0], sizeof(ubo.proj));
 
-    if (uniform.copy(cpool, &ubo, sizeof(ubo))) {
+    if (uniform.reset(sched.frameIndex()) ||
+        uniform.alloc(ubo, dynamicOffset)) {
+      return 1;
+    }
+    return 0;
+  }
+
+  // recordFrame records sched.frame().cmd to draw into framebufs[image_i].
+  int recordFrame(uint32_t image_i, uint32_t dynamicOffset) {
+    auto& cmdBuffer = sched.frame().cmd;
+    VkBuffer vertexBuffers[] = {vertexBuffer.vk};
+    VkDeviceSize offsets[] = {0};
+    if (cmdBuffer.beginOneTimeUse() || cmdBuffer.setViewport(pass) ||
+        cmdBuffer.setScissor(pass) ||
+        cmdBuffer.beginPrimaryPass(pass, cpool.dev.framebufs.at(image_i)) ||
+        cmdBuffer.bindGraphicsPipelineAndDescriptors(
+            *pipe0.pipe, 0, 1, &descriptorSet->vk, 1, &dynamicOffset) ||
+        cmdBuffer.bindVertexBuffers(
+            0, sizeof(vertexBuffers) / sizeof(vertexBuffers[0]), vertexBuffers,
+            offsets) ||
+        cmdBuffer.bindAndDraw(indices, indexBuffer.vk, 0 /*indexBufOffset*/) ||
+        cmdBuffer.draw(3, 1, 0, 0) || cmdBuffer.endRenderPass() ||
+        cmdBuffer.end()) {
+      logE("recordFrame: command buffer for image [%u] failed\n", image_i);
       return 1;
     }
     return 0;
@@ -142,7 +170,9 @@ class SimplePipeline : public science::CommandPoolContainer {
   science::ShaderLibrary shaders{cpool.dev};
   science::DescriptorLibrary descriptorLibrary{cpool.dev};
   std::unique_ptr<memory::DescriptorSet> descriptorSet;
-  memory::UniformBuffer uniform{cpool.dev};
+  // uniform has one region per frame in flight, so writing the next frame's
+  // uniforms never races with the GPU reading the previous frame's.
+  memory::UniformArena uniform{cpool.dev};
   memory::Buffer vertexBuffer{cpool.dev};
   memory::Buffer indexBuffer{cpool.dev};
   memory::Sampler textureSampler{cpool.dev};
@@ -180,7 +210,10 @@ class SimplePipeline : public science::CommandPoolContainer {
       }
     }
 
-    if (uniform.ctorError(sizeof(test::UniformBufferObject))) {
+    uniform.framesInFlight = sched.framesInFlight;
+    uniform.range = sizeof(test::UniformBufferObject);
+    uniform.frameSize = uniform.range;
+    if (uniform.ctorError()) {
       return 1;
     }
 
@@ -216,6 +249,8 @@ class SimplePipeline : public science::CommandPoolContainer {
     logI("main.vert.spv (0x%zx bytes) main.frag.spv (0x%zx bytes)\n",
          sizeof(spv_basic_test_vert), sizeof(spv_basic_test_frag));
 
+    // binding 0 is written through a dynamic offset into uniform.
+    shaders.dynamicBuffers.emplace(0, 0);
     auto vshader =
         shaders.load(spv_basic_test_vert, sizeof(spv_basic_test_vert));
     auto fshader =
@@ -235,7 +270,10 @@ class SimplePipeline : public science::CommandPoolContainer {
     }
     pipe0.info().setLayouts.emplace_back(descriptorLibrary.layouts.at(LI).vk);
 
-    return descriptorSet->write(0, {&uniform}) ||
+    VkDescriptorBufferInfo uniformInfo;
+    uniform.toDescriptor(&uniformInfo);
+    return descriptorSet->write(0, std::vector<VkDescriptorBufferInfo>{
+                                       uniformInfo}) ||
            descriptorSet->write(1, {&textureSampler}) ||
            onResized(cpool.dev.swapChainInfo.imageExtent,
                      memory::ASSUME_POOL_QINDEX);
@@ -248,11 +286,12 @@ class SimplePipeline : public science::CommandPoolContainer {
                                                                     framebuf_i);
   }
 
-  int onResizeFramebufImpl(language::Framebuf& framebuf, size_t framebuf_i) {
-    if (framebuf_i == 0) {
-      cpool.updateBuffersAndPass(cmdBuffers, pass);
+  int onResizeFramebufImpl(language::Framebuf& /*framebuf*/,
+                           size_t framebuf_i) {
+    if (framebuf_i != 0) {
+      return 0;
     }
-    // Patch viewport with new size.
+    // Patch viewport with new size. recordFrame() reads it every frame.
     auto& newSize = cpool.dev.swapChainInfo.imageExtent;
     VkViewport& viewport = pipe0.info().viewports.at(0);
     viewport.width = (float)newSize.width;
@@ -260,24 +299,6 @@ class SimplePipeline : public science::CommandPoolContainer {
 
     // Patch scissors with new size.
     pipe0.info().scissors.at(0).extent = newSize;
-
-    auto& cmdBuffer = cmdBuffers.at(framebuf_i);
-    VkBuffer vertexBuffers[] = {vertexBuffer.vk};
-    VkDeviceSize offsets[] = {0};
-    if (cmdBuffer.beginSimultaneousUse() || cmdBuffer.setViewport(pass) ||
-        cmdBuffer.setScissor(pass) ||
-        cmdBuffer.beginPrimaryPass(pass, framebuf) ||
-        cmdBuffer.bindGraphicsPipelineAndDescriptors(*pipe0.pipe, 0, 1,
-                                                     &descriptorSet->vk) ||
-        cmdBuffer.bindVertexBuffers(
-            0, sizeof(vertexBuffers) / sizeof(vertexBuffers[0]), vertexBuffers,
-            offsets) ||
-        cmdBuffer.bindAndDraw(indices, indexBuffer.vk, 0 /*indexBufOffset*/) ||
-        cmdBuffer.draw(3, 1, 0, 0) || cmdBuffer.endRenderPass() ||
-        cmdBuffer.end()) {
-      logE("onResizeFramebuf: command buffer [%zu] failed\n", framebuf_i);
-      return 1;
-    }
     return 0;
   }
 };
@@ -289,42 +310,36 @@ int mainLoop(GLFWwindow* window, SimplePipeline& simple) {
     return 1;
   }
 
-  command::Semaphore imageAvailableSemaphore(simple.cpool.dev);
-  if (imageAvailableSemaphore.ctorError(simple.cpool.dev)) {
-    return 1;
-  }
-  science::PresentSemaphore renderSemaphore(simple);
-  if (renderSemaphore.ctorError()) {
-    return 1;
-  }
-
+  auto& sched = simple.sched;
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
     if (automatedTest && simple.timeDelta == 3) {
       break;
     }
-    if (simple.updateUniformBuffer()) {
-      return 1;
-    }
 
     uint32_t next_image_i;
-    if (simple.acquireNextImage(simple.frameCount, &next_image_i,
-                                imageAvailableSemaphore)) {
+    if (sched.acquire(&next_image_i)) {
       return 1;
     }
-    if (next_image_i != (uint32_t)-1) {
-      if (simple.cmdBuffers.at(next_image_i)
-              .submit(0, {imageAvailableSemaphore.vk},
-                      {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
-                      {renderSemaphore.vk}) ||
-          renderSemaphore.present(&next_image_i)) {
-        return 1;
-      }
-      if (next_image_i != (uint32_t)-1 && renderSemaphore.waitIdle()) {
-        return 1;
-      }
-      simple.frameCount++;
+    if (next_image_i == (uint32_t)-1) {
+      continue;
     }
+    // Only this frame's fence was waited on, so the CPU records the next
+    // frame while the GPU is still rendering the previous one.
+    uint32_t dynamicOffset;
+    if (simple.updateUniformBuffer(dynamicOffset) ||
+        simple.recordFrame(next_image_i, dynamicOffset) ||
+        sched.submitAndPresent(sched.frame().cmd, &next_image_i)) {
+      return 1;
+    }
+    simple.frameCount = sched.frameNumber;
+  }
+  if (sched.frameNumber) {
+    logI("CPU waited for GPU %.3f ms/frame\n",
+         std::chrono::duration_cast<std::chrono::microseconds>(
+             sched.totalCpuWait)
+                 .count() /
+             1000.0 / sched.frameNumber);
   }
 
   VkResult v = vkDeviceWaitIdle(simple.cpool.dev.dev);
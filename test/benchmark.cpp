@@ -0,0 +1,431 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * benchmark measures the CPU time spent recording command buffers, the time
+ * for a compute reduction, and pipeline creation with a cold and a warm
+ * pipeline cache. It uses Instance::ctorErrorHeadless(), so it runs without a
+ * window.
+ */
+
+#include <src/command/command.h>
+#include <src/language/language.h>
+#include <src/memory/memory.h>
+#include <src/science/science.h>
+
+#include <stdio.h>
+#include <chrono>
+#include <limits>
+
+// Compile SPIR-V bytecode directly into application.
+#include "test/benchmark_reduce.comp.h"
+#include "test/headless_test.comp.h"
+#include "test/headless_test.frag.h"
+#include "test/headless_test.vert.h"
+
+namespace {  // An anonymous namespace keeps any definition local to this file.
+
+static const uint32_t BENCH_WIDTH = 64;
+static const uint32_t BENCH_HEIGHT = 64;
+// DRAWS is the number of draw calls recorded in each frame.
+static const size_t DRAWS = 20000;
+// JOBS is the number of secondary command buffers DRAWS is split into.
+static const size_t JOBS = 64;
+static const size_t FRAMES = 50;
+// REDUCE_N is the number of uints summed by benchReduce.
+static const uint32_t REDUCE_N = 1 << 22;
+// REDUCE_GROUP must match local_size_x in benchmark_reduce.comp.
+static const uint32_t REDUCE_GROUP = 256;
+// CACHE_FILE is written and then removed by benchPipelineCache.
+static const char CACHE_FILE[] = "benchmark_pipeline_cache.bin";
+// CACHE_REPS is how many times benchPipelineCache creates the pipelines.
+static const size_t CACHE_REPS = 10;
+
+typedef std::chrono::steady_clock Clock;
+
+// report prints the average time to record a frame.
+void report(const char* name, Clock::duration total) {
+  double ms =
+      std::chrono::duration<double, std::milli>(total).count() / FRAMES;
+  logI("%-40s %8.3f ms/frame %8.1f ns/draw\n", name, ms, ms * 1e6 / DRAWS);
+}
+
+// benchParallel records DRAWS draws in JOBS secondary command buffers with a
+// ParallelRecorder using nThreads (0 means one per CPU).
+int benchParallel(science::CommandPoolContainer& cpc, command::Pipeline& pipe,
+                  size_t nThreads, const char* name) {
+  auto& dev = cpc.cpool.dev;
+  science::ParallelRecorder rec(dev);
+  rec.nThreads = nThreads;
+  rec.framesInFlight = 1;
+  if (rec.ctorError()) {
+    logE("benchParallel: ParallelRecorder::ctorError failed\n");
+    return 1;
+  }
+  std::vector<VkCommandBuffer> vk(1);
+  if (cpc.cpool.alloc(vk)) {
+    logE("benchParallel: cpool.alloc failed\n");
+    return 1;
+  }
+  command::CommandBuffer primary(cpc.cpool);
+  primary.vk = vk.at(0);
+  auto& framebuf = dev.framebufs.at(0);
+
+  Clock::duration total{0};
+  int r = 0;
+  for (size_t i = 0; i < FRAMES && !r; i++) {
+    if (i) {
+      // record() would wait for the fence anyway. Waiting here keeps the GPU
+      // out of the measurement.
+      VkResult v = rec.fence(0).wait(dev, std::numeric_limits<uint64_t>::max());
+      if (v != VK_SUCCESS) {
+        logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+        r = 1;
+        break;
+      }
+    }
+    auto t0 = Clock::now();
+    if (primary.beginOneTimeUse() ||
+        primary.beginSecondaryPass(cpc.pass, framebuf) ||
+        rec.record(0, primary, cpc.pass, 0, framebuf, JOBS,
+                   [&](command::CommandBuffer& buf, size_t) -> int {
+                     if (buf.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                          pipe)) {
+                       return 1;
+                     }
+                     for (size_t d = 0; d < DRAWS / JOBS; d++) {
+                       if (buf.draw(3, 1, 0, 0)) {
+                         return 1;
+                       }
+                     }
+                     return 0;
+                   }) ||
+        primary.endRenderPass() || primary.end()) {
+      logE("benchParallel: recording failed\n");
+      r = 1;
+      break;
+    }
+    total += Clock::now() - t0;
+    if (primary.submit(0, {}, {}, {}, rec.fence(0).vk)) {
+      logE("benchParallel: submit failed\n");
+      r = 1;
+    }
+  }
+  // ~ParallelRecorder waits for the last submit before destroying its pools,
+  // but primary is freed here, so wait for it first.
+  if (!r) {
+    VkResult v = rec.fence(0).wait(dev, std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+      r = 1;
+    }
+  }
+  cpc.cpool.free(vk);
+  if (!r) {
+    report(name, total);
+  }
+  return r;
+}
+
+// benchPrimary records DRAWS draws inline in one primary command buffer. If
+// useScope is true the draws go through a CommandBuffer::RecordingScope,
+// which locks cpool.lockmutex once instead of once per draw, or not at all if
+// cpool.owner is set.
+int benchPrimary(science::CommandPoolContainer& cpc, command::Pipeline& pipe,
+                 bool useScope, const char* name) {
+  auto& dev = cpc.cpool.dev;
+  command::Fence fence(dev);
+  if (fence.ctorError(dev)) {
+    logE("benchPrimary: fence.ctorError failed\n");
+    return 1;
+  }
+  std::vector<VkCommandBuffer> vk(1);
+  if (cpc.cpool.alloc(vk)) {
+    logE("benchPrimary: cpool.alloc failed\n");
+    return 1;
+  }
+  command::CommandBuffer cmd(cpc.cpool);
+  cmd.vk = vk.at(0);
+  auto& framebuf = dev.framebufs.at(0);
+
+  Clock::duration total{0};
+  int r = 0;
+  for (size_t i = 0; i < FRAMES && !r; i++) {
+    auto t0 = Clock::now();
+    if (cmd.beginOneTimeUse() || cmd.beginPrimaryPass(cpc.pass, framebuf) ||
+        cmd.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipe)) {
+      logE("benchPrimary: begin failed\n");
+      r = 1;
+      break;
+    }
+    if (useScope) {
+      command::CommandBuffer::RecordingScope rec(cmd);
+      if (rec.ctorError()) {
+        logE("benchPrimary: RecordingScope::ctorError failed\n");
+        r = 1;
+        break;
+      }
+      for (size_t d = 0; d < DRAWS; d++) {
+        rec.draw(3, 1, 0, 0);
+      }
+    } else {
+      for (size_t d = 0; d < DRAWS && !r; d++) {
+        r = cmd.draw(3, 1, 0, 0);
+      }
+    }
+    if (r || cmd.endRenderPass() || cmd.end()) {
+      logE("benchPrimary: recording failed\n");
+      r = 1;
+      break;
+    }
+    total += Clock::now() - t0;
+    if (cmd.submit(0, {}, {}, {}, fence.vk)) {
+      logE("benchPrimary: submit failed\n");
+      r = 1;
+      break;
+    }
+    VkResult v = fence.wait(dev, std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+      r = 1;
+      break;
+    }
+    if (fence.reset(dev)) {
+      r = 1;
+    }
+  }
+  cpc.cpool.free(vk);
+  if (!r) {
+    report(name, total);
+  }
+  return r;
+}
+
+// benchReduce sums REDUCE_N uints with a compute shader that writes one
+// partial sum per workgroup. It reports the time from submit until the fence
+// signals, then checks the sum on the CPU.
+int benchReduce(command::CommandPool& cpool) {
+  auto& dev = cpool.dev;
+  science::ShaderLibrary shaders(dev);
+  command::ComputePipeline pipe(dev);
+  science::DescriptorLibrary library(dev);
+  auto cshader = shaders.load(spv_benchmark_reduce_comp,
+                              sizeof(spv_benchmark_reduce_comp));
+  if (!cshader || shaders.stage(pipe, cshader) ||
+      shaders.makeDescriptorLibrary(library)) {
+    logE("benchReduce: shaders failed\n");
+    return 1;
+  }
+  std::unique_ptr<memory::DescriptorSet> set = library.makeSet(0);
+  if (!set) {
+    logE("benchReduce: makeSet failed\n");
+    return 1;
+  }
+  pipe.info.setLayouts.emplace_back(library.layouts.at(0).vk);
+  if (pipe.ctorError()) {
+    logE("benchReduce: pipe.ctorError failed\n");
+    return 1;
+  }
+
+  std::vector<uint32_t> data(REDUCE_N);
+  uint32_t want = 0;
+  for (uint32_t i = 0; i < REDUCE_N; i++) {
+    data.at(i) = i & 0xff;
+    want += data.at(i);
+  }
+  memory::Buffer stage(dev), in(dev), out(dev);
+  stage.info.size = in.info.size = REDUCE_N * sizeof(uint32_t);
+  in.info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  out.info.size = REDUCE_N / REDUCE_GROUP * sizeof(uint32_t);
+  out.info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  if (stage.ctorHostCoherent() || stage.bindMemory() ||
+      stage.copyFromHost(data) || in.ctorDeviceLocal() || in.bindMemory() ||
+      in.copy(cpool, stage) || out.ctorHostPersistent() ||
+      out.bindMemory() ||
+      set->write(0, std::vector<memory::Buffer*>{&in}) ||
+      set->write(1, std::vector<memory::Buffer*>{&out})) {
+    logE("benchReduce: buffers failed\n");
+    return 1;
+  }
+
+  command::Fence fence(dev);
+  if (fence.ctorError(dev)) {
+    logE("benchReduce: fence.ctorError failed\n");
+    return 1;
+  }
+  std::vector<VkCommandBuffer> vk(1);
+  if (cpool.alloc(vk)) {
+    logE("benchReduce: cpool.alloc failed\n");
+    return 1;
+  }
+  command::CommandBuffer cmd(cpool);
+  cmd.vk = vk.at(0);
+  command::CommandBuffer::BarrierSet b;
+  b.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  b.dstStageMask = VK_PIPELINE_STAGE_HOST_BIT;
+  VkMemoryBarrier VkInit(mb);
+  mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  mb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  b.mem.emplace_back(mb);
+
+  Clock::duration total{0};
+  int r = 0;
+  // The first dispatch is not timed: it includes any lazy driver setup.
+  for (size_t i = 0; i <= FRAMES && !r; i++) {
+    if (cmd.beginOneTimeUse() ||
+        cmd.bindComputePipelineAndDescriptors(pipe, 0, 1, &set->vk) ||
+        cmd.dispatch(REDUCE_N / REDUCE_GROUP, 1, 1) || cmd.waitBarrier(b) ||
+        cmd.end()) {
+      logE("benchReduce: recording failed\n");
+      r = 1;
+      break;
+    }
+    auto t0 = Clock::now();
+    if (cmd.submit(0, {}, {}, {}, fence.vk)) {
+      logE("benchReduce: submit failed\n");
+      r = 1;
+      break;
+    }
+    VkResult v = fence.wait(dev, std::numeric_limits<uint64_t>::max());
+    if (v != VK_SUCCESS) {
+      logE("%s failed: %d (%s)\n", "vkWaitForFences", v, string_VkResult(v));
+      r = 1;
+      break;
+    }
+    if (i) {
+      total += Clock::now() - t0;
+    }
+    if (fence.reset(dev)) {
+      r = 1;
+    }
+  }
+  cpool.free(vk);
+  if (r || out.mem.invalidateRange(0, VK_WHOLE_SIZE)) {
+    return 1;
+  }
+
+  auto* sums = reinterpret_cast<const uint32_t*>(out.mem.mapped);
+  uint32_t got = 0;
+  for (uint32_t i = 0; i < REDUCE_N / REDUCE_GROUP; i++) {
+    got += sums[i];
+  }
+  if (got != want) {
+    logE("benchReduce: sum is %u, want %u\n", got, want);
+    return 1;
+  }
+  double ms =
+      std::chrono::duration<double, std::milli>(total).count() / FRAMES;
+  logI("%-40s %8.3f ms/dispatch %8.2f GB/s\n", "compute reduction", ms,
+       REDUCE_N * sizeof(uint32_t) / (ms * 1e6));
+  return 0;
+}
+
+// makeComputePipelines creates a ComputePipeline from each compute shader
+// using dev.pipelineCache. Only the time in ComputePipeline::ctorError() is
+// added to total.
+int makeComputePipelines(language::Device& dev, Clock::duration& total) {
+  typedef struct Spv {
+    const void* code;
+    size_t len;
+  } Spv;
+  for (auto& spv : std::vector<Spv>{
+           {spv_headless_test_comp, sizeof(spv_headless_test_comp)},
+           {spv_benchmark_reduce_comp, sizeof(spv_benchmark_reduce_comp)},
+       }) {
+    science::ShaderLibrary shaders(dev);
+    command::ComputePipeline pipe(dev);
+    science::DescriptorLibrary library(dev);
+    auto cshader = shaders.load(spv.code, spv.len);
+    if (!cshader || shaders.stage(pipe, cshader) ||
+        shaders.makeDescriptorLibrary(library)) {
+      logE("makeComputePipelines: shaders failed\n");
+      return 1;
+    }
+    pipe.info.setLayouts.emplace_back(library.layouts.at(0).vk);
+    auto t0 = Clock::now();
+    if (pipe.ctorError()) {
+      logE("makeComputePipelines: pipe.ctorError failed\n");
+      return 1;
+    }
+    total += Clock::now() - t0;
+  }
+  return 0;
+}
+
+// benchPipelineCache compares creating pipelines with an empty pipelineCache
+// (cold, the first run of an app) and with one loaded from a file written by
+// savePipelineCache (warm, every later run). A driver with its own on-disk
+// shader cache makes the cold case faster than a true first run.
+int benchPipelineCache(language::Device& dev) {
+  Clock::duration cold{0}, warm{0};
+  int r = 0;
+  for (size_t i = 0; i < CACHE_REPS && !r; i++) {
+    // Loading a missing file leaves pipelineCache empty.
+    remove(CACHE_FILE);
+    if (dev.loadPipelineCache(CACHE_FILE) || makeComputePipelines(dev, cold) ||
+        dev.savePipelineCache(CACHE_FILE) ||
+        dev.loadPipelineCache(CACHE_FILE) || makeComputePipelines(dev, warm)) {
+      logE("benchPipelineCache: failed\n");
+      r = 1;
+    }
+  }
+  // Do not let ~Device write CACHE_FILE again.
+  dev.pipelineCacheFile.clear();
+  remove(CACHE_FILE);
+  if (r) {
+    return 1;
+  }
+  auto ms = [](Clock::duration total) -> double {
+    return std::chrono::duration<double, std::milli>(total).count() /
+           CACHE_REPS;
+  };
+  logI("%-40s %8.3f ms\n", "pipeline creation, cold cache", ms(cold));
+  logI("%-40s %8.3f ms\n", "pipeline creation, warm cache", ms(warm));
+  return 0;
+}
+
+int runBenchmarks() {
+  language::Instance inst;
+  if (inst.ctorErrorHeadless() || inst.open({BENCH_WIDTH, BENCH_HEIGHT})) {
+    logE("benchmark: headless Instance failed\n");
+    return 1;
+  }
+  auto& dev = *inst.devs.at(0);
+  science::CommandPoolContainer cpc(dev);
+  if (cpc.cpool.ctorError()) {
+    logE("benchmark: cpool.ctorError failed\n");
+    return 1;
+  }
+
+  science::ShaderLibrary shaders(dev);
+  science::PipeBuilder pipe0(dev, cpc.pass);
+  pipe0.info().rastersci.cullMode = VK_CULL_MODE_NONE;
+  auto vshader =
+      shaders.load(spv_headless_test_vert, sizeof(spv_headless_test_vert));
+  auto fshader =
+      shaders.load(spv_headless_test_frag, sizeof(spv_headless_test_frag));
+  if (!vshader || !fshader ||
+      shaders.stage(cpc.pass, pipe0, VK_SHADER_STAGE_VERTEX_BIT, vshader) ||
+      shaders.stage(cpc.pass, pipe0, VK_SHADER_STAGE_FRAGMENT_BIT, fshader)) {
+    logE("benchmark: shaders failed\n");
+    return 1;
+  }
+  if (cpc.onResized({BENCH_WIDTH, BENCH_HEIGHT}, 0)) {
+    logE("benchmark: onResized failed\n");
+    return 1;
+  }
+
+  if (benchPrimary(cpc, *pipe0.pipe, false, "CommandBuffer::draw") ||
+      benchPrimary(cpc, *pipe0.pipe, true, "RecordingScope::draw")) {
+    return 1;
+  }
+  cpc.cpool.owner = std::this_thread::get_id();
+  int r = benchPrimary(cpc, *pipe0.pipe, true, "RecordingScope::draw owned");
+  cpc.cpool.owner = std::thread::id();
+  return r ||
+         benchParallel(cpc, *pipe0.pipe, 1, "ParallelRecorder 1 thread") ||
+         benchParallel(cpc, *pipe0.pipe, 0, "ParallelRecorder all CPUs") ||
+         benchReduce(cpc.cpool) || benchPipelineCache(dev);
+}
+
+}  // End of anonymous namespace
+
+int main() { return runBenchmarks(); }
@@ -0,0 +1,667 @@
+/* Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+ *
+ * Tests that need a Vulkan device but no window. They use
+ * Instance::ctorErrorHeadless(), so they run on a CI machine with a software
+ * driver such as lavapipe.
+ */
+
+#include "gtest/gtest.h"
+
+#include <src/command/command.h>
+#include <src/language/VkInit.h>
+#include <src/language/language.h>
+#include <src/memory/memory.h>
+#include <src/science/science.h>
+
+#include <limits>
+#include <set>
+
+// Compile SPIR-V bytecode directly into application.
+#include "test/headless_test.comp.h"
+#include "test/headless_test.frag.h"
+#include "test/headless_test.vert.h"
+
+namespace {  // An anonymous namespace keeps any definition local to this file.
+
+static const uint32_t TEST_WIDTH = 64;
+static const uint32_t TEST_HEIGHT = 64;
+static const char PIPELINE_CACHE_FILE[] = "headless_test_pipeline_cache.bin";
+
+// readFile returns the contents of filename, or an empty vector if it could
+// not be read.
+std::vector<unsigned char> readFile(const char* filename) {
+  std::vector<unsigned char> data;
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return data;
+  }
+  unsigned char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+  return data;
+}
+
+bool writeFile(const char* filename, const std::vector<unsigned char>& data) {
+  FILE* f = fopen(filename, "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = data.empty() || fwrite(data.data(), data.size(), 1, f) == 1;
+  return !fclose(f) && ok;
+}
+
+bool fileExists(const char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+  fclose(f);
+  return true;
+}
+
+// HeadlessTests opens a headless Instance for each test.
+class HeadlessTests : public ::testing::Test {
+ protected:
+  language::Instance inst;
+
+  void SetUp() override {
+    ASSERT_EQ(inst.ctorErrorHeadless(), 0);
+    ASSERT_EQ(inst.open({TEST_WIDTH, TEST_HEIGHT}), 0);
+    ASSERT_GT(inst.devs.size(), size_t(0));
+    ASSERT_EQ(inst.devs.at(0)->isHeadless(), true);
+  }
+
+  void TearDown() override {
+    // ~Device would save the pipelineCache again.
+    if (!inst.devs.empty()) {
+      dev().pipelineCacheFile.clear();
+    }
+    remove(PIPELINE_CACHE_FILE);
+    remove((std::string(PIPELINE_CACHE_FILE) + ".tmp").c_str());
+  }
+
+  language::Device& dev() { return *inst.devs.at(0); }
+
+  // pipelineCacheLen returns the size of dev().pipelineCache's data.
+  size_t pipelineCacheLen() {
+    size_t len = 0;
+    EXPECT_EQ(vkGetPipelineCacheData(dev().dev, dev().pipelineCache, &len,
+                                     nullptr),
+              VK_SUCCESS);
+    return len;
+  }
+
+  // addComputePipeline creates a pipeline so dev().pipelineCache has an entry.
+  void addComputePipeline() {
+    science::ShaderLibrary shaders(dev());
+    command::ComputePipeline pipe(dev());
+    auto cshader =
+        shaders.load(spv_headless_test_comp, sizeof(spv_headless_test_comp));
+    ASSERT_TRUE(!!cshader);
+    ASSERT_EQ(shaders.stage(pipe, cshader), 0);
+    science::DescriptorLibrary library(dev());
+    ASSERT_EQ(shaders.makeDescriptorLibrary(library), 0);
+    ASSERT_EQ(library.layouts.size(), size_t(1));
+    pipe.info.setLayouts.emplace_back(library.layouts.at(0).vk);
+    ASSERT_EQ(pipe.ctorError(), 0);
+  }
+
+  // headerMatchesDevice checks the VkPipelineCacheHeaderVersionOne in data.
+  void headerMatchesDevice(const std::vector<unsigned char>& data) {
+    ASSERT_GE(data.size(), size_t(16 + VK_UUID_SIZE));
+    auto le32 = [&](size_t i) {
+      return uint32_t(data[i]) | (uint32_t(data[i + 1]) << 8) |
+             (uint32_t(data[i + 2]) << 16) | (uint32_t(data[i + 3]) << 24);
+    };
+    auto& prop = dev().physProp.properties;
+    ASSERT_EQ(le32(4), uint32_t(VK_PIPELINE_CACHE_HEADER_VERSION_ONE));
+    ASSERT_EQ(le32(8), prop.vendorID);
+    ASSERT_EQ(le32(12), prop.deviceID);
+    ASSERT_EQ(memcmp(&data[16], prop.pipelineCacheUUID, VK_UUID_SIZE), 0);
+  }
+
+  // makeLayout builds a DescriptorSetLayout with one binding per entry in
+  // types. counts gives the descriptorCount of each binding.
+  void makeLayout(memory::DescriptorSetLayout& layout,
+                  const std::vector<VkDescriptorType>& types,
+                  const std::vector<uint32_t>& counts) {
+    ASSERT_EQ(types.size(), counts.size());
+    std::vector<VkDescriptorSetLayoutBinding> bindings(types.size());
+    for (size_t i = 0; i < types.size(); i++) {
+      auto& b = bindings.at(i);
+      memset(&b, 0, sizeof(b));
+      b.binding = (uint32_t)i;
+      b.descriptorType = types.at(i);
+      b.descriptorCount = counts.at(i);
+      b.stageFlags = VK_SHADER_STAGE_ALL;
+    }
+    ASSERT_EQ(layout.ctorError(dev(), bindings), 0);
+  }
+
+  // hostReadBarrier makes writes by srcStage visible to the host once the
+  // submit's fence is signalled.
+  static int hostReadBarrier(command::CommandBuffer& cmd,
+                             VkPipelineStageFlags srcStage,
+                             VkAccessFlags srcAccess) {
+    command::CommandBuffer::BarrierSet b;
+    b.srcStageMask = srcStage;
+    b.dstStageMask = VK_PIPELINE_STAGE_HOST_BIT;
+    b.mem.emplace_back();
+    auto& mb = b.mem.back();
+    VkOverwrite(mb);
+    mb.srcAccessMask = srcAccess;
+    mb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    return cmd.waitBarrier(b);
+  }
+};
+
+TEST_F(HeadlessTests, OpenCreatesNoSurface) {
+  ASSERT_EQ(bool(inst.surface), false);
+  ASSERT_EQ(dev().swapChainInfo.imageFormat, VK_FORMAT_R8G8B8A8_UNORM);
+  ASSERT_EQ(dev().swapChainInfo.imageExtent.width, TEST_WIDTH);
+  ASSERT_EQ(dev().swapChainInfo.imageExtent.height, TEST_HEIGHT);
+}
+
+TEST_F(HeadlessTests, ctorErrorWithoutSurfaceFnShouldFail) {
+  language::Instance windowed;
+  // PRESENT is still in minSurfaceSupport, so a null createWindowSurface is
+  // a mistake.
+  ASSERT_NE(windowed.ctorError(nullptr, nullptr), 0);
+}
+
+// DrawOffscreen renders one frame into Device::offscreenImages and reads it
+// back.
+TEST_F(HeadlessTests, DrawOffscreen) {
+  science::CommandPoolContainer cpc(dev());
+  ASSERT_EQ(cpc.cpool.ctorError(), 0);
+
+  science::ShaderLibrary shaders(dev());
+  science::PipeBuilder pipe0(dev(), cpc.pass);
+  // The triangle is the same no matter the winding.
+  pipe0.info().rastersci.cullMode = VK_CULL_MODE_NONE;
+  auto vshader =
+      shaders.load(spv_headless_test_vert, sizeof(spv_headless_test_vert));
+  auto fshader =
+      shaders.load(spv_headless_test_frag, sizeof(spv_headless_test_frag));
+  ASSERT_TRUE(vshader && fshader);
+  ASSERT_EQ(
+      shaders.stage(cpc.pass, pipe0, VK_SHADER_STAGE_VERTEX_BIT, vshader), 0);
+  ASSERT_EQ(
+      shaders.stage(cpc.pass, pipe0, VK_SHADER_STAGE_FRAGMENT_BIT, fshader),
+      0);
+
+  // onResized calls RenderPass::ctorError and Device::resetSwapChain, which
+  // creates offscreenImages and framebufs.
+  ASSERT_EQ(cpc.onResized({TEST_WIDTH, TEST_HEIGHT}, 0), 0);
+  ASSERT_EQ(dev().offscreenImages.size(), dev().offscreenCount);
+  ASSERT_EQ(dev().framebufs.size(), dev().offscreenCount);
+  auto& img = *dev().offscreenImages.at(0);
+  ASSERT_TRUE(img.info.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
+  memory::Buffer readback(dev());
+  readback.info.size = TEST_WIDTH * TEST_HEIGHT * 4;
+  readback.info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  ASSERT_EQ(readback.ctorHostPersistent(), 0);
+  ASSERT_EQ(readback.bindMemory(), 0);
+  ASSERT_TRUE(readback.mem.mapped != nullptr);
+
+  {
+    science::SmartCommandBuffer cmd(cpc.cpool, 0);
+    ASSERT_EQ(cmd.ctorError(), 0);
+    ASSERT_EQ(cmd.autoSubmit(), 0);
+
+    VkBufferImageCopy region;
+    memset(&region, 0, sizeof(region));
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {TEST_WIDTH, TEST_HEIGHT, 1};
+    // The RenderPass leaves the image in TRANSFER_SRC_OPTIMAL when headless.
+    ASSERT_FALSE(
+        cmd.beginPrimaryPass(cpc.pass, dev().framebufs.at(0)) ||
+        cmd.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, *pipe0.pipe) ||
+        cmd.draw(3, 1, 0, 0) || cmd.endRenderPass() ||
+        cmd.copyImageToBuffer(img.vk, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              readback.vk, {region}) ||
+        hostReadBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_TRANSFER_WRITE_BIT));
+    // ~SmartCommandBuffer submits cmd and waits for it.
+  }
+  ASSERT_EQ(readback.mem.invalidateRange(0, VK_WHOLE_SIZE), 0);
+
+  auto* px = reinterpret_cast<const uint8_t*>(readback.mem.mapped);
+  for (size_t i = 0; i < TEST_WIDTH * TEST_HEIGHT; i += TEST_WIDTH + 1) {
+    // The fragment shader writes opaque green to every pixel.
+    ASSERT_EQ(px[i * 4 + 0], 0) << "pixel " << i;
+    ASSERT_EQ(px[i * 4 + 1], 255) << "pixel " << i;
+    ASSERT_EQ(px[i * 4 + 2], 0) << "pixel " << i;
+    ASSERT_EQ(px[i * 4 + 3], 255) << "pixel " << i;
+  }
+}
+
+// DispatchCompute runs a compute shader with a specialization constant and
+// reads back the storage buffer it writes.
+TEST_F(HeadlessTests, DispatchCompute) {
+  static const uint32_t N = 256;
+  static const uint32_t SCALE = 3;
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+
+  science::ShaderLibrary shaders(dev());
+  command::ComputePipeline pipe(dev());
+  auto cshader =
+      shaders.load(spv_headless_test_comp, sizeof(spv_headless_test_comp));
+  ASSERT_TRUE(!!cshader);
+  ASSERT_EQ(shaders.stage(pipe, cshader), 0);
+  pipe.info.addSpecialization(0, SCALE);
+
+  science::DescriptorLibrary library(dev());
+  ASSERT_EQ(shaders.makeDescriptorLibrary(library), 0);
+  ASSERT_EQ(library.layouts.size(), size_t(1));
+  std::unique_ptr<memory::DescriptorSet> set = library.makeSet(0);
+  ASSERT_TRUE(!!set);
+  pipe.info.setLayouts.emplace_back(library.layouts.at(0).vk);
+  ASSERT_EQ(pipe.ctorError(), 0);
+  // ctorError must not leave pointers into its stack frame in info.
+  ASSERT_TRUE(pipe.info.stage.info.pSpecializationInfo == nullptr);
+
+  memory::Buffer result(dev());
+  result.info.size = N * sizeof(uint32_t);
+  result.info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  ASSERT_EQ(result.ctorHostPersistent(), 0);
+  ASSERT_EQ(result.bindMemory(), 0);
+  ASSERT_TRUE(result.mem.mapped != nullptr);
+  memset(result.mem.mapped, 0, N * sizeof(uint32_t));
+  ASSERT_EQ(set->write(0, std::vector<memory::Buffer*>{&result}), 0);
+
+  {
+    science::SmartCommandBuffer cmd(cpool, 0);
+    ASSERT_EQ(cmd.ctorError(), 0);
+    ASSERT_EQ(cmd.autoSubmit(), 0);
+    ASSERT_FALSE(cmd.bindComputePipelineAndDescriptors(pipe, 0, 1, &set->vk) ||
+                 cmd.dispatch(N / 64, 1, 1) ||
+                 hostReadBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_ACCESS_SHADER_WRITE_BIT));
+    // ~SmartCommandBuffer submits cmd and waits for it.
+  }
+  ASSERT_EQ(result.mem.invalidateRange(0, VK_WHOLE_SIZE), 0);
+
+  auto* data = reinterpret_cast<const uint32_t*>(result.mem.mapped);
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_EQ(data[i], i * SCALE) << "element " << i;
+  }
+}
+
+// SavePipelineCache checks that savePipelineCache writes a valid header and
+// renames its temporary file over an existing file.
+TEST_F(HeadlessTests, SavePipelineCache) {
+  ASSERT_NO_FATAL_FAILURE(addComputePipeline());
+  // An old file must be replaced, not appended to.
+  ASSERT_TRUE(writeFile(PIPELINE_CACHE_FILE,
+                        std::vector<unsigned char>(4096, 0xff)));
+  ASSERT_EQ(dev().savePipelineCache(PIPELINE_CACHE_FILE), 0);
+  std::string tmpName = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+  ASSERT_FALSE(fileExists(tmpName.c_str()));
+  auto data = readFile(PIPELINE_CACHE_FILE);
+  ASSERT_EQ(data.size(), pipelineCacheLen());
+  ASSERT_NO_FATAL_FAILURE(headerMatchesDevice(data));
+
+  // A failed save leaves no file behind.
+  ASSERT_NE(dev().savePipelineCache("no-such-dir/pipeline_cache.bin"), 0);
+  ASSERT_FALSE(fileExists("no-such-dir/pipeline_cache.bin.tmp"));
+}
+
+// LoadPipelineCache loads a saved cache, then checks that a file with an
+// invalid header is discarded and leaves an empty pipelineCache.
+TEST_F(HeadlessTests, LoadPipelineCache) {
+  size_t emptyLen = pipelineCacheLen();
+  ASSERT_NO_FATAL_FAILURE(addComputePipeline());
+  size_t fullLen = pipelineCacheLen();
+  ASSERT_EQ(dev().savePipelineCache(PIPELINE_CACHE_FILE), 0);
+  auto data = readFile(PIPELINE_CACHE_FILE);
+  ASSERT_EQ(data.size(), fullLen);
+
+  ASSERT_EQ(dev().loadPipelineCache(PIPELINE_CACHE_FILE), 0);
+  ASSERT_EQ(dev().pipelineCacheFile, PIPELINE_CACHE_FILE);
+  ASSERT_TRUE(bool(dev().pipelineCache));
+  ASSERT_EQ(pipelineCacheLen(), fullLen);
+
+  // Each of these must be discarded without an error.
+  std::vector<std::vector<unsigned char>> bad;
+  bad.emplace_back(data.begin(), data.begin() + 8);  // Truncated.
+  bad.emplace_back(data);
+  bad.back()[4] ^= 0xff;  // headerVersion.
+  bad.emplace_back(data);
+  bad.back()[8] ^= 0xff;  // vendorID.
+  bad.emplace_back(data);
+  bad.back()[16] ^= 0xff;  // pipelineCacheUUID.
+  for (size_t i = 0; i < bad.size(); i++) {
+    ASSERT_TRUE(writeFile(PIPELINE_CACHE_FILE, bad.at(i)));
+    ASSERT_EQ(dev().loadPipelineCache(PIPELINE_CACHE_FILE), 0) << "bad " << i;
+    ASSERT_TRUE(bool(dev().pipelineCache)) << "bad " << i;
+    ASSERT_EQ(pipelineCacheLen(), emptyLen) << "bad " << i;
+  }
+
+  // A missing file is not an error either.
+  remove(PIPELINE_CACHE_FILE);
+  ASSERT_EQ(dev().loadPipelineCache(PIPELINE_CACHE_FILE), 0);
+  ASSERT_EQ(pipelineCacheLen(), emptyLen);
+}
+
+// DescriptorAllocatorGrows allocates more sets than one pool holds. The
+// allocator must chain new pools, and reuse them after beginFrame.
+TEST_F(HeadlessTests, DescriptorAllocatorGrows) {
+  memory::DescriptorSetLayout layout(dev());
+  ASSERT_NO_FATAL_FAILURE(
+      makeLayout(layout, {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER}, {1}));
+  memory::DescriptorAllocator alloc(dev());
+  alloc.setsPerPool = 2;
+  ASSERT_EQ(alloc.ctorError(2), 0);
+
+  for (size_t pass = 0; pass < 2; pass++) {
+    ASSERT_EQ(alloc.beginFrame(0), 0);
+    for (size_t i = 0; i < 5; i++) {
+      VkDescriptorSet set = VK_NULL_HANDLE;
+      ASSERT_EQ(alloc.alloc(layout, set), 0) << "pass " << pass << " i " << i;
+      ASSERT_TRUE(set != VK_NULL_HANDLE);
+    }
+    // 5 sets need 3 pools of 2. The second pass reuses them.
+    ASSERT_EQ(alloc.poolCount(0), size_t(3)) << "pass " << pass;
+  }
+  ASSERT_EQ(alloc.poolCount(1), size_t(0));
+}
+
+// DescriptorAllocatorArrayBinding checks that an array binding reserves
+// descriptorCount descriptors in each pool, not 1.
+TEST_F(HeadlessTests, DescriptorAllocatorArrayBinding) {
+  static const uint32_t ARRAY_LEN = 4;
+  memory::DescriptorSetLayout layout(dev());
+  ASSERT_NO_FATAL_FAILURE(makeLayout(
+      layout,
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+      {ARRAY_LEN, 1}));
+  memory::DescriptorAllocator alloc(dev());
+  alloc.setsPerPool = 2;
+  ASSERT_EQ(alloc.ctorError(), 0);
+  ASSERT_EQ(alloc.beginFrame(0), 0);
+
+  for (size_t i = 0; i < 3; i++) {
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    ASSERT_EQ(alloc.alloc(layout, set), 0) << "i " << i;
+  }
+  ASSERT_EQ(alloc.typesPerSet.count(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
+            size_t(ARRAY_LEN));
+  ASSERT_EQ(alloc.typesPerSet.count(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            size_t(1));
+  ASSERT_EQ(alloc.poolCount(0), size_t(2));
+}
+
+// ParallelRecorderFence checks that record() reuses frame_i once primary is
+// submitted with fence(frame_i), and that a primary that is never submitted
+// makes record() fail instead of waiting forever, until cancel() is called.
+TEST_F(HeadlessTests, ParallelRecorderFence) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  std::vector<VkCommandBuffer> vk(1);
+  ASSERT_EQ(cpool.alloc(vk), 0);
+  command::CommandBuffer primary(cpool);
+  primary.vk = vk.at(0);
+  // With no jobs, record() never uses pass or framebuf.
+  command::RenderPass pass(dev());
+  language::Framebuf framebuf(dev());
+  auto job = [](command::CommandBuffer&, size_t) -> int { return 1; };
+
+  science::ParallelRecorder rec(dev());
+  rec.nThreads = 2;
+  rec.framesInFlight = 1;
+  rec.fenceTimeout = 1000000;  // 1ms
+  ASSERT_EQ(rec.ctorError(), 0);
+
+  for (size_t i = 0; i < 2; i++) {
+    if (i) {
+      // primary must not be pending when it is begun again. record() then
+      // also waits for the fence and resets it.
+      ASSERT_EQ(
+          rec.fence(0).wait(dev(), std::numeric_limits<uint64_t>::max()),
+          VK_SUCCESS);
+    }
+    ASSERT_EQ(primary.beginOneTimeUse(), 0) << "i " << i;
+    ASSERT_EQ(rec.record(0, primary, pass, 0, framebuf, 0, job), 0);
+    ASSERT_EQ(primary.end(), 0) << "i " << i;
+    ASSERT_EQ(primary.submit(0, {}, {}, {}, rec.fence(0).vk), 0) << "i " << i;
+  }
+  ASSERT_EQ(rec.fence(0).wait(dev(), std::numeric_limits<uint64_t>::max()),
+            VK_SUCCESS);
+
+  // primary is not submitted this time.
+  ASSERT_EQ(primary.beginOneTimeUse(), 0);
+  ASSERT_EQ(rec.record(0, primary, pass, 0, framebuf, 0, job), 0);
+  ASSERT_EQ(primary.end(), 0);
+  ASSERT_NE(rec.record(0, primary, pass, 0, framebuf, 0, job), 0);
+  ASSERT_EQ(rec.cancel(0), 0);
+  ASSERT_NE(rec.cancel(0), 0);
+  ASSERT_EQ(rec.record(0, primary, pass, 0, framebuf, 0, job), 0);
+  ASSERT_EQ(rec.cancel(0), 0);
+  cpool.free(vk);
+}
+
+// SubmitAsyncInFlight keeps several one-time command buffers in flight at
+// once and checks that each onDone is called exactly once.
+TEST_F(HeadlessTests, SubmitAsyncInFlight) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  int done = 0;
+  std::vector<std::shared_ptr<science::AsyncSubmit>> inFlight(3);
+  for (auto& a : inFlight) {
+    science::SmartCommandBuffer cmd(cpool, 0);
+    ASSERT_EQ(cmd.ctorError(), 0);
+    ASSERT_EQ(cmd.submitAsync(a, [&done] { done++; }), 0);
+    ASSERT_TRUE(!!a);
+  }
+  for (auto& a : inFlight) {
+    ASSERT_EQ(a->wait(), 0);
+    ASSERT_TRUE(a->isDone());
+  }
+  ASSERT_EQ(done, 3);
+  // A finished AsyncSubmit does not call onDone again.
+  ASSERT_EQ(inFlight.at(0)->poll(), 0);
+  ASSERT_EQ(inFlight.at(0)->wait(), 0);
+  ASSERT_EQ(done, 3);
+}
+
+// StagingRingOffsets checks where StagingRing::alloc places each upload, and
+// that begin() reuses a frame's region once its fence has signalled.
+TEST_F(HeadlessTests, StagingRingOffsets) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  memory::StagingRing ring(cpool);
+  ring.framesInFlight = 3;
+  ring.frameSize = 1000;
+  ASSERT_EQ(ring.ctorError(), 0);
+  VkDeviceSize copyAlign =
+      dev().physProp.properties.limits.optimalBufferCopyOffsetAlignment;
+  if (!copyAlign) {
+    copyAlign = 1;
+  }
+  // ctorError rounds frameSize up so each frame starts aligned.
+  ASSERT_GE(ring.frameSize, VkDeviceSize(1000));
+  ASSERT_EQ(ring.frameSize % copyAlign, VkDeviceSize(0));
+  ASSERT_EQ(ring.buf.info.size, ring.frameSize * 3);
+
+  void* p;
+  VkDeviceSize off;
+  ASSERT_NE(ring.alloc(1, &p, &off), 0);  // alloc before begin().
+  for (size_t pass = 0; pass < 2; pass++) {
+    ASSERT_EQ(ring.begin(1), 0) << "pass " << pass;
+    VkDeviceSize base = ring.frameSize;
+    ASSERT_EQ(ring.alloc(1, &p, &off), 0);
+    ASSERT_EQ(off, base) << "pass " << pass;
+    ASSERT_EQ(reinterpret_cast<char*>(p) -
+                  reinterpret_cast<char*>(ring.buf.mem.mapped),
+              ptrdiff_t(off));
+
+    // A 3-byte texel block: the offset in buf must be a multiple of both.
+    VkDeviceSize prev = off;
+    ASSERT_EQ(ring.alloc(6, &p, &off, 3), 0);
+    ASSERT_GT(off, prev);
+    ASSERT_EQ(off % 3, VkDeviceSize(0));
+    ASSERT_EQ(off % copyAlign, VkDeviceSize(0));
+    ASSERT_LE(off + 6, base + ring.frameSize);
+
+    // There is no room left for a whole frame.
+    ASSERT_NE(ring.alloc(ring.frameSize, &p, &off), 0);
+    ASSERT_NE(ring.begin(2), 0);  // begin without end().
+    ASSERT_EQ(ring.end(), 0);
+  }
+  ASSERT_NE(ring.begin(3), 0);
+}
+
+// FencePoolRecycles checks that a signaled fence calls its onDone and is
+// recycled, and that cancel() recycles a fence that was never submitted.
+TEST_F(HeadlessTests, FencePoolRecycles) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  command::FencePool pool(dev());
+  int done1 = 0, done2 = 0;
+  VkFence f1 = pool.get([&done1] { done1++; });
+  VkFence f2 = pool.get([&done2] { done2++; });
+  ASSERT_TRUE(f1 != VK_NULL_HANDLE && f2 != VK_NULL_HANDLE);
+  ASSERT_TRUE(f1 != f2);
+  ASSERT_EQ(pool.pendingSize(), size_t(2));
+
+  // A submit with no batches signals its fence when the queue is idle.
+  ASSERT_EQ(vkQueueSubmit(cpool.q(0), 0, nullptr, f1), VK_SUCCESS);
+  ASSERT_EQ(pool.wait({f1}, true, std::numeric_limits<uint64_t>::max()),
+            VK_SUCCESS);
+  ASSERT_EQ(done1, 1);
+  ASSERT_EQ(pool.pendingSize(), size_t(1));
+  ASSERT_EQ(pool.poll(), 0);
+  ASSERT_EQ(done1, 1);
+  ASSERT_EQ(done2, 0);
+
+  ASSERT_EQ(pool.cancel(f2), 0);
+  ASSERT_NE(pool.cancel(f2), 0);
+  ASSERT_EQ(pool.pendingSize(), size_t(0));
+  ASSERT_EQ(done2, 0);
+
+  // Both fences come back from get(), reset to unsignaled.
+  std::set<VkFence> recycled{pool.get(), pool.get()};
+  ASSERT_EQ(recycled, std::set<VkFence>({f1, f2}));
+  for (auto f : recycled) {
+    ASSERT_EQ(vkGetFenceStatus(dev().dev, f), VK_NOT_READY);
+    ASSERT_EQ(pool.cancel(f), 0);
+  }
+}
+
+// QueryRingFrames checks that QueryRing reports each frame's queries when the
+// same frame_i comes around again, in the order begin() was called.
+TEST_F(HeadlessTests, QueryRingFrames) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  science::QueryRing occ(dev());
+  occ.framesInFlight = 2;
+  occ.maxQueries = 2;
+  ASSERT_EQ(occ.ctorError(), 0);
+
+  for (size_t frame = 0; frame < 3; frame++) {
+    size_t frame_i = frame % occ.framesInFlight;
+    science::SmartCommandBuffer cmd(cpool, 0);
+    ASSERT_EQ(cmd.ctorError(), 0);
+    ASSERT_EQ(cmd.autoSubmit(), 0);
+    ASSERT_EQ(occ.beginFrame(frame_i, cmd), 0) << "frame " << frame;
+    if (frame < occ.framesInFlight) {
+      ASSERT_EQ(occ.results.size(), size_t(0)) << "frame " << frame;
+    } else {
+      // frame 2 gets the results of frame 0.
+      ASSERT_EQ(occ.results.size(), size_t(2));
+      ASSERT_EQ(occ.results.at(0).id, size_t(0));
+      ASSERT_EQ(occ.results.at(1).id, size_t(1));
+      for (auto& r : occ.results) {
+        ASSERT_EQ(r.frame, uint64_t(0));
+        ASSERT_EQ(r.values.size(), size_t(1));
+        ASSERT_EQ(r.values.at(0), uint64_t(0));  // Nothing was drawn.
+      }
+    }
+    ASSERT_EQ(occ.begin(cmd, frame * 10), 0);
+    ASSERT_NE(occ.begin(cmd, 99), 0);  // Only one active query per cmd.
+    ASSERT_NE(occ.endFrame(cmd), 0);   // The query was not ended.
+    ASSERT_EQ(occ.end(cmd), 0);
+    ASSERT_EQ(occ.begin(cmd, frame * 10 + 1), 0);
+    ASSERT_EQ(occ.end(cmd), 0);
+    ASSERT_NE(occ.begin(cmd, 99), 0);  // All maxQueries are used.
+    ASSERT_EQ(occ.endFrame(cmd), 0);
+    // ~SmartCommandBuffer submits cmd and waits for it.
+  }
+}
+
+// RenderGraphOrder checks that compile() culls a pass whose result is never
+// used, and execute() calls the live passes in the order they were added.
+TEST_F(HeadlessTests, RenderGraphOrder) {
+  command::CommandPool cpool(dev());
+  ASSERT_EQ(cpool.ctorError(), 0);
+  std::vector<std::unique_ptr<memory::Buffer>> bufs;
+  for (size_t i = 0; i < 3; i++) {
+    bufs.emplace_back(new memory::Buffer(dev()));
+    auto& b = *bufs.back();
+    b.info.size = 256;
+    b.info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    ASSERT_EQ(b.ctorDeviceLocal(), 0);
+    ASSERT_EQ(b.bindMemory(), 0);
+  }
+  memory::Image img(dev());
+  img.info.extent = {4, 4, 1};
+  img.info.format = VK_FORMAT_R8G8B8A8_UNORM;
+  img.info.usage =
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  img.info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  ASSERT_EQ(img.ctorDeviceLocal(), 0);
+  ASSERT_EQ(img.bindMemory(), 0);
+
+  science::RenderGraph graph(dev());
+  auto out = graph.importBuffer(*bufs.at(0), true /*keep*/);
+  auto mid = graph.importBuffer(*bufs.at(1));
+  auto unused = graph.importBuffer(*bufs.at(2));
+  auto tex = graph.importImage(img, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  std::vector<size_t> order;
+  auto record = [&order](size_t i) {
+    return [&order, i](command::CommandBuffer&) -> int {
+      order.emplace_back(i);
+      return 0;
+    };
+  };
+  auto p0 = graph.addPass("mid", record(0));
+  auto p1 = graph.addPass("unused", record(1));
+  auto p2 = graph.addPass("tex", record(2));
+  auto p3 = graph.addPass("out", record(3));
+  typedef science::RenderGraph RG;
+  ASSERT_FALSE(graph.write(p0, mid, RG::storage()) ||
+               graph.write(p1, unused, RG::storage()) ||
+               graph.read(p1, mid, RG::storage()) ||
+               graph.write(p2, tex, RG::transferDst()) ||
+               graph.read(p3, mid, RG::storage()) ||
+               graph.write(p3, out, RG::storage()));
+  ASSERT_EQ(graph.compile(), 0);
+  ASSERT_FALSE(graph.isCulled(p0));
+  ASSERT_TRUE(graph.isCulled(p1));
+  ASSERT_FALSE(graph.isCulled(p2));
+  ASSERT_FALSE(graph.isCulled(p3));
+
+  {
+    science::SmartCommandBuffer cmd(cpool, 0);
+    ASSERT_EQ(cmd.ctorError(), 0);
+    ASSERT_EQ(cmd.autoSubmit(), 0);
+    ASSERT_EQ(graph.execute(cmd), 0);
+    // ~SmartCommandBuffer submits cmd and waits for it.
+  }
+  ASSERT_EQ(order, std::vector<size_t>({0, 2, 3}));
+  ASSERT_EQ(img.currentLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+}  // End of anonymous namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
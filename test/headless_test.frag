@@ -0,0 +1,9 @@
+// Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+  outColor = vec4(0.0, 1.0, 0.0, 1.0);
+}
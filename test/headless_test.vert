@@ -0,0 +1,14 @@
+// Copyright (c) 2018 the Volcano Authors. Licensed under the GPLv3.
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+// Draw one triangle that covers the whole framebuffer. No vertex buffer is
+// needed: the position is computed from gl_VertexIndex.
+void main() {
+  vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}